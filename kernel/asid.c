@@ -0,0 +1,205 @@
+// Address space identifiers.
+//
+// satp carries an ASID that tags the TLB entries made while
+// it is in effect, so switching page tables needs no TLB
+// flush as long as each address space has its own ASID.
+// The kernel page table uses ASID 0; each process gets one
+// the first time it returns to user space.
+//
+// ASIDs are handed out in generations. A process keeps its
+// ASID until the numbers run out; then a new generation
+// starts, every process gets a new number the next time it
+// returns to user space, and each hart flushes its whole TLB
+// before it first uses a number of the new generation. ASIDs
+// are never freed one at a time, so stale entries for a
+// number can only be from an earlier generation.
+//
+// The threads of a process share an address space, and with
+// it an ASID. A change to the page table is flushed by
+// address on the hart that makes it. mm->tlbsync has a bit
+// for each hart whose TLB holds nothing stale for the
+// address space; a hart whose bit is clear flushes the ASID
+// before it next returns to user space with it.
+// A mapping that was removed or made less permissive must
+// also be gone from the other harts running a thread of the
+// process right now, before its page can be freed:
+// tlbshootdown() interrupts them and waits until each has
+// flushed its TLB. A hart that waits for a spinlock with
+// interrupts off answers while it spins, so a shootdown
+// can't deadlock with a thread waiting for a lock that the
+// caller holds. A new or more permissive mapping needs only
+// asidflush(): another hart that faults on its stale entry
+// finds the page mapped and flushes then (uvmcheckstale()).
+//
+// With `make NOASID=1`, or on hardware with too few ASID
+// bits, user ASIDs are 0 and trampoline.S flushes the whole
+// TLB on every switch, as xv6 always did.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
+#include "defs.h"
+
+#define ASIDBITS 16
+#define ASIDMASK ((1L << ASIDBITS) - 1)
+#define ASIDFLUSHMAX 32  // flush the whole ASID for more pages
+
+static struct {
+    struct spinlock lock;
+    uint64 gen;    // current generation
+    uint64 next;   // next unused ASID of the generation
+    uint64 nasid;  // ASIDs the hardware has; 0 if not used
+
+    // statistics, protected by lock.
+    int nalloc;
+    int nrollover;
+    int nshootdown;  // atomic; harts interrupted by tlbshootdown()
+} asid;
+
+// Find out how many ASID bits the hardware implements.
+// Called once, on hart 0, with paging on.
+void asidinit(void) {
+    initlock(&asid.lock, "asid");
+    asid.gen = 1;
+    asid.next = 1;
+#ifndef NOASID
+    // unimplemented bits of the ASID field read as 0.
+    uint64 satp = r_satp();
+    w_satp(satp | SATP_ASID_MASK);
+    uint64 n = ((r_satp() & SATP_ASID_MASK) >> SATP_ASID_SHIFT) + 1;
+    w_satp(satp);
+    sfence_vma();
+    // every hart may still be running a process with a
+    // number from the last generation.
+    if (n >= 2 * NCPU) asid.nasid = n;
+#endif
+}
+
+// Return the satp value for running p in user space on
+// this hart, after flushing whatever the TLB may hold that
+// is stale for p. Called with interrupts off.
+uint64 asidswitch(struct proc *p) {
+    struct mm *mm = p->mm;
+    struct cpu *c = mycpu();
+    uint bit = 1 << cpuid();
+
+    if (asid.nasid == 0) return MAKE_SATP(mm->pagetable);
+
+    uint64 gen = __atomic_load_n(&asid.gen, __ATOMIC_ACQUIRE);
+    if ((__atomic_load_n(&mm->asid, __ATOMIC_ACQUIRE) >> ASIDBITS) != gen) {
+        acquire(&asid.lock);
+        // another thread may have got mm a number meanwhile.
+        if ((mm->asid >> ASIDBITS) != asid.gen) {
+            if (asid.next == asid.nasid) {
+                asid.gen++;
+                asid.next = 1;
+                asid.nrollover++;
+            }
+            // no hart has entries for a new number.
+            __atomic_store_n(&mm->tlbsync, ~0U, __ATOMIC_RELAXED);
+            __atomic_store_n(&mm->asid, (asid.gen << ASIDBITS) | asid.next++,
+                             __ATOMIC_RELEASE);
+            asid.nalloc++;
+        }
+        gen = asid.gen;
+        release(&asid.lock);
+    }
+
+    // pairs with the barrier in tlbshootdown(): either it
+    // sees c->proc, or this sees the cleared bit.
+    __sync_synchronize();
+    if (c->asidgen != gen) {
+        sfence_vma();
+        c->asidgen = gen;
+    } else if ((__atomic_load_n(&mm->tlbsync, __ATOMIC_RELAXED) & bit) == 0) {
+        sfence_vma_asid(mm->asid & ASIDMASK);
+    }
+    __atomic_fetch_or(&mm->tlbsync, bit, __ATOMIC_RELAXED);
+    return MAKE_SATP_ASID(mm->pagetable, mm->asid & ASIDMASK);
+}
+
+// Flush this hart's TLB entries for npages pages at va in
+// mm, after a mapping there was added or made more
+// permissive. mm must be the current process's.
+void asidflush(struct mm *mm, uint64 va, uint64 npages) {
+    uint64 n = mm->asid & ASIDMASK;
+
+    if (n == 0) return;  // nothing cached, or no ASIDs
+    push_off();
+    if (npages > ASIDFLUSHMAX) {
+        sfence_vma_asid(n);
+    } else {
+        for (uint64 i = 0; i < npages; i++) sfence_vma_page(va + i * PGSIZE, n);
+    }
+    pop_off();
+}
+
+// Flush the TLB entries for npages pages at va in mm from
+// every hart, after a mapping there was removed or made less
+// permissive: this one at once, every other hart that is
+// running a thread of mm before this returns, and the rest
+// before they next use mm. Then no hart can reach the pages
+// that were mapped there before. mm need not be the current
+// process's (see vmatruncate()).
+void tlbshootdown(struct mm *mm, uint64 va, uint64 npages) {
+    uint mask = 0;
+
+    push_off();
+    int id = cpuid();
+    struct proc *p = mycpu()->proc;
+    asidflush(mm, va, npages);
+    // this hart stays up to date only if it was before.
+    __atomic_and_fetch(&mm->tlbsync, 1U << id, __ATOMIC_RELAXED);
+    if (p && p->mm == mm && mm->nthread <= 1) {
+        pop_off();
+        return;
+    }
+    __sync_synchronize();
+    for (int i = 0; i < NCPU; i++) {
+        // procs are never freed, so a stale c->proc is safe
+        // to look at.
+        struct proc *q = __atomic_load_n(&cpus[i].proc, __ATOMIC_RELAXED);
+        if (i == id || q == 0 || q->mm != mm) continue;
+        __atomic_store_n(&cpus[i].tlbflush, 1, __ATOMIC_RELEASE);
+        ipi(i);
+        mask |= 1 << i;
+    }
+    for (int i = 0; i < NCPU; i++) {
+        if ((mask & (1 << i)) == 0) continue;
+        __atomic_fetch_add(&asid.nshootdown, 1, __ATOMIC_RELAXED);
+        // another hart may be shooting down this one's TLB.
+        while (__atomic_load_n(&cpus[i].tlbflush, __ATOMIC_ACQUIRE))
+            tlbcheck();
+    }
+    pop_off();
+}
+
+// Flush this hart's TLB if tlbshootdown() asked for it.
+// Called with interrupts off.
+void tlbcheck(void) {
+    struct cpu *c = mycpu();
+
+    if (__atomic_load_n(&c->tlbflush, __ATOMIC_ACQUIRE)) {
+        sfence_vma();
+        __atomic_store_n(&c->tlbflush, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Report ASID usage for the stats device.
+int statsasid(char *buf, int sz) {
+    int n;
+
+    acquire(&asid.lock);
+    n = snprintf(buf, sz,
+                 "--- asid\nasids %d, generation %d, allocated %d, "
+                 "rollovers %d, shootdowns %d\n",
+                 (int)asid.nasid, (int)asid.gen, asid.nalloc, asid.nrollover,
+                 asid.nshootdown);
+    release(&asid.lock);
+    return n;
+}
@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,6 +12,25 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+//
+// Buffers are hashed by block number into NBUCKET chains,
+// each with its own lock, which protects the chain and the
+// refcnt, dev and blockno of the buffers on it. Each buffer
+// also belongs to one of NSHARD shards; a shard keeps the
+// unused buffers (refcnt == 0) that belong to it on a list,
+// most recently used first, under the shard's lock. A
+// bucket's lock comes before a shard's.
+//
+// On a miss, bget() takes the least recently used buffer of
+// this hart's shard, or of the next shard that has one: the
+// last on its list. It can't lock the buffer's bucket while
+// it holds the shard lock, so it notes the buffer, takes the
+// locks in order, and tries again if the buffer was taken or
+// reused meanwhile. The buffer leaves its chain and list
+// with refcnt 1, so that no one else can find it, and joins
+// the chain for its new block. If another process cached
+// the block meanwhile, the buffer goes back empty, to the
+// cold end of its list.
 
 #include "types.h"
 #include "param.h"
@@ -22,34 +41,154 @@
 #include "fs.h"
 #include "buf.h"
 
-// refer to https://blog.miigon.net/posts/s081-lab8-locks/
-extern uint ticks;
+#define NSHARD 4
+
+struct bshard {
+    struct spinlock lock;
+    struct buf head;  // unused buffers; head.next is the most recently used
+
+    // statistics, protected by lock.
+    int nevict;  // buffers taken for another block
+    int nscan;   // buffers looked at to find them
+};
+
+struct bucket {
+    struct spinlock lock;
+    struct buf *head;
+
+    // statistics, protected by lock.
+    int nhit;
+    int nmiss;
+    int nrace;  // misses that found the block cached on the second look
+};
+
 struct {
-    struct spinlock eviction_lock;
     struct buf buf[NBUF];
-
-    struct buf buf_hash[NBUCKET];
-    struct spinlock buf_hash_locks[NBUCKET];
+    struct bucket bucket[NBUCKET];
+    struct bshard shard[NSHARD];
 } bcache;
 
-void binit(void) {
-    // struct buf *b;
+// Put b on bucket's chain.
+static void hashin(struct bucket *bk, struct buf *b) {
+    b->hnext = bk->head;
+    b->hprev = &bk->head;
+    if (bk->head) bk->head->hprev = &b->hnext;
+    bk->head = b;
+}
+
+static void hashout(struct buf *b) {
+    *b->hprev = b->hnext;
+    if (b->hnext) b->hnext->hprev = b->hprev;
+}
+
+// Put b on its shard's list, at the front if recent, else
+// at the back. Caller must hold the shard's lock.
+static void lruin(struct buf *b, int recent) {
+    struct buf *h = &bcache.shard[b->shard].head;
+
+    if (recent) {
+        b->next = h->next;
+        b->prev = h;
+    } else {
+        b->next = h;
+        b->prev = h->prev;
+    }
+    b->next->prev = b;
+    b->prev->next = b;
+}
+
+static void lruout(struct buf *b) {
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+}
+
+// Take a reference to b. Caller must hold b's bucket lock.
+static void bref(struct buf *b) {
+    if (b->refcnt++ == 0) {
+        struct bshard *s = &bcache.shard[b->shard];
+        acquire(&s->lock);
+        lruout(b);
+        release(&s->lock);
+    }
+}
 
-    initlock(&bcache.eviction_lock, "bcache_eviction");
+// Drop a reference to b, which was in use recently if
+// recent is set. Caller must hold b's bucket lock.
+static void bunref(struct buf *b, int recent) {
+    if (--b->refcnt == 0) {
+        struct bshard *s = &bcache.shard[b->shard];
+        acquire(&s->lock);
+        lruin(b, recent);
+        release(&s->lock);
+    }
+}
 
-    for (int i = 0; i < NBUCKET; i++) {
-        initlock(&bcache.buf_hash_locks[i], "bcache_hash");
-        bcache.buf_hash[i].next = 0;
+void binit(void) {
+    for (int i = 0; i < NSHARD; i++) {
+        struct bshard *s = &bcache.shard[i];
+        initlock(&s->lock, "bcache_lru");
+        s->head.prev = &s->head;
+        s->head.next = &s->head;
     }
+    for (int i = 0; i < NBUCKET; i++)
+        initlock(&bcache.bucket[i].lock, "bcache_hash");
 
-    // put all buffers to hash table[0]
+    // every buffer starts out empty, as block 0 of device 0,
+    // which no one reads.
     for (int i = 0; i < NBUF; i++) {
         struct buf *b = &bcache.buf[i];
         initsleeplock(&b->lock, "buffer");
-        b->lastuse = 0;
         b->refcnt = 0;
-        b->next = bcache.buf_hash[0].next;
-        bcache.buf_hash[0].next = b;
+        b->shard = i % NSHARD;
+        hashin(&bcache.bucket[BUFMAP_HASH(0)], b);
+        lruin(b, 0);
+    }
+}
+
+// Return the least recently used buffer of one shard or
+// another, off its chain and list, with refcnt 1.
+static struct buf *bevict(void) {
+    struct bshard *s;
+    struct bucket *bk;
+    struct buf *b;
+    int i0, nscan = 0;
+
+    push_off();
+    i0 = cpuid() % NSHARD;
+    pop_off();
+    for (;;) {
+        int empty = 1;
+        for (int i = 0; i < NSHARD; i++) {
+            s = &bcache.shard[(i0 + i) % NSHARD];
+            acquire(&s->lock);
+            b = s->head.prev;
+            if (b == &s->head) {
+                release(&s->lock);
+                continue;
+            }
+            empty = 0;
+            nscan++;
+            bk = &bcache.bucket[BUFMAP_HASH(b->blockno)];
+            release(&s->lock);
+
+            // still unused, and still on bk's chain?
+            acquire(&bk->lock);
+            if (bk == &bcache.bucket[BUFMAP_HASH(b->blockno)] && b->refcnt == 0) {
+                hashout(b);
+                b->refcnt = 1;
+                acquire(&s->lock);
+                lruout(b);
+                s->nevict++;
+                s->nscan += nscan;
+                release(&s->lock);
+                release(&bk->lock);
+                return b;
+            }
+            release(&bk->lock);
+            break;  // raced; look again from the start
+        }
+        // every buffer is in use.
+        if (empty) panic("bget: no buffers");
     }
 }
 
@@ -57,88 +196,55 @@ void binit(void) {
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
 static struct buf *bget(uint dev, uint blockno) {
-    struct buf *b;
-
-    uint key = BUFMAP_HASH(blockno);
-    acquire(&bcache.buf_hash_locks[key]);
+    struct bucket *bk = &bcache.bucket[BUFMAP_HASH(blockno)];
+    struct buf *b, *victim;
 
+    acquire(&bk->lock);
     // Is the block already cached?
-    for (b = bcache.buf_hash[key].next; b; b = b->next) {
+    for (b = bk->head; b; b = b->hnext) {
         if (b->dev == dev && b->blockno == blockno) {
-            b->refcnt++;
-            release(&bcache.buf_hash_locks[key]);
+            bref(b);
+            bk->nhit++;
+            release(&bk->lock);
             acquiresleep(&b->lock);
             return b;
         }
     }
+    bk->nmiss++;
+    release(&bk->lock);
 
-    release(&bcache.buf_hash_locks[key]);
+    // Not cached.
+    // Recycle the least recently used (LRU) unused buffer.
+    victim = bevict();
 
-    acquire(&bcache.eviction_lock);
-    for (b = bcache.buf_hash[key].next; b; b = b->next) {
+    acquire(&bk->lock);
+    // another process may have cached it meanwhile.
+    for (b = bk->head; b; b = b->hnext) {
         if (b->dev == dev && b->blockno == blockno) {
-            acquire(&bcache.buf_hash_locks[key]);
-            b->refcnt++;
-            release(&bcache.buf_hash_locks[key]);
+            bref(b);
+            bk->nrace++;
+            release(&bk->lock);
+
+            // give the victim back, empty.
+            struct bucket *bk0 = &bcache.bucket[BUFMAP_HASH(0)];
+            acquire(&bk0->lock);
+            victim->dev = 0;
+            victim->blockno = 0;
+            victim->valid = 0;
+            hashin(bk0, victim);
+            bunref(victim, 0);
+            release(&bk0->lock);
 
-            release(&bcache.eviction_lock);
             acquiresleep(&b->lock);
             return b;
         }
     }
-
-    // for (b = bcache.head.next; b != &bcache.head; b = b->next) {
-    //     if (b->dev == dev && b->blockno == blockno) {
-    //         b->refcnt++;
-    //         release(&bcache.lock);
-    //         acquiresleep(&b->lock);
-    //         return b;
-    //     }
-    // }
-
-    // Not cached.
-    // Recycle the least recently used (LRU) unused buffer.
-
-    // buf_find find the previous one that meets the requirements
-    struct buf *buf_find = 0;
-    uint flag = 0;
-    uint before = -1;
-    for (int i = 0; i < NBUCKET; i++) {
-        if (i == key) continue;
-        acquire(&bcache.buf_hash_locks[i]);
-
-        // buf_find = bcache.buf_hash[i].next;
-        for (b = &bcache.buf_hash[i]; b->next; b = b->next) {
-            if (b->next->refcnt == 0 &&
-                ((!buf_find) || b->next->lastuse < buf_find->next->lastuse)) {
-                flag = 1;
-                buf_find = b;
-            }
-        }
-        if (flag == 0) {
-            release(&bcache.buf_hash_locks[i]);
-        } else {
-            if (before != -1) release(&bcache.buf_hash_locks[before]);
-            before = i;
-        }
-        flag = 0;
-    }
-    if (!buf_find) panic("bget: no buffers");
-    
-    b = buf_find->next;
-    buf_find->next = b->next;
-    release(&bcache.buf_hash_locks[before]);
-
-    acquire(&bcache.buf_hash_locks[key]);
-    b->next = bcache.buf_hash[key].next;
-    bcache.buf_hash[key].next = b;
-
+    b = victim;
     b->dev = dev;
     b->blockno = blockno;
     b->valid = 0;
-    b->refcnt = 1;
-    release(&bcache.buf_hash_locks[key]);
-    release(&bcache.eviction_lock);
+    hashin(bk, b);
+    release(&bk->lock);
     acquiresleep(&b->lock);
     return b;
 }
@@ -162,39 +268,52 @@ void bwrite(struct buf *b) {
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// If no one else uses it, put it at the front of its
+// shard's list.
 void brelse(struct buf *b) {
     if (!holdingsleep(&b->lock)) panic("brelse");
 
     releasesleep(&b->lock);
 
-    uint key = BUFMAP_HASH(b->blockno);
-    acquire(&bcache.buf_hash_locks[key]);
-    b->refcnt--;
-    if (b->refcnt == 0) {
-        // no one is waiting for it.
-        // b->next->prev = b->prev;
-        // b->prev->next = b->next;
-        // b->next = bcache.head.next;
-        // b->prev = &bcache.head;
-        // bcache.head.next->prev = b;
-        // bcache.head.next = b;
-        b->lastuse = ticks;
-    }
-
-    release(&bcache.buf_hash_locks[key]);
+    struct bucket *bk = &bcache.bucket[BUFMAP_HASH(b->blockno)];
+    acquire(&bk->lock);
+    bunref(b, 1);
+    release(&bk->lock);
 }
 
 void bpin(struct buf *b) {
-    uint key = BUFMAP_HASH(b->blockno);
-    acquire(&bcache.buf_hash_locks[key]);
-    b->refcnt++;
-    release(&bcache.buf_hash_locks[key]);
+    struct bucket *bk = &bcache.bucket[BUFMAP_HASH(b->blockno)];
+    acquire(&bk->lock);
+    bref(b);
+    release(&bk->lock);
 }
 
 void bunpin(struct buf *b) {
-    uint key = BUFMAP_HASH(b->blockno);
-    acquire(&bcache.buf_hash_locks[key]);
-    b->refcnt--;
-    release(&bcache.buf_hash_locks[key]);
+    struct bucket *bk = &bcache.bucket[BUFMAP_HASH(b->blockno)];
+    acquire(&bk->lock);
+    bunref(b, 1);
+    release(&bk->lock);
+}
+
+// Report buffer cache activity for the stats device.
+int statsbcache(char *buf, int sz) {
+    int nhit = 0, nmiss = 0, nrace = 0, nevict = 0, nscan = 0;
+
+    for (struct bucket *bk = bcache.bucket; bk < &bcache.bucket[NBUCKET]; bk++) {
+        acquire(&bk->lock);
+        nhit += bk->nhit;
+        nmiss += bk->nmiss;
+        nrace += bk->nrace;
+        release(&bk->lock);
+    }
+    for (struct bshard *s = bcache.shard; s < &bcache.shard[NSHARD]; s++) {
+        acquire(&s->lock);
+        nevict += s->nevict;
+        nscan += s->nscan;
+        release(&s->lock);
+    }
+    return snprintf(buf, sz,
+                    "--- bcache\nhits %d, misses %d, raced misses %d, "
+                    "evictions %d, buffers scanned %d\n",
+                    nhit, nmiss, nrace, nevict, nscan);
 }
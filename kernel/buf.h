@@ -5,9 +5,11 @@ struct buf {
     uint blockno;
     struct sleeplock lock;
     uint refcnt;
-    uint lastuse;
-    struct buf *prev;  // LRU cache list
+    int shard;           // whose LRU list it goes on when unused
+    struct buf *prev;    // LRU list of its shard
     struct buf *next;
+    struct buf *hnext;   // hash chain
+    struct buf **hprev;  // link that points to this one
     uchar data[BSIZE];
 };
 
@@ -75,12 +75,12 @@ int consolewrite(int user_src, uint64 src, int n) {
 //
 int consoleread(int user_dst, uint64 dst, int n) {
     uint target;
-    int c;
-    char cbuf;
+    int c, m, done = 0;
+    char cbuf[INPUT_BUF_SIZE];
 
     target = n;
-    acquire(&cons.lock);
-    while (n > 0) {
+    while (n > 0 && !done) {
+        acquire(&cons.lock);
         // wait until interrupt handler has put some
         // input into cons.buffer.
         while (cons.r == cons.w) {
@@ -91,31 +91,36 @@ int consoleread(int user_dst, uint64 dst, int n) {
             sleep(&cons.r, &cons.lock);
         }
 
-        c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
+        for (m = 0; m < n && m < INPUT_BUF_SIZE && cons.r != cons.w;) {
+            c = cons.buf[cons.r++ % INPUT_BUF_SIZE];
 
-        if (c == C('D')) {  // end-of-file
-            if (n < target) {
-                // Save ^D for next time, to make sure
-                // caller gets a 0-byte result.
-                cons.r--;
+            if (c == C('D')) {  // end-of-file
+                if (m > 0 || n < target) {
+                    // Save ^D for next time, to make sure
+                    // caller gets a 0-byte result.
+                    cons.r--;
+                }
+                done = 1;
+                break;
             }
-            break;
-        }
-
-        // copy the input byte to the user-space buffer.
-        cbuf = c;
-        if (either_copyout(user_dst, dst, &cbuf, 1) == -1) break;
 
-        dst++;
-        --n;
+            cbuf[m++] = c;
 
-        if (c == '\n') {
-            // a whole line has arrived, return to
-            // the user-level read().
-            break;
+            if (c == '\n') {
+                // a whole line has arrived, return to
+                // the user-level read().
+                done = 1;
+                break;
+            }
         }
+        release(&cons.lock);
+
+        // copy the input to the user-space buffer, without
+        // the lock, since copyout() may fault a page in.
+        if (m > 0 && either_copyout(user_dst, dst, cbuf, m) == -1) break;
+        dst += m;
+        n -= m;
     }
-    release(&cons.lock);
 
     return target - n;
 }
@@ -0,0 +1,203 @@
+// Directory entry cache, for path lookups that lock nothing.
+//
+// A dentry records that directory dir on dev has an entry
+// name for inode inum, and inum's type if it was known when
+// the entry was added. namex() adds the entries it finds
+// with dirlookup(), and tries the cache first on its next
+// walk: if every element of a path is cached it takes no
+// inode locks and reads no directory blocks.
+//
+// Readers walk the hash chains inside an RCU read section,
+// with no locks; writers hold dcache.lock, publish new
+// entries with a release store, and hand the ones they
+// take out to rcuretire(). Only "." and ".." are never
+// cached, so that a dentry always stands for a live entry
+// of a directory: one can't be emptied, and so freed,
+// while it has dentries under it.
+//
+// Removing a name from a directory bumps dcache.seq, a
+// seqlock. A lockless walk notes it before it starts and
+// checks it after it has got the inode it found; if a name
+// went away meanwhile, the inode may have been freed and its
+// number reused, and the walk starts over the slow way. A
+// dentry added by a walk that started before such a removal
+// may be stale, so dcacheadd() drops it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "seqlock.h"
+#include "proc.h"
+#include "fs.h"
+#include "rcu.h"
+#include "defs.h"
+
+#define NDHASH 61
+#define NDENTRY 512
+
+struct dentry {
+    struct dentry *next;  // hash chain; read without locks
+    uint dev;
+    uint dir;             // inum of the directory
+    char name[DIRSIZ];
+    uint inum;
+    short type;           // of inum, or 0 if not known
+    struct rcuhead rcu;
+};
+
+static struct {
+    struct spinlock lock;  // for writers
+    struct seqlock seq;    // bumped by every removal
+    struct kmem_cache *cache;
+    struct dentry *hash[NDHASH];
+    int n;
+
+    // statistics, protected by lock.
+    int nadd;
+    int nstale;   // adds dropped after a removal
+    int nremove;
+    int nevict;
+} dcache;
+
+// per-CPU statistics, so that readers don't share a line.
+static struct {
+    int nhit;
+    int nmiss;
+    int nretry;  // walks that raced with a removal
+} __attribute__((aligned(64))) dstats[NCPU];
+
+static uint dhash(uint dev, uint dir, char *name) {
+    uint h = dev * 31 + dir;
+
+    for (int i = 0; i < DIRSIZ && name[i]; i++) h = h * 31 + name[i];
+    return h % NDHASH;
+}
+
+void dcacheinit(void) {
+    initlock(&dcache.lock, "dcache");
+    initseqlock(&dcache.seq);
+    dcache.cache = kmem_cache_create("dentry", sizeof(struct dentry), 0, 0);
+}
+
+static void dfree(void *d) { kmem_cache_free(dcache.cache, d); }
+
+// Return the sequence number for dcacheretry() or
+// dcacheadd(): the removals so far.
+uint dcachebegin(void) { return readseqbegin(&dcache.seq); }
+
+// Has a name been removed since dcachebegin() returned
+// seq? Called with interrupts off.
+int dcacheretry(uint seq) {
+    if (!readseqretry(&dcache.seq, seq)) return 0;
+    dstats[cpuid()].nretry++;
+    return 1;
+}
+
+// Find name in directory dir, and set *inum and *type.
+// Returns 1 if found. Called inside an RCU read section.
+int dcachelookup(uint dev, uint dir, char *name, uint *inum, short *type) {
+    struct dentry *d = __atomic_load_n(&dcache.hash[dhash(dev, dir, name)],
+                                       __ATOMIC_ACQUIRE);
+
+    for (; d; d = __atomic_load_n(&d->next, __ATOMIC_ACQUIRE)) {
+        if (d->dev == dev && d->dir == dir && strncmp(d->name, name, DIRSIZ) == 0) {
+            *inum = d->inum;
+            *type = d->type;
+            dstats[cpuid()].nhit++;
+            return 1;
+        }
+    }
+    dstats[cpuid()].nmiss++;
+    return 0;
+}
+
+// Record that directory dir has an entry name for inum, of
+// type type, or 0 if not known, as found by a dirlookup()
+// after dcachebegin() returned seq.
+void dcacheadd(uint dev, uint dir, char *name, uint inum, short type, uint seq) {
+    struct dentry *d, *old = 0, **pp;
+    uint h = dhash(dev, dir, name);
+
+    if ((d = kmem_cache_alloc(dcache.cache)) == 0) return;
+    d->dev = dev;
+    d->dir = dir;
+    strncpy(d->name, name, DIRSIZ);
+    d->inum = inum;
+    d->type = type;
+
+    acquire(&dcache.lock);
+    if (readseqretry(&dcache.seq, seq)) {
+        dcache.nstale++;
+        goto out;
+    }
+    for (pp = &dcache.hash[h]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->dev == dev && (*pp)->dir == dir &&
+            strncmp((*pp)->name, name, DIRSIZ) == 0) {
+            if (type) (*pp)->type = type;
+            goto out;
+        }
+    }
+    if (dcache.n == NDENTRY) {
+        // make room by dropping the last of this chain.
+        if (dcache.hash[h] == 0) goto out;
+        for (pp = &dcache.hash[h]; (*pp)->next; pp = &(*pp)->next)
+            ;
+        old = *pp;
+        __atomic_store_n(pp, 0, __ATOMIC_RELEASE);
+        dcache.n--;
+        dcache.nevict++;
+    }
+    d->next = dcache.hash[h];
+    __atomic_store_n(&dcache.hash[h], d, __ATOMIC_RELEASE);
+    dcache.n++;
+    dcache.nadd++;
+    d = 0;
+out:
+    release(&dcache.lock);
+    if (d) kmem_cache_free(dcache.cache, d);
+    if (old) rcuretire(&old->rcu, dfree, old);
+}
+
+// Directory dir no longer has an entry name. Called by
+// unlink with the directory locked, after it has erased
+// the entry.
+void dcacheremove(uint dev, uint dir, char *name) {
+    struct dentry *d = 0, **pp;
+
+    acquire(&dcache.lock);
+    writeseqbegin(&dcache.seq);
+    for (pp = &dcache.hash[dhash(dev, dir, name)]; *pp; pp = &(*pp)->next) {
+        if ((*pp)->dev == dev && (*pp)->dir == dir &&
+            strncmp((*pp)->name, name, DIRSIZ) == 0) {
+            d = *pp;
+            __atomic_store_n(pp, d->next, __ATOMIC_RELEASE);
+            dcache.n--;
+            break;
+        }
+    }
+    writeseqend(&dcache.seq);
+    dcache.nremove++;
+    release(&dcache.lock);
+    if (d) rcuretire(&d->rcu, dfree, d);
+}
+
+// Report dentry cache activity for the stats device.
+int statsdcache(char *buf, int sz) {
+    int nhit = 0, nmiss = 0, nretry = 0, n;
+
+    for (int i = 0; i < NCPU; i++) {
+        nhit += dstats[i].nhit;
+        nmiss += dstats[i].nmiss;
+        nretry += dstats[i].nretry;
+    }
+    acquire(&dcache.lock);
+    n = snprintf(buf, sz,
+                 "--- dcache\nentries %d, hits %d, misses %d, retries %d, "
+                 "adds %d, stale adds %d, removals %d, evictions %d\n",
+                 dcache.n, nhit, nmiss, nretry, dcache.nadd, dcache.nstale,
+                 dcache.nremove, dcache.nevict);
+    release(&dcache.lock);
+    return n;
+}
@@ -1,18 +1,34 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
+struct kmem_cache;
+struct mm;
 struct pipe;
 struct proc;
+struct rcuhead;
+struct rwlock;
+struct seqlock;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timer;
+struct vma;
 #ifdef LAB_NET
 struct mbuf;
 struct sock;
 #endif
 
+// asid.c
+void            asidinit(void);
+uint64          asidswitch(struct proc *);
+void            asidflush(struct mm *, uint64, uint64);
+void            tlbshootdown(struct mm *, uint64, uint64);
+void            tlbcheck(void);
+int             statsasid(char *, int);
+
 // bio.c
 void binit(void);
 struct buf *bread(uint, uint);
@@ -20,6 +36,7 @@ void brelse(struct buf *);
 void bwrite(struct buf *);
 void bpin(struct buf *);
 void bunpin(struct buf *);
+int statsbcache(char *, int);
 
 // console.c
 void consoleinit(void);
@@ -29,10 +46,23 @@ void consputc(int);
 // exec.c
 int exec(char *, char **);
 
+// dcache.c
+void            dcacheinit(void);
+uint            dcachebegin(void);
+int             dcacheretry(uint);
+int             dcachelookup(uint, uint, char *, uint *, short *);
+void            dcacheadd(uint, uint, char *, uint, short, uint);
+void            dcacheremove(uint, uint, char *);
+int             statsdcache(char *, int);
+
 // file.c
 struct file *filealloc(void);
 void fileclose(struct file *);
 struct file *filedup(struct file *);
+struct files *filesalloc(void);
+struct files *filescopy(struct files *);
+struct files *filesdup(struct files *);
+void filesput(struct files *);
 void fileinit(void);
 int fileread(struct file *, uint64, int n);
 int filestat(struct file *, uint64 addr);
@@ -56,27 +86,61 @@ struct inode *nameiparent(char *, char *);
 int readi(struct inode *, int, uint64, uint, uint);
 void stati(struct inode *, struct stat *);
 int writei(struct inode *, int, uint64, uint, uint);
-void itrunc(struct inode *);
+int itrunc(struct inode *);
+int itext(struct inode *, int);
+int iwrite(struct inode *, int);
 
 // ramdisk.c
 void ramdiskinit(void);
 void ramdiskintr(void);
 void ramdiskrw(struct buf *);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(uint64, int, int);
+int             futexwake(uint64, int);
+int             statsfutex(char *, int);
+
 // kalloc.c
-<<<<<<< HEAD
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void*           kalloc_zeroed(void);
+int             kzerofill(void);
+void*           kalloc_order(int);
+void            kfree_order(void *, int);
+void            ksplit(void *, int);
 uint64          get_free_memory(void);
 void            addref(void *);
-void*           kcowcopy(void *); 
+int             krefcnt(void *);
+int             statskalloc(char *, int);
+
+// slab.c
+void            slabinit(void);
+struct kmem_cache* kmem_cache_create(char *, uint, void (*)(void *), void (*)(void *));
+void*           kmem_cache_alloc(struct kmem_cache *);
+void            kmem_cache_free(struct kmem_cache *, void *);
+int             statsslab(char *, int);
+
+// pcache.c
+void            pcacheinit(void);
+void*           pcache_get(struct inode *, uint);
+int             pcache_inval(struct inode *);
+void            pcache_write(struct inode *, uint, void *, uint);
+int             pcache_reclaim(void);
+int             pcache_nunmapped(void);
+int             statspcache(char *, int);
 
-=======
-void *kalloc(void);
-void kfree(void *);
-void kinit(void);
->>>>>>> lock
+// vma.c
+struct vma*     vmalookup(struct proc *, uint64);
+int             vmaoverlap(struct proc *, uint64, uint64);
+int             vmafault(struct proc *, uint64);
+void            vmaprefault(uint64, uint64);
+int             vmadup(struct proc *, struct proc *);
+void            vmafree(struct proc *);
+uint64          vmammap(uint64, uint64, int, int, struct file *, uint);
+int             vmamunmap(uint64, uint64);
+void            vmatruncate(struct inode *);
 
 // log.c
 void initlog(int, struct superblock *);
@@ -85,6 +149,7 @@ void begin_op(void);
 void end_op(void);
 
 // pipe.c
+void pipeinit(void);
 int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
 int piperead(struct pipe *, uint64, int);
@@ -98,9 +163,9 @@ void printfinit(void);
 // proc.c
 int             cpuid(void);
 void            exit(int);
+void            exitthread(int);
 int             fork(void);
-int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+uint64          growproc(int);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
 int             kill(int);
@@ -121,6 +186,16 @@ int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
 uint64          get_unused_process(void);
+void            setrunnable(struct proc *);
+int             statssched(char *, int);
+int             statswait(char *, int);
+int             sleepuntil(void *, struct spinlock *, uint);
+int             setpriority(int, int, int);
+int             getpriority(int, int *, int *);
+int             setaffinity(int, int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+void            mmforeach(void (*)(struct mm *, void *), void *);
 
 // swtch.S
 void swtch(struct context *, struct context *);
@@ -133,15 +208,38 @@ void release(struct spinlock *);
 void push_off(void);
 void pop_off(void);
 int atomic_read4(int *addr);
-#ifdef LAB_LOCK
 void freelock(struct spinlock *);
-#endif
+int statslock(char *, int);
 
 // sleeplock.c
 void acquiresleep(struct sleeplock *);
 void releasesleep(struct sleeplock *);
 int holdingsleep(struct sleeplock *);
 void initsleeplock(struct sleeplock *, char *);
+int statssleeplock(char *, int);
+
+// rcu.c
+void rcuinit(void);
+void rcureadlock(void);
+void rcureadunlock(void);
+void rcupoll(void);
+void rcuretire(struct rcuhead *, void (*)(void *), void *);
+int statsrcu(char *, int);
+
+// rwlock.c
+void initrwlock(struct rwlock *, char *);
+void acquireread(struct rwlock *);
+void releaseread(struct rwlock *);
+void acquirewrite(struct rwlock *);
+void releasewrite(struct rwlock *);
+int holdingwrite(struct rwlock *);
+
+// seqlock.c
+void initseqlock(struct seqlock *);
+uint readseqbegin(struct seqlock *);
+int readseqretry(struct seqlock *, uint);
+void writeseqbegin(struct seqlock *);
+void writeseqend(struct seqlock *);
 
 // string.c
 int memcmp(const void *, const void *, uint);
@@ -160,12 +258,27 @@ int fetchstr(uint64, char *, int);
 int fetchaddr(uint64, uint64 *);
 void syscall();
 
+// timer.c
+void            timerwheelinit(void);
+void            timerset(struct timer *, uint, void (*)(void *), void *);
+int             timerdel(struct timer *);
+void            timertick(uint);
+int             timernext(uint *);
+int             statstimer(char *, int);
+
 // trap.c
 extern uint ticks;
 void trapinit(void);
 void trapinithart(void);
 extern struct spinlock tickslock;
 void usertrapret(void);
+uint64 clocknow(void);
+void clockintr(void);
+uint getticks(void);
+void clockarm(uint);
+void clockslice(void);
+void clockdisarm(void);
+void ipi(int);
 
 // uart.c
 void uartinit(void);
@@ -184,8 +297,11 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcopyrange(pagetable_t, pagetable_t, uint64, uint64, int);
+void            uvmflush(pagetable_t, uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
+void            uvmunmapmm(struct mm *, uint64, uint64);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
@@ -194,6 +310,11 @@ int             copyin(pagetable_t, char *, uint64, uint64);
 int             copyinstr(pagetable_t, char *, uint64, uint64);
 int             uvmcheckcowpage(uint64);
 int             uvmcowcopy(uint64);
+uint64          uvmptneed(pagetable_t, uint64, uint64);
+int             uvmchecklazypage(uint64);
+int             uvmlazyalloc(uint64);
+int             uvmcheckstale(uint64, uint64);
+uint64          uvmwriteaddr(uint64);
 
 // plic.c
 void plicinit(void);
@@ -4,11 +4,11 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *, uint64, struct inode *, uint, uint);
-
 int flags2perm(int flags) {
     int perm = 0;
     if (flags & 0x1) perm = PTE_X;
@@ -24,8 +24,15 @@ int exec(char *path, char **argv) {
     struct inode *ip;
     struct proghdr ph;
     pagetable_t pagetable = 0, oldpagetable;
+    struct vma vma[NVMA], *v;
     struct proc *p = myproc();
 
+    // the other threads would lose their memory under them.
+    if (p->mm->ref > 1) return -1;
+
+    memset(vma, 0, sizeof(vma));
+    v = vma;
+
     begin_op();
 
     if ((ip = namei(path)) == 0) {
@@ -41,26 +48,35 @@ int exec(char *path, char **argv) {
 
     if ((pagetable = proc_pagetable(p)) == 0) goto bad;
 
-    // Load program into memory.
+    // Describe each program segment with a memory area;
+    // its pages are read in when first touched.
     for (i = 0, off = elf.phoff; i < elf.phnum; i++, off += sizeof(ph)) {
         if (readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph)) goto bad;
         if (ph.type != ELF_PROG_LOAD) continue;
         if (ph.memsz < ph.filesz) goto bad;
+        if (ph.memsz == 0) continue;
         if (ph.vaddr + ph.memsz < ph.vaddr) goto bad;
         if (ph.vaddr % PGSIZE != 0) goto bad;
-        uint64 sz1;
-        if ((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz,
-                            flags2perm(ph.flags))) == 0)
-            goto bad;
-        sz = sz1;
-        if (loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0) goto bad;
+        if (ph.vaddr < sz || ph.vaddr + ph.memsz >= USERTOP) goto bad;
+        if (ph.off + ph.filesz < ph.off) goto bad;
+        if (v == &vma[NVMA]) goto bad;
+        // the file can't be open for writing.
+        if (itext(ip, 1) < 0) goto bad;
+        v->start = ph.vaddr;
+        v->end = ph.vaddr + ph.memsz;
+        v->perm = flags2perm(ph.flags) | PTE_R;
+        v->ip = idup(ip);
+        v->off = ph.off;
+        v->filesz = ph.filesz;
+        v++;
+        sz = ph.vaddr + ph.memsz;
     }
     iunlockput(ip);
     end_op();
     ip = 0;
 
     p = myproc();
-    uint64 oldsz = p->sz;
+    uint64 oldsz = p->mm->sz;
 
     // Allocate two pages at the next page boundary.
     // Make the first inaccessible as a stack guard.
@@ -102,43 +118,37 @@ int exec(char *path, char **argv) {
         if (*s == '/') last = s + 1;
     safestrcpy(p->name, last, sizeof(p->name));
 
-    // Commit to the user image.
+    // Commit to the user image. The new page table has the
+    // trapframe in the first thread's slot.
+    vmafree(p);
+    struct mm *mm = p->mm;
+    acquire(&mm->lock);
+    memmove(mm->vma, vma, sizeof(vma));
     oldpagetable = p->pagetable;
-    p->pagetable = pagetable;
-    p->sz = sz;
+    mm->pagetable = p->pagetable = pagetable;
+    mm->asid = 0;  // the old ASID's TLB entries are stale
+    mm->sz = sz;
+    mm->frames = 1;
+    p->tframe = 0;
+    release(&mm->lock);
     p->trapframe->epc = elf.entry;  // initial program counter = main
     p->trapframe->sp = sp;          // initial stack pointer
+    p->trapframe->tp = 0;           // no thread pointer, see user/pthread.c
+    p->alarmticks = 0;              // the handler went with the old image
     proc_freepagetable(oldpagetable, oldsz);
 
     return argc;  // this ends up in a0, the first argument to main(argc, argv)
 
 bad:
     if (pagetable) proc_freepagetable(pagetable, sz);
-    if (ip) {
-        iunlockput(ip);
-        end_op();
+    if (!ip) begin_op();
+    for (v = vma; v < &vma[NVMA]; v++) {
+        if (v->ip) {
+            itext(v->ip, -1);
+            iput(v->ip);
+        }
     }
+    if (ip) iunlockput(ip);
+    end_op();
     return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int loadseg(pagetable_t pagetable, uint64 va, struct inode *ip,
-                   uint offset, uint sz) {
-    uint i, n;
-    uint64 pa;
-
-    for (i = 0; i < sz; i += PGSIZE) {
-        pa = walkaddr(pagetable, va + i);
-        if (pa == 0) panic("loadseg: address should exist");
-        if (sz - i < PGSIZE)
-            n = sz - i;
-        else
-            n = PGSIZE;
-        if (readi(ip, 0, (uint64)pa, offset + i, n) != n) return -1;
-    }
-
-    return 0;
-}
@@ -3,3 +3,16 @@
 #define O_RDWR 0x002
 #define O_CREATE 0x200
 #define O_TRUNC 0x400
+
+// mmap() protection
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+
+// mmap() flags
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+// a private anonymous area carved into stacks of off bytes
+// each, whose lowest page is a guard page that faults.
+#define MAP_STACK 0x40
@@ -15,26 +15,32 @@
 
 struct devsw devsw[NDEV];
 struct {
-    struct spinlock lock;
-    struct file file[NFILE];
+    struct spinlock lock;  // protects every file's ref
+    struct kmem_cache *cache;
+    struct kmem_cache *filescache;
 } ftable;
 
-void fileinit(void) { initlock(&ftable.lock, "ftable"); }
+static void filesctor(void *obj) {
+    initlock(&((struct files *)obj)->lock, "files");
+}
+
+static void filesdtor(void *obj) { freelock(&((struct files *)obj)->lock); }
+
+void fileinit(void) {
+    initlock(&ftable.lock, "ftable");
+    ftable.cache = kmem_cache_create("file", sizeof(struct file), 0, 0);
+    ftable.filescache = kmem_cache_create("files", sizeof(struct files),
+                                          filesctor, filesdtor);
+}
 
 // Allocate a file structure.
 struct file *filealloc(void) {
     struct file *f;
 
-    acquire(&ftable.lock);
-    for (f = ftable.file; f < ftable.file + NFILE; f++) {
-        if (f->ref == 0) {
-            f->ref = 1;
-            release(&ftable.lock);
-            return f;
-        }
-    }
-    release(&ftable.lock);
-    return 0;
+    if ((f = kmem_cache_alloc(ftable.cache)) == 0) return 0;
+    f->type = FD_NONE;
+    f->ref = 1;
+    return f;
 }
 
 // Increment ref count for file f.
@@ -60,16 +66,72 @@ void fileclose(struct file *f) {
     f->ref = 0;
     f->type = FD_NONE;
     release(&ftable.lock);
+    kmem_cache_free(ftable.cache, f);
 
     if (ff.type == FD_PIPE) {
         pipeclose(ff.pipe, ff.writable);
     } else if (ff.type == FD_INODE || ff.type == FD_DEVICE) {
+        if (ff.type == FD_INODE && ff.writable) iwrite(ff.ip, -1);
         begin_op();
         iput(ff.ip);
         end_op();
     }
 }
 
+// Allocate an empty table of open files.
+struct files *filesalloc(void) {
+    struct files *fs;
+
+    if ((fs = kmem_cache_alloc(ftable.filescache)) == 0) return 0;
+    memset(fs->ofile, 0, sizeof(fs->ofile));
+    fs->cwd = 0;
+    fs->ref = 1;
+    return fs;
+}
+
+// Make a copy of fs for fork(), with its own references
+// to the open files and the current directory.
+struct files *filescopy(struct files *fs) {
+    struct files *nfs;
+
+    if ((nfs = filesalloc()) == 0) return 0;
+    acquire(&fs->lock);
+    for (int fd = 0; fd < NOFILE; fd++)
+        if (fs->ofile[fd]) nfs->ofile[fd] = filedup(fs->ofile[fd]);
+    nfs->cwd = idup(fs->cwd);
+    release(&fs->lock);
+    return nfs;
+}
+
+// Share fs with another thread.
+struct files *filesdup(struct files *fs) {
+    acquire(&fs->lock);
+    fs->ref++;
+    release(&fs->lock);
+    return fs;
+}
+
+// Drop a reference to fs; the last one closes the files
+// and releases the current directory.
+// Caller must not be inside a transaction.
+void filesput(struct files *fs) {
+    acquire(&fs->lock);
+    if (--fs->ref > 0) {
+        release(&fs->lock);
+        return;
+    }
+    release(&fs->lock);
+
+    for (int fd = 0; fd < NOFILE; fd++)
+        if (fs->ofile[fd]) fileclose(fs->ofile[fd]);
+    if (fs->cwd) {
+        begin_op();
+        iput(fs->cwd);
+        end_op();
+    }
+    kmem_cache_free(ftable.filescache, fs);
+}
+
 // Get metadata about file f.
 // addr is a user virtual address, pointing to a struct stat.
 int filestat(struct file *f, uint64 addr) {
@@ -100,6 +162,9 @@ int fileread(struct file *f, uint64 addr, int n) {
             return -1;
         r = devsw[f->major].read(1, addr, n);
     } else if (f->type == FD_INODE) {
+        // fault the buffer in before readi() copies to it
+        // holding the inode and buffer locks; see vma.c.
+        if (n > 0) vmaprefault(addr, n);
         ilock(f->ip);
         if ((r = readi(f->ip, 1, addr, f->off, n)) > 0) f->off += r;
         iunlock(f->ip);
@@ -132,6 +197,9 @@ int filewrite(struct file *f, uint64 addr, int n) {
         // might be writing a device like the console.
         int max = ((MAXOPBLOCKS - 1 - 1 - 2) / 2) * BSIZE;
         int i = 0;
+
+        // as in fileread().
+        if (n > 0) vmaprefault(addr, n);
         while (i < n) {
             int n1 = n - i;
             if (n1 > max) n1 = max;
@@ -18,6 +18,10 @@ struct inode {
     uint dev;               // Device number
     uint inum;              // Inode number
     int ref;                // Reference count
+    struct inode *next;     // itable hash chain
+    int npcache;            // pages in the page cache (pcache.lock)
+    int ntext;              // program segments mapping it (itable.lock)
+    int nwrite;             // writers: open files, shared mappings (itable.lock)
     struct sleeplock lock;  // protects everything below here
     int valid;              // inode has been read from disk?
 
@@ -15,6 +15,7 @@
 #include "param.h"
 #include "stat.h"
 #include "spinlock.h"
+#include "rwlock.h"
 #include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -153,27 +154,49 @@ static void bfree(int dev, uint b) {
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// In-memory inodes come from a slab cache, so the number of
+// active inodes is bounded only by memory. Active inodes are
+// kept in a hash table keyed by (dev, inum); an inode leaves
+// the table and goes back to the cache when its ref falls to 0.
+//
+// The itable.lock reader-writer lock protects the hash table.
+// Since ip->ref indicates whether an inode is in use, and
+// ip->dev and ip->inum indicate which i-node it holds, one
+// must hold itable.lock while using any of those fields.
+// Looking an inode up and taking a reference to it only need
+// the lock for reading, and bump ref atomically; adding an
+// inode to the table, or dropping a reference, which may take
+// it out, need the lock for writing.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
-    struct spinlock lock;
-    struct inode inode[NINODE];
+    struct rwlock lock;
+    struct kmem_cache *cache;
+    struct inode *hash[NIHASH];
 } itable;
 
-void iinit() {
-    int i = 0;
+static void inodector(void *p) {
+    struct inode *ip = p;
 
-    initlock(&itable.lock, "itable");
-    for (i = 0; i < NINODE; i++) {
-        initsleeplock(&itable.inode[i].lock, "inode");
-    }
+    initsleeplock(&ip->lock, "inode");
+}
+
+static void inodedtor(void *p) {
+    struct inode *ip = p;
+
+    freelock(&ip->lock.lk);
+}
+
+void iinit() {
+    initrwlock(&itable.lock, "itable");
+    itable.cache =
+        kmem_cache_create("inode", sizeof(struct inode), inodector, inodedtor);
 }
 
 static struct inode *iget(uint dev, uint inum);
@@ -181,7 +204,7 @@ static struct inode *iget(uint dev, uint inum);
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
-// or NULL if there is no free inode.
+// or NULL if there is no free inode or no memory for it.
 struct inode *ialloc(uint dev, short type) {
     int inum;
     struct buf *bp;
@@ -191,11 +214,16 @@ struct inode *ialloc(uint dev, short type) {
         bp = bread(dev, IBLOCK(inum, sb));
         dip = (struct dinode *)bp->data + inum % IPB;
         if (dip->type == 0) {  // a free inode
+            struct inode *ip = iget(dev, inum);
+            if (ip == 0) {
+                brelse(bp);
+                return 0;
+            }
             memset(dip, 0, sizeof(*dip));
             dip->type = type;
             log_write(bp);  // mark it allocated on the disk
             brelse(bp);
-            return iget(dev, inum);
+            return ip;
         }
         brelse(bp);
     }
@@ -226,32 +254,49 @@ void iupdate(struct inode *ip) {
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Returns 0 if out of memory.
 static struct inode *iget(uint dev, uint inum) {
-    struct inode *ip, *empty;
-
-    acquire(&itable.lock);
+    struct inode *ip, **hp;
 
     // Is the inode already in the table?
-    empty = 0;
-    for (ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++) {
-        if (ip->ref > 0 && ip->dev == dev && ip->inum == inum) {
+    hp = &itable.hash[IHASH(dev, inum)];
+    acquireread(&itable.lock);
+    for (ip = *hp; ip; ip = ip->next) {
+        if (ip->dev == dev && ip->inum == inum) {
+            __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
+            releaseread(&itable.lock);
+            return ip;
+        }
+    }
+    releaseread(&itable.lock);
+
+    // No; look again, since another thread may have added it
+    // meanwhile.
+    acquirewrite(&itable.lock);
+    for (ip = *hp; ip; ip = ip->next) {
+        if (ip->dev == dev && ip->inum == inum) {
             ip->ref++;
-            release(&itable.lock);
+            releasewrite(&itable.lock);
             return ip;
         }
-        if (empty == 0 && ip->ref == 0)  // Remember empty slot.
-            empty = ip;
     }
 
-    // Recycle an inode entry.
-    if (empty == 0) panic("iget: no inodes");
+    // Allocate a new in-memory inode.
+    if ((ip = kmem_cache_alloc(itable.cache)) == 0) {
+        releasewrite(&itable.lock);
+        return 0;
+    }
 
-    ip = empty;
     ip->dev = dev;
     ip->inum = inum;
     ip->ref = 1;
     ip->valid = 0;
-    release(&itable.lock);
+    ip->npcache = 0;
+    ip->ntext = 0;
+    ip->nwrite = 0;
+    ip->next = *hp;
+    *hp = ip;
+    releasewrite(&itable.lock);
 
     return ip;
 }
@@ -259,9 +304,9 @@ static struct inode *iget(uint dev, uint inum) {
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode *idup(struct inode *ip) {
-    acquire(&itable.lock);
-    ip->ref++;
-    release(&itable.lock);
+    acquireread(&itable.lock);
+    __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
+    releaseread(&itable.lock);
     return ip;
 }
 
@@ -298,15 +343,45 @@ void iunlock(struct inode *ip) {
     releasesleep(&ip->lock);
 }
 
+// A running program's text is read from the page cache, so
+// the file must not change under it: ip can't be mapped as
+// program text while it is open for writing, nor written
+// while it is program text. itext() and iwrite() add n to
+// the count of each; they return -1 if n > 0 and the other
+// count is not 0, else 0.
+int itext(struct inode *ip, int n) {
+    int r = 0;
+
+    acquirewrite(&itable.lock);
+    if (n > 0 && ip->nwrite > 0)
+        r = -1;
+    else
+        ip->ntext += n;
+    releasewrite(&itable.lock);
+    return r;
+}
+
+int iwrite(struct inode *ip, int n) {
+    int r = 0;
+
+    acquirewrite(&itable.lock);
+    if (n > 0 && ip->ntext > 0)
+        r = -1;
+    else
+        ip->nwrite += n;
+    releasewrite(&itable.lock);
+    return r;
+}
+
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the in-memory inode is
+// returned to the inode cache.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
 // case it has to free the inode.
 void iput(struct inode *ip) {
-    acquire(&itable.lock);
+    acquirewrite(&itable.lock);
 
     if (ip->ref == 1 && ip->valid && ip->nlink == 0) {
         // inode has no links and no other references: truncate and free.
@@ -315,7 +390,7 @@ void iput(struct inode *ip) {
         // so this acquiresleep() won't block (or deadlock).
         acquiresleep(&ip->lock);
 
-        release(&itable.lock);
+        releasewrite(&itable.lock);
 
         itrunc(ip);
         ip->type = 0;
@@ -324,11 +399,22 @@ void iput(struct inode *ip) {
 
         releasesleep(&ip->lock);
 
-        acquire(&itable.lock);
+        acquirewrite(&itable.lock);
     }
 
-    ip->ref--;
-    release(&itable.lock);
+    if (--ip->ref > 0) {
+        releasewrite(&itable.lock);
+        return;
+    }
+
+    // last reference: take the inode out of the table.
+    struct inode **hp = &itable.hash[IHASH(ip->dev, ip->inum)];
+    while (*hp != ip) hp = &(*hp)->next;
+    *hp = ip->next;
+    releasewrite(&itable.lock);
+
+    pcache_inval(ip);
+    kmem_cache_free(itable.cache, ip);
 }
 
 // Common idiom: unlock, then put.
@@ -385,7 +471,9 @@ static uint bmap(struct inode *ip, uint bn) {
 
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
-void itrunc(struct inode *ip) {
+// Returns non-zero if the page cache held pages of ip,
+// which memory areas may still map.
+int itrunc(struct inode *ip) {
     int i, j;
     struct buf *bp;
     uint *a;
@@ -410,6 +498,7 @@ void itrunc(struct inode *ip) {
 
     ip->size = 0;
     iupdate(ip);
+    return pcache_inval(ip);
 }
 
 // Copy stat information from inode.
@@ -471,6 +560,7 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
             brelse(bp);
             break;
         }
+        pcache_write(ip, off, bp->data + (off % BSIZE), m);
         log_write(bp);
         brelse(bp);
     }
@@ -490,9 +580,10 @@ int writei(struct inode *ip, int user_src, uint64 src, uint off, uint n) {
 int namecmp(const char *s, const char *t) { return strncmp(s, t, DIRSIZ); }
 
 // Look for a directory entry in a directory.
-// If found, set *poff to byte offset of entry.
-struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
-    uint off, inum;
+// If found, set *poff to byte offset of entry and
+// return its i-number; else return 0.
+static uint dirfind(struct inode *dp, char *name, uint *poff) {
+    uint off;
     struct dirent de;
 
     if (dp->type != T_DIR) panic("dirlookup not DIR");
@@ -504,26 +595,31 @@ struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
         if (namecmp(name, de.name) == 0) {
             // entry matches path element
             if (poff) *poff = off;
-            inum = de.inum;
-            return iget(dp->dev, inum);
+            return de.inum;
         }
     }
 
     return 0;
 }
 
+// Look for a directory entry in a directory.
+// If found, set *poff to byte offset of entry.
+// Returns 0 if not found or if out of memory.
+struct inode *dirlookup(struct inode *dp, char *name, uint *poff) {
+    uint inum;
+
+    if ((inum = dirfind(dp, name, poff)) == 0) return 0;
+    return iget(dp->dev, inum);
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 // Returns 0 on success, -1 on failure (e.g. out of disk blocks).
 int dirlink(struct inode *dp, char *name, uint inum) {
     int off;
     struct dirent de;
-    struct inode *ip;
 
     // Check that name is not present.
-    if ((ip = dirlookup(dp, name, 0)) != 0) {
-        iput(ip);
-        return -1;
-    }
+    if (dirfind(dp, name, 0) != 0) return -1;
 
     // Look for an empty dirent.
     for (off = 0; off < dp->size; off += sizeof(de)) {
@@ -572,20 +668,74 @@ static char *skipelem(char *path, char *name) {
     return path;
 }
 
+// Look path up in the dentry cache, locking no inodes;
+// see dcache.c. Returns 0, having done nothing, if an
+// element isn't cached, or it is "..", or the walk raced
+// with an unlink; namex() then walks the slow way. Anything
+// that namex() would fail on also comes back 0.
+static struct inode *namexfast(char *path, int nameiparent, char *name) {
+    struct files *fs = 0;
+    struct inode *ip = 0;
+    uint dev, inum, seq;
+    short type = T_DIR;
+
+    if (*path != '/') {
+        // holding fs->lock keeps the cwd, and its number.
+        fs = myproc()->files;
+        acquire(&fs->lock);
+    }
+    rcureadlock();
+    seq = dcachebegin();
+    dev = fs ? fs->cwd->dev : ROOTDEV;
+    inum = fs ? fs->cwd->inum : ROOTINO;
+    while ((path = skipelem(path, name)) != 0) {
+        if (type != T_DIR) goto out;
+        if (nameiparent && *path == '\0') break;
+        if (namecmp(name, ".") == 0) continue;
+        if (namecmp(name, "..") == 0 || !dcachelookup(dev, inum, name, &inum, &type))
+            goto out;
+    }
+    if (nameiparent && path == 0) goto out;
+    if ((ip = iget(dev, inum)) == 0) goto out;
+    if (dcacheretry(seq)) {
+        rcureadunlock();
+        if (fs) release(&fs->lock);
+        iput(ip);
+        return 0;
+    }
+out:
+    rcureadunlock();
+    if (fs) release(&fs->lock);
+    return ip;
+}
+
 // Look up and return the inode for a path name.
 // If parent != 0, return the inode for the parent and copy the final
 // path element into name, which must have room for DIRSIZ bytes.
 // Must be called inside a transaction since it calls iput().
+// The elements it finds go into the dentry cache, for
+// namexfast() to find next time; an element's type is
+// known once it has been locked.
 static struct inode *namex(char *path, int nameiparent, char *name) {
     struct inode *ip, *next;
-
-    if (*path == '/')
-        ip = iget(ROOTDEV, ROOTINO);
-    else
-        ip = idup(myproc()->cwd);
+    char dname[DIRSIZ];
+    uint dir = 0, seq = 0;
+
+    if ((ip = namexfast(path, nameiparent, name)) != 0) return ip;
+
+    if (*path == '/') {
+        if ((ip = iget(ROOTDEV, ROOTINO)) == 0) return 0;
+    } else {
+        struct files *fs = myproc()->files;
+        acquire(&fs->lock);
+        ip = idup(fs->cwd);
+        release(&fs->lock);
+    }
 
     while ((path = skipelem(path, name)) != 0) {
         ilock(ip);
+        if (dir) dcacheadd(ip->dev, dir, dname, ip->inum, ip->type, seq);
+        dir = 0;
         if (ip->type != T_DIR) {
             iunlockput(ip);
             return 0;
@@ -595,13 +745,19 @@ static struct inode *namex(char *path, int nameiparent, char *name) {
             iunlock(ip);
             return ip;
         }
+        seq = dcachebegin();
         if ((next = dirlookup(ip, name, 0)) == 0) {
             iunlockput(ip);
             return 0;
         }
+        if (namecmp(name, ".") != 0 && namecmp(name, "..") != 0) {
+            dir = ip->inum;
+            memmove(dname, name, DIRSIZ);
+        }
         iunlockput(ip);
         ip = next;
     }
+    if (dir) dcacheadd(ip->dev, dir, dname, ip->inum, 0, seq);
     if (nameiparent) {
         iput(ip);
         return 0;
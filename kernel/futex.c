@@ -0,0 +1,225 @@
+// Futexes: blocking on a word of user memory.
+//
+// futexwait(addr, val, timeout) sleeps if the int at addr
+// still holds val; futexwake(addr, n) wakes up to n of the
+// threads sleeping on addr. User-space locks spin or
+// compare-and-swap on the word, and enter the kernel only to
+// sleep or to wake a sleeper.
+//
+// A futex is named by where its word lives rather than by
+// its physical address, which a copy-on-write fault after a
+// fork() changes: a word in private memory by the address
+// space and the address, which the threads of a process
+// share; a word in a MAP_SHARED file area by the inode and
+// the file offset, the same in every process that maps it;
+// and a word in shared anonymous memory, whose pages never
+// move, by its physical address. Waiters hang off NFUTEX
+// hashed buckets, in the order they came. The bucket lock
+// is held from checking the word until the waiter is
+// asleep, and futexwake() takes it too, so a store to the
+// word followed by futexwake() can't slip in between and be
+// missed.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "mm.h"
+#include "defs.h"
+
+#define NFUTEX 64
+#define FUTEXHASH(k) \
+    (((k).obj ^ ((k).off >> 2) ^ ((k).off >> 12) ^ ((k).obj >> 6)) % NFUTEX)
+
+// The name of a futex: (mm, va), (inode, offset) or (0, pa).
+struct futexkey {
+    uint64 obj;
+    uint64 off;
+};
+
+// A thread in futexwait(), on its kernel stack.
+struct futexwaiter {
+    struct futexkey key;
+    struct proc *p;
+    int woken;                  // taken off the bucket by futexwake()
+    struct futexwaiter *next;
+    struct futexwaiter **prev;
+};
+
+static struct futexbucket {
+    struct spinlock lock;
+    struct futexwaiter *head;
+    struct futexwaiter **tail;
+
+    // statistics, protected by lock.
+    int nwait;     // futexwait() calls that slept
+    int nagain;    // futexwait() calls that found the word changed
+    int ntimeout;  // waits that timed out
+    int nwake;     // futexwake() calls
+    int nwoken;    // waiters they woke
+} futex[NFUTEX];
+
+void futexinit(void) {
+    for (struct futexbucket *b = futex; b < &futex[NFUTEX]; b++) {
+        initlock(&b->lock, "futex");
+        b->tail = &b->head;
+    }
+}
+
+static void unlink(struct futexbucket *b, struct futexwaiter *w) {
+    *w->prev = w->next;
+    if (w->next)
+        w->next->prev = w->prev;
+    else
+        b->tail = w->prev;
+}
+
+// Name the word at user address addr, whose physical
+// address is pa. Caller must hold mm->lock.
+static void futexkey(struct proc *p, uint64 addr, uint64 pa,
+                     struct futexkey *k) {
+    struct vma *v = vmalookup(p, addr);
+
+    if (v && (v->flags & MAP_SHARED) && v->ip) {
+        k->obj = (uint64)v->ip;
+        k->off = v->off + (addr - v->start);
+    } else if (v && (v->flags & MAP_SHARED)) {
+        k->obj = 0;
+        k->off = pa;
+    } else {
+        k->obj = (uint64)p->mm;
+        k->off = addr;
+    }
+}
+
+static int keyeq(struct futexkey *a, struct futexkey *b) {
+    return a->obj == b->obj && a->off == b->off;
+}
+
+// Name the word at user address addr in *k, and lock its
+// bucket. If val is non-null, also read the word while the
+// page can't go away. Returns the bucket, or 0 if addr
+// isn't a writable, aligned word.
+static struct futexbucket *futexlock(uint64 addr, int *val,
+                                     struct futexkey *k) {
+    struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    struct futexkey k1;
+
+    if (addr % sizeof(int) != 0) return 0;
+    for (;;) {
+        uint64 pa = uvmwriteaddr(addr);
+        if (pa == 0) return 0;
+        acquire(&mm->lock);
+        futexkey(p, addr, pa, k);
+        release(&mm->lock);
+        struct futexbucket *b = &futex[FUTEXHASH(*k)];
+        acquire(&b->lock);
+        // another thread may have unmapped or remapped the
+        // page since; a page that is still mapped isn't freed
+        // while mm->lock is held.
+        acquire(&mm->lock);
+        uint64 va0 = PGROUNDDOWN(addr);
+        int same = walkaddr(mm->pagetable, va0) + (addr - va0) == pa;
+        if (same) {
+            futexkey(p, addr, pa, &k1);
+            same = keyeq(k, &k1);
+        }
+        if (same && val) *val = __atomic_load_n((int *)pa, __ATOMIC_RELAXED);
+        release(&mm->lock);
+        if (same) return b;
+        release(&b->lock);
+    }
+}
+
+// Sleep until woken by futexwake(), if the word at addr
+// holds val. timeout is in ticks; 0 waits forever. Returns 0
+// if woken, -1 if the word held something else, the timeout
+// passed, or the thread was killed. May also return 0 for
+// no reason; callers recheck the word.
+int futexwait(uint64 addr, int val, int timeout) {
+    struct proc *p = myproc();
+    struct futexwaiter w;
+    struct futexbucket *b;
+    int cur, timedout = 0;
+    uint deadline = 0;
+
+    if (timeout < 0) return -1;
+    if (timeout > 0) deadline = getticks() + timeout;
+
+    if ((b = futexlock(addr, &cur, &w.key)) == 0) return -1;
+    if (cur != val) {
+        b->nagain++;
+        release(&b->lock);
+        return -1;
+    }
+    w.p = p;
+    w.woken = 0;
+    w.next = 0;
+    w.prev = b->tail;
+    *b->tail = &w;
+    b->tail = &w.next;
+    b->nwait++;
+
+    while (!w.woken && !timedout && !killed(p)) {
+        if (timeout > 0)
+            timedout = sleepuntil(&w, &b->lock, deadline);
+        else
+            sleep(&w, &b->lock);
+    }
+    if (!w.woken) {
+        unlink(b, &w);
+        if (timedout) b->ntimeout++;
+    }
+    release(&b->lock);
+    return w.woken ? 0 : -1;
+}
+
+// Wake up to n of the threads sleeping on the word at addr,
+// the longest-waiting first. Returns how many were woken, or
+// -1 if addr isn't a writable, aligned word.
+int futexwake(uint64 addr, int n) {
+    struct futexwaiter *w, *next;
+    struct futexbucket *b;
+    struct futexkey key;
+    int nwoken = 0;
+
+    if ((b = futexlock(addr, 0, &key)) == 0) return -1;
+    for (w = b->head; w && nwoken < n; w = next) {
+        next = w->next;
+        if (!keyeq(&w->key, &key)) continue;
+        unlink(b, w);
+        w->woken = 1;
+        wakeup(w);
+        nwoken++;
+    }
+    b->nwake++;
+    b->nwoken += nwoken;
+    release(&b->lock);
+    return nwoken;
+}
+
+// Report futex activity for the stats device.
+int statsfutex(char *buf, int sz) {
+    int nwait = 0, nagain = 0, ntimeout = 0, nwake = 0, nwoken = 0;
+
+    for (struct futexbucket *b = futex; b < &futex[NFUTEX]; b++) {
+        acquire(&b->lock);
+        nwait += b->nwait;
+        nagain += b->nagain;
+        ntimeout += b->ntimeout;
+        nwake += b->nwake;
+        nwoken += b->nwoken;
+        release(&b->lock);
+    }
+    return snprintf(buf, sz,
+                    "--- futex\nwaits %d, word changed %d, timeouts %d, "
+                    "wakes %d, woken %d\n",
+                    nwait, nagain, ntimeout, nwake, nwoken);
+}
@@ -1,6 +1,24 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
-// and pipe buffers. Allocates whole 4096-byte pages.
+// and pipe buffers. Allocates whole 4096-byte pages,
+// or physically contiguous runs of 2^order pages.
+//
+// All free memory belongs to a binary buddy allocator.
+// Each CPU keeps a cache of single pages on
+// kmem[cpu].freelist, so the common kalloc()/kfree()
+// only take that CPU's lock. A CPU whose cache runs dry
+// refills it from the buddy allocator, or if that is empty
+// steals half of another CPU's cache; a CPU whose cache
+// grows past KMEM_HIGH gives a batch back to the buddy
+// allocator.
+//
+// Idle CPUs also keep a small pool of pages that are
+// already zeroed on kmem[cpu].zerolist, which
+// kalloc_zeroed() hands out without a memset.
+//
+// Freed and newly allocated pages are filled with junk
+// to catch dangling references, unless the kernel is
+// built with NOJUNK.
 
 #include "types.h"
 #include "param.h"
@@ -11,6 +29,23 @@
 
 #define PA2PGREF_ID(p) ((((uint64)p) - KERNBASE) / PGSIZE)
 #define PGREF_MAX_ENTRIES PA2PGREF_ID(PHYSTOP)
+#define PGID2PA(id) (KERNBASE + (uint64)(id) * PGSIZE)
+
+// pages moved from the buddy allocator to a CPU's
+// empty freelist at a time.
+#define KALLOC_BATCH 32
+
+// high watermark of a CPU's freelist. kfree() returns
+// KALLOC_BATCH pages to the buddy allocator above it.
+#define KMEM_HIGH (4 * KALLOC_BATCH)
+
+// pages each CPU keeps zeroed ahead of time.
+#define KZERO_HIGH 64
+
+// idle CPUs stop zeroing pages once the buddy allocator
+// holds fewer pages than this, so that the pool never
+// competes for the last free pages.
+#define KZERO_RESERVE 256
 
 void freerange(void *pa_start, void *pa_end);
 
@@ -24,6 +59,15 @@ struct run {
 struct {
     struct spinlock lock;
     struct run *freelist;
+    int nfree;      // pages on freelist
+    int nsteal;     // times this CPU stole from another
+    int nstolen;    // pages taken by those steals
+    int nreturn;    // batches given back to the buddy allocator
+    struct run *zerolist;  // zeroed pages, but for the first word
+    int nzero;      // pages on zerolist
+    int nzeroing;   // pages taken off freelist to be zeroed
+    int nzhit;      // kalloc_zeroed() calls served from zerolist
+    int nzmiss;     // kalloc_zeroed() calls that had to memset
 } kmem[NCPU];
 
 char *kmem_lock_names[] = {
@@ -31,32 +75,135 @@ char *kmem_lock_names[] = {
     "kmem_cpu_4", "kmem_cpu_5", "kmem_cpu_6", "kmem_cpu_7",
 };
 
+// a free buddy block. lives in the first page of the block.
+struct block {
+    struct block *next;
+    struct block *prev;
+};
+
+struct {
+    struct spinlock lock;
+    struct block free[MAXORDER + 1];  // circular lists, one per order
+    int nfree[MAXORDER + 1];          // number of blocks on free[order]
+    uint64 npages;                    // pages held by the buddy allocator
+    uchar order[PGREF_MAX_ENTRIES];   // order of the block headed by a page
+    uchar isfree[PGREF_MAX_ENTRIES];  // page heads a block on a free list
+} buddy;
+
+// copy-on-write reference count of each physical page.
+// updated with atomic instructions, so that fork and
+// copy-on-write faults on different CPUs do not contend
+// on a lock.
+static int pgref[PGREF_MAX_ENTRIES];
+
+static void blist_push(int order, uint64 id) {
+    struct block *b = (struct block *)PGID2PA(id);
+    struct block *h = &buddy.free[order];
+
+    b->next = h->next;
+    b->prev = h;
+    h->next->prev = b;
+    h->next = b;
+    buddy.nfree[order]++;
+    buddy.order[id] = order;
+    buddy.isfree[id] = 1;
+}
+
+static void blist_remove(int order, uint64 id) {
+    struct block *b = (struct block *)PGID2PA(id);
+
+    b->prev->next = b->next;
+    b->next->prev = b->prev;
+    buddy.nfree[order]--;
+    buddy.isfree[id] = 0;
+}
+
+// Return the block of 2^order pages headed by page id to the
+// buddy allocator, merging it with its buddy while that is free.
+// Caller must hold buddy.lock.
+static void buddy_free(uint64 id, int order) {
+    buddy.npages += 1L << order;
+    while (order < MAXORDER) {
+        uint64 bid = id ^ (1L << order);
+        if (bid >= PGREF_MAX_ENTRIES || !buddy.isfree[bid] ||
+            buddy.order[bid] != order)
+            break;
+        blist_remove(order, bid);
+        if (bid < id) id = bid;
+        order++;
+    }
+    blist_push(order, id);
+}
+
+// Take a block of 2^order pages from the buddy allocator,
+// splitting a larger block if needed. Returns its first
+// page id, or -1 if no block is large enough.
+// Caller must hold buddy.lock.
+static int buddy_alloc(int order) {
+    int k;
+
+    for (k = order; k <= MAXORDER; k++)
+        if (buddy.nfree[k] > 0) break;
+    if (k > MAXORDER) return -1;
+
+    int id = PA2PGREF_ID(buddy.free[k].next);
+    blist_remove(k, id);
+    while (k > order) {
+        k--;
+        blist_push(k, id + (1L << k));
+    }
+    buddy.order[id] = order;
+    buddy.npages -= 1L << order;
+    return id;
+}
+
 void kinit() {
-    // initlock(&kmem.lock, "kmem");
     for (int i = 0; i < NCPU; i++) {
         initlock(&kmem[i].lock, kmem_lock_names[i]);
     }
+    initlock(&buddy.lock, "kmem_buddy");
+    for (int k = 0; k <= MAXORDER; k++) {
+        buddy.free[k].next = buddy.free[k].prev = &buddy.free[k];
+    }
     freerange(end, (void *)PHYSTOP);
 }
 
+// Hand [pa_start, pa_end) to the buddy allocator
+// in the largest aligned blocks that fit.
 void freerange(void *pa_start, void *pa_end) {
-    char *p;
-    p = (char *)PGROUNDUP((uint64)pa_start);
-    for (; p + PGSIZE <= (char *)pa_end; p += PGSIZE) kfree(p);
+    uint64 id = PA2PGREF_ID(PGROUNDUP((uint64)pa_start));
+    uint64 last = PA2PGREF_ID(PGROUNDDOWN((uint64)pa_end));
+
+    acquire(&buddy.lock);
+    while (id < last) {
+        int order = MAXORDER;
+        while (order > 0 && ((id & ((1L << order) - 1)) != 0 ||
+                             id + (1L << order) > last))
+            order--;
+        buddy_free(id, order);
+        id += 1L << order;
+    }
+    release(&buddy.lock);
 }
 
 // Free the page of physical memory pointed at by pa,
 // which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// call to kalloc(). The page is only freed once
+// the last copy-on-write reference to it is dropped.
 void kfree(void *pa) {
     struct run *r;
 
     if (((uint64)pa % PGSIZE) != 0 || (char *)pa < end || (uint64)pa >= PHYSTOP)
         panic("kfree");
 
+    int n = __atomic_sub_fetch(&pgref[PA2PGREF_ID(pa)], 1, __ATOMIC_ACQ_REL);
+    if (n > 0) return;
+    if (n < 0) panic("kfree: ref");
+
+#ifndef NOJUNK
     // Fill with junk to catch dangling refs.
     memset(pa, 1, PGSIZE);
+#endif
 
     r = (struct run *)pa;
 
@@ -67,10 +214,92 @@ void kfree(void *pa) {
 
     r->next = kmem[cpu].freelist;
     kmem[cpu].freelist = r;
+    kmem[cpu].nfree++;
+
+    // above the high watermark: detach a batch
+    // and give it back to the buddy allocator.
+    r = 0;
+    if (kmem[cpu].nfree > KMEM_HIGH) {
+        struct run *tail = kmem[cpu].freelist;
+        for (int i = 1; i < KALLOC_BATCH; i++) tail = tail->next;
+        r = kmem[cpu].freelist;
+        kmem[cpu].freelist = tail->next;
+        tail->next = 0;
+        kmem[cpu].nfree -= KALLOC_BATCH;
+        kmem[cpu].nreturn++;
+    }
 
     release(&kmem[cpu].lock);
 
     pop_off();
+
+    if (r) {
+        acquire(&buddy.lock);
+        while (r) {
+            struct run *next = r->next;
+            buddy_free(PA2PGREF_ID(r), 0);
+            r = next;
+        }
+        release(&buddy.lock);
+    }
+}
+
+// Refill cpu's empty freelist from the buddy allocator.
+// Caller must hold kmem[cpu].lock.
+static void krefill(int cpu) {
+    acquire(&buddy.lock);
+    for (int i = 0; i < KALLOC_BATCH; i++) {
+        int id = buddy_alloc(0);
+        if (id < 0) break;
+        struct run *r = (struct run *)PGID2PA(id);
+        r->next = kmem[cpu].freelist;
+        kmem[cpu].freelist = r;
+        kmem[cpu].nfree++;
+    }
+    release(&buddy.lock);
+}
+
+// Steal half of the pages cached by some other CPU and
+// return one of them; the rest go on cpu's freelist.
+// The victim's zeroed pages are only taken once its
+// freelist is empty. Only one kmem lock is held at a
+// time. Returns 0 if every other CPU's cache is empty.
+// Caller must have interrupts off and hold no kmem lock.
+static struct run *ksteal(int cpu) {
+    for (int i = 0; i < NCPU; i++) {
+        if (i == cpu) continue;
+        acquire(&kmem[i].lock);
+        struct run **list = &kmem[i].freelist;
+        int *cnt = &kmem[i].nfree;
+        if (*cnt == 0) {
+            list = &kmem[i].zerolist;
+            cnt = &kmem[i].nzero;
+        }
+        int n = (*cnt + 1) / 2;
+        if (n == 0) {
+            release(&kmem[i].lock);
+            continue;
+        }
+        struct run *head = *list;
+        struct run *tail = head;
+        for (int j = 1; j < n; j++) tail = tail->next;
+        *list = tail->next;
+        *cnt -= n;
+        release(&kmem[i].lock);
+
+        // splice all but the first page onto cpu's freelist.
+        acquire(&kmem[cpu].lock);
+        if (head != tail) {
+            tail->next = kmem[cpu].freelist;
+            kmem[cpu].freelist = head->next;
+            kmem[cpu].nfree += n - 1;
+        }
+        kmem[cpu].nsteal++;
+        kmem[cpu].nstolen += n;
+        release(&kmem[cpu].lock);
+        return head;
+    }
+    return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -82,75 +311,241 @@ void *kalloc(void) {
     push_off();
     int cpu = cpuid();
     acquire(&kmem[cpu].lock);
-    r = kmem[cpu].freelist;
-    if (!r) {
-        int steal_pages = 32;
-        for (int i = 0; i < NCPU; i++) {
-            if (i == cpu) continue;
-            acquire(&kmem[i].lock);
-            struct run *st = kmem[i].freelist;
-            while (st && steal_pages) {
-                struct run *temp;
-                temp = st->next;
-                st->next = kmem[cpu].freelist;
-                kmem[cpu].freelist = st;
-                kmem[i].freelist = temp;
-                st = kmem[i].freelist;
-                steal_pages--;
-            }
-            release(&kmem[i].lock);
-            if (steal_pages == 0 || i == NCPU) {
-                break;
-            }
-        }
-    }
+    if (!kmem[cpu].freelist) krefill(cpu);
     r = kmem[cpu].freelist;
     if (r) {
         kmem[cpu].freelist = r->next;
+        kmem[cpu].nfree--;
+    } else if ((r = kmem[cpu].zerolist) != 0) {
+        kmem[cpu].zerolist = r->next;
+        kmem[cpu].nzero--;
     }
     release(&kmem[cpu].lock);
+    if (!r) r = ksteal(cpu);
     pop_off();
 
-    if (r) memset((char *)r, 5, PGSIZE);  // fill with junk
+    if (r) {
+#ifndef NOJUNK
+        memset((char *)r, 5, PGSIZE);  // fill with junk
+#endif
+        __atomic_store_n(&pgref[PA2PGREF_ID(r)], 1, __ATOMIC_RELEASE);
+    }
     return (void *)r;
 }
 
-void *kcowcopy(void *pa) {
-    acquire(&ref.lock);
-    if (ref.cnt[PA2PGREF_ID(pa)] <= 1) {
-        release(&ref.lock);
-        return pa;
+// Allocate one page of physical memory filled with zeros.
+// Returns 0 if the memory cannot be allocated.
+void *kalloc_zeroed(void) {
+    struct run *r;
+
+    push_off();
+    int cpu = cpuid();
+    acquire(&kmem[cpu].lock);
+    r = kmem[cpu].zerolist;
+    if (r) {
+        kmem[cpu].zerolist = r->next;
+        kmem[cpu].nzero--;
+        kmem[cpu].nzhit++;
+    } else {
+        kmem[cpu].nzmiss++;
+    }
+    release(&kmem[cpu].lock);
+    pop_off();
+
+    if (r) {
+        r->next = 0;
+        __atomic_store_n(&pgref[PA2PGREF_ID(r)], 1, __ATOMIC_RELEASE);
+    } else if ((r = kalloc()) != 0) {
+        memset((char *)r, 0, PGSIZE);
+    }
+    return (void *)r;
+}
+
+// Zero one page ahead of time for kalloc_zeroed().
+// Called by the scheduler when this CPU has nothing
+// to run. Does nothing if the CPU's pool is full or
+// free memory is low. Returns 1 if it zeroed a page.
+int kzerofill(void) {
+    struct run *r = 0;
+
+    push_off();
+    int cpu = cpuid();
+    acquire(&kmem[cpu].lock);
+    if (kmem[cpu].nzero < KZERO_HIGH &&
+        __atomic_load_n(&buddy.npages, __ATOMIC_RELAXED) >= KZERO_RESERVE) {
+        if (!kmem[cpu].freelist) krefill(cpu);
+        r = kmem[cpu].freelist;
+        if (r) {
+            kmem[cpu].freelist = r->next;
+            kmem[cpu].nfree--;
+            kmem[cpu].nzeroing++;
+        }
+    }
+    release(&kmem[cpu].lock);
+
+    if (r) {
+        memset((char *)r, 0, PGSIZE);
+        acquire(&kmem[cpu].lock);
+        r->next = kmem[cpu].zerolist;
+        kmem[cpu].zerolist = r;
+        kmem[cpu].nzero++;
+        kmem[cpu].nzeroing--;
+        release(&kmem[cpu].lock);
+    }
+    pop_off();
+    return r != 0;
+}
+
+// Give every page cached on the per-CPU freelists back to
+// the buddy allocator, so that it can merge them into
+// larger blocks.
+static void kdrain(void) {
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&kmem[i].lock);
+        struct run *r = kmem[i].freelist;
+        struct run *z = kmem[i].zerolist;
+        kmem[i].freelist = kmem[i].zerolist = 0;
+        kmem[i].nfree = kmem[i].nzero = 0;
+        release(&kmem[i].lock);
+
+        acquire(&buddy.lock);
+        while (r) {
+            struct run *next = r->next;
+            buddy_free(PA2PGREF_ID(r), 0);
+            r = next;
+        }
+        while (z) {
+            struct run *next = z->next;
+            buddy_free(PA2PGREF_ID(z), 0);
+            z = next;
+        }
+        release(&buddy.lock);
+    }
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size. Returns 0 if no such run is available.
+void *kalloc_order(int order) {
+    int id;
+
+    if (order < 0 || order > MAXORDER) panic("kalloc_order");
+    if (order == 0) return kalloc();
+
+    acquire(&buddy.lock);
+    id = buddy_alloc(order);
+    release(&buddy.lock);
+    if (id < 0) {
+        kdrain();
+        acquire(&buddy.lock);
+        id = buddy_alloc(order);
+        release(&buddy.lock);
+        if (id < 0) return 0;
     }
 
-    uint64 newpa = (uint64)kalloc();
-    if (newpa == 0) {
-        release(&ref.lock);
-        return 0;
+#ifndef NOJUNK
+    memset((void *)PGID2PA(id), 5, PGSIZE << order);  // fill with junk
+#endif
+    __atomic_store_n(&pgref[id], 1, __ATOMIC_RELEASE);
+    return (void *)PGID2PA(id);
+}
+
+// Turn a run of 2^order pages returned by kalloc_order(order)
+// into 2^order single pages, each of which is later freed
+// with kfree().
+void ksplit(void *pa, int order) {
+    int id = PA2PGREF_ID(pa);
+    int ref = __atomic_load_n(&pgref[id], __ATOMIC_ACQUIRE);
+
+    for (int i = 1; i < (1 << order); i++)
+        __atomic_store_n(&pgref[id + i], ref, __ATOMIC_RELEASE);
+}
+
+// Free a run of 2^order pages returned by kalloc_order(order).
+void kfree_order(void *pa, int order) {
+    if (order < 0 || order > MAXORDER) panic("kfree_order");
+    if (order == 0) {
+        kfree(pa);
+        return;
     }
-    memmove((void *)newpa, (void *)pa, PGSIZE);
+    if (((uint64)pa % (PGSIZE << order)) != 0 || (char *)pa < end ||
+        (uint64)pa + (PGSIZE << order) > PHYSTOP)
+        panic("kfree_order");
 
-    ref.cnt[PA2PGREF_ID(pa)]--;
+    __atomic_store_n(&pgref[PA2PGREF_ID(pa)], 0, __ATOMIC_RELEASE);
+#ifndef NOJUNK
+    memset(pa, 1, PGSIZE << order);
+#endif
 
-    release(&ref.lock);
-    return (void *)newpa;
+    acquire(&buddy.lock);
+    buddy_free(PA2PGREF_ID(pa), order);
+    release(&buddy.lock);
 }
 
+// Return the number of references to page pa.
+int krefcnt(void *pa) {
+    return __atomic_load_n(&pgref[PA2PGREF_ID(pa)], __ATOMIC_ACQUIRE);
+}
+
+// Add a copy-on-write reference to page pa.
 void addref(void *pa) {
-    acquire(&ref.lock);
-    ref.cnt[PA2PGREF_ID(pa)]++;
-    release(&ref.lock);
+    __atomic_fetch_add(&pgref[PA2PGREF_ID(pa)], 1, __ATOMIC_RELAXED);
 }
+
+// Return the number of free bytes of physical memory.
 uint64 get_free_memory(void) {
-    // 锁
-    acquire(&kmem.lock);
+    uint64 npages;
 
-    uint64 mem_bytes = 0;
-    struct run *r = kmem.freelist;
-    while (r) {
-        mem_bytes += PGSIZE;
-        r = r->next;
+    acquire(&buddy.lock);
+    npages = buddy.npages;
+    release(&buddy.lock);
+
+    npages += pcache_nunmapped();
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&kmem[i].lock);
+        npages += kmem[i].nfree + kmem[i].nzero + kmem[i].nzeroing;
+        release(&kmem[i].lock);
     }
+    return npages * PGSIZE;
+}
+
+// Report the per-CPU caches and the buddy free lists
+// for the stats device.
+// frag is the share of free memory that is not in the
+// largest free block order, in percent.
+int statskalloc(char *buf, int sz) {
+    int n, largest = -1, frag = 0;
+    uint64 npages;
+
+    int nzhit = 0, nzmiss = 0;
 
-    release(&kmem.lock);
-    return mem_bytes;
-}
\ No newline at end of file
+    n = snprintf(buf, sz, "--- kalloc cpus\n");
+    for (int i = 0; i < NCPU; i++) {
+        acquire(&kmem[i].lock);
+        n += snprintf(buf + n, sz - n,
+                      "cpu %d: free %d, zeroed %d, steals %d, stolen %d, "
+                      "returns %d\n",
+                      i, kmem[i].nfree, kmem[i].nzero, kmem[i].nsteal,
+                      kmem[i].nstolen, kmem[i].nreturn);
+        nzhit += kmem[i].nzhit;
+        nzmiss += kmem[i].nzmiss;
+        release(&kmem[i].lock);
+    }
+    n += snprintf(buf + n, sz - n, "kalloc_zeroed: %d hits, %d misses\n", nzhit,
+                  nzmiss);
+
+    acquire(&buddy.lock);
+    n += snprintf(buf + n, sz - n, "--- kalloc buddy\n");
+    for (int k = 0; k <= MAXORDER; k++) {
+        if (buddy.nfree[k] > 0) largest = k;
+        n += snprintf(buf + n, sz - n, "order %d: %d free\n", k,
+                      buddy.nfree[k]);
+    }
+    npages = buddy.npages;
+    if (largest >= 0)
+        frag = 100 - (100 * ((uint64)buddy.nfree[largest] << largest)) / npages;
+    release(&buddy.lock);
+
+    n += snprintf(buf + n, sz - n, "buddy pages %d, largest order %d, frag %d%%\n",
+                  (int)npages, largest, frag);
+    return n;
+}
@@ -11,6 +11,7 @@ volatile static int started = 0;
 void main() {
     if (cpuid() == 0) {
         consoleinit();
+        statsinit();
         printfinit();
         printf("\n");
         printf("xv6 kernel is booting\n");
@@ -21,16 +22,24 @@ void main() {
         printf(" /_/\\_\\  \\_/  \\___/ \n");
         printf("\n");
         kinit();             // physical page allocator
+        slabinit();          // small object caches
+        pcacheinit();        // page cache for file pages
         kvminit();           // create kernel page table
         kvminithart();       // turn on paging
+        asidinit();          // address space identifiers
         procinit();          // process table
         trapinit();          // trap vectors
+        timerwheelinit();    // kernel timers
+        futexinit();         // futex wait queues
+        rcuinit();           // deferred frees for lockless readers
         trapinithart();      // install kernel trap vector
         plicinit();          // set up interrupt controller
         plicinithart();      // ask PLIC for device interrupts
         binit();             // buffer cache
         iinit();             // inode table
+        dcacheinit();        // directory entry cache
         fileinit();          // file table
+        pipeinit();          // pipe objects
         virtio_disk_init();  // emulated hard disk
         userinit();          // first user process
         __sync_synchronize();
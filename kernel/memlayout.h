@@ -27,6 +27,7 @@
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4 * (hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8 * (hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8)  // cycles since boot.
 
@@ -62,6 +63,11 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
-//   TRAPFRAME (p->trapframe, used by the trampoline)
+//   the other threads' trapframes, downwards from TRAPFRAME
+//   TRAPFRAME (p->trapframe of a process's first thread,
+//              used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define THREADFRAME(t) (TRAPFRAME - (t) * PGSIZE)
+// user memory ends below the lowest trapframe.
+#define USERTOP THREADFRAME(NTHREAD - 1)
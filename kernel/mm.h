@@ -0,0 +1,18 @@
+// A process's address space, shared by its threads; see
+// proc.c. Both lock and maplock must be held to change sz
+// or vma, and either to read them; lock must be held to
+// change the user mappings in pagetable.
+struct mm {
+    struct spinlock lock;
+    struct sleeplock maplock;  // serializes sbrk(), mmap(), munmap()
+    int ref;                   // struct procs that use it
+    int nthread;               // threads that have not exited
+    int exiting;               // exit() has been called
+    int xstatus;               // its status, for the parent's wait()
+    uint frames;               // trapframe slots in use, a bit each
+    pagetable_t pagetable;     // User page table
+    uint64 sz;                 // Size of process memory (bytes)
+    struct vma vma[NVMA];      // Memory areas: program segments, mmap()
+    uint64 asid;               // ASID and its generation; 0 if none yet
+    uint tlbsync;              // Harts whose TLB is up to date for it; see asid.c
+};
@@ -1,8 +1,8 @@
-#define NPROC 64                   // maximum number of processes
+#define NPROC 64                   // live processes allowed at least; see maxproc
 #define NCPU 8                     // maximum number of CPUs
 #define NOFILE 16                  // open files per process
-#define NFILE 100                  // open files per system
-#define NINODE 50                  // maximum number of active i-nodes
+#define NFILE 100                  // open files per system (unused; no limit)
+#define NINODE 50                  // active i-nodes (usertests only; no limit)
 #define NDEV 10                    // maximum major device number
 #define ROOTDEV 1                  // device number of file system root disk
 #define MAXARG 32                  // max exec arguments
@@ -11,3 +11,7 @@
 #define NBUF (MAXOPBLOCKS * 3)     // size of disk block cache
 #define FSSIZE 2000                // size of file system in blocks
 #define MAXPATH 128                // maximum file path name
+#define MAXORDER 10                // largest kalloc_order() block is 2^MAXORDER pages
+#define NVMA 16                    // memory areas per process
+#define NRTPRIO 8                  // real-time scheduling priorities
+#define NTHREAD 16                 // threads per process
@@ -0,0 +1,227 @@
+// Page cache for file-backed user memory.
+//
+// Holds whole pages of file content, keyed by inode and
+// page-aligned file offset, so that processes running the
+// same program map the same physical pages for its
+// read-only text, and processes that mmap() the same file
+// share its pages. The cache holds one reference to each
+// page (see kalloc.c); every mapping holds another.
+//
+// Interface:
+// * pcache_get(ip, off) returns the page holding ip's bytes
+//   [off, off+PGSIZE), reading it if needed, with a
+//   reference for the caller. Release it with kfree().
+// * pcache_write(ip, off, src, n) copies bytes that writei()
+//   just wrote into the cached page, so that mappings of
+//   the file see the new content.
+// * pcache_inval(ip) drops ip's pages from the cache; the
+//   file system calls it when ip is truncated and when its
+//   last reference goes away. After a truncation, if it
+//   dropped any, open() unmaps them from MAP_SHARED areas
+//   with vmatruncate().
+// * pcache_reclaim() frees the pages that only the cache
+//   refers to; page faults call it when memory runs out.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "defs.h"
+
+#define NPCHASH 61
+#define PCHASH(ip, off) ((((uint64)(ip) >> 3) + (off) / PGSIZE) % NPCHASH)
+
+struct pcpage {
+    struct pcpage *next;  // hash chain
+    struct inode *ip;
+    uint off;
+    void *pa;
+};
+
+static struct {
+    struct spinlock lock;
+    struct kmem_cache *cache;
+    struct pcpage *hash[NPCHASH];
+    int npages;
+
+    // statistics, protected by lock.
+    int nhit;
+    int nmiss;
+    int nreclaim;
+} pcache;
+
+void pcacheinit(void) {
+    initlock(&pcache.lock, "pcache");
+    pcache.cache = kmem_cache_create("pcpage", sizeof(struct pcpage), 0, 0);
+}
+
+// Look up ip's page at off. Caller must hold pcache.lock.
+static struct pcpage *pcache_lookup(struct inode *ip, uint off) {
+    struct pcpage *pg;
+
+    for (pg = pcache.hash[PCHASH(ip, off)]; pg; pg = pg->next)
+        if (pg->ip == ip && pg->off == off) return pg;
+    return 0;
+}
+
+// Return the physical page holding ip's content at the
+// page-aligned offset off, with a reference for the caller.
+// The part of the page past the end of the file reads as 0.
+// Returns 0 if out of memory or the read fails.
+// Caller must not hold ip->lock.
+void *pcache_get(struct inode *ip, uint off) {
+    struct pcpage *pg;
+    void *pa;
+    uint n = 0;
+
+    acquire(&pcache.lock);
+    if ((pg = pcache_lookup(ip, off)) != 0) {
+        addref(pg->pa);
+        pcache.nhit++;
+        release(&pcache.lock);
+        return pg->pa;
+    }
+    pcache.nmiss++;
+    release(&pcache.lock);
+
+    // read the page without the cache lock held, but with
+    // ip locked until the page is in the cache, so that no
+    // write can slip in between and leave the page stale.
+    if ((pa = kalloc()) == 0) return 0;
+    pg = kmem_cache_alloc(pcache.cache);  // if 0, don't cache
+    ilock(ip);
+    if (off < ip->size) n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+    if (n > 0 && readi(ip, 0, (uint64)pa, off, n) != n) {
+        iunlock(ip);
+        kfree(pa);
+        if (pg) kmem_cache_free(pcache.cache, pg);
+        return 0;
+    }
+    memset((char *)pa + n, 0, PGSIZE - n);
+    if (pg == 0) {
+        iunlock(ip);
+        return pa;
+    }
+
+    acquire(&pcache.lock);
+    struct pcpage *old = pcache_lookup(ip, off);
+    if (old) {
+        // another process read the same page meanwhile.
+        addref(old->pa);
+        release(&pcache.lock);
+        iunlock(ip);
+        kmem_cache_free(pcache.cache, pg);
+        kfree(pa);
+        return old->pa;
+    }
+    pg->ip = ip;
+    pg->off = off;
+    pg->pa = pa;
+    pg->next = pcache.hash[PCHASH(ip, off)];
+    pcache.hash[PCHASH(ip, off)] = pg;
+    pcache.npages++;
+    ip->npcache++;
+    addref(pa);  // one for the cache, one for the caller
+    release(&pcache.lock);
+    iunlock(ip);
+    return pa;
+}
+
+// Copy the n bytes at src, which writei() just wrote to ip
+// at off, into ip's cached page. The bytes must not cross a
+// page boundary. Caller must hold ip->lock.
+void pcache_write(struct inode *ip, uint off, void *src, uint n) {
+    struct pcpage *pg;
+
+    if (ip->npcache == 0) return;
+    acquire(&pcache.lock);
+    if ((pg = pcache_lookup(ip, PGROUNDDOWN(off))) != 0)
+        memmove((char *)pg->pa + off % PGSIZE, src, n);
+    release(&pcache.lock);
+}
+
+// Remove every page for which drop(pg) is true from the
+// cache and release the cache's references to them.
+// Returns the number of pages removed.
+static int pcache_drop(int (*drop)(struct pcpage *, void *), void *arg) {
+    struct pcpage *pg, **pp, *freed = 0;
+    int n = 0;
+
+    acquire(&pcache.lock);
+    for (int i = 0; i < NPCHASH; i++) {
+        for (pp = &pcache.hash[i]; (pg = *pp) != 0;) {
+            if (drop(pg, arg)) {
+                *pp = pg->next;
+                pg->ip->npcache--;
+                pg->next = freed;
+                freed = pg;
+                n++;
+            } else {
+                pp = &pg->next;
+            }
+        }
+    }
+    pcache.npages -= n;
+    release(&pcache.lock);
+
+    while ((pg = freed) != 0) {
+        freed = pg->next;
+        kfree(pg->pa);
+        kmem_cache_free(pcache.cache, pg);
+    }
+    return n;
+}
+
+static int isinode(struct pcpage *pg, void *ip) { return pg->ip == ip; }
+
+static int unmapped(struct pcpage *pg, void *arg) {
+    return krefcnt(pg->pa) == 1;
+}
+
+// Forget ip's cached pages. Processes that map them
+// keep their references. Returns the number dropped; any
+// page that is mapped is among them.
+int pcache_inval(struct inode *ip) {
+    return ip->npcache > 0 ? pcache_drop(isinode, ip) : 0;
+}
+
+// Free the cached pages that no process maps.
+// Returns the number of pages freed.
+int pcache_reclaim(void) {
+    int n = pcache_drop(unmapped, 0);
+
+    acquire(&pcache.lock);
+    pcache.nreclaim += n;
+    release(&pcache.lock);
+    return n;
+}
+
+// Return the number of cached pages that no process maps,
+// which pcache_reclaim() could free.
+int pcache_nunmapped(void) {
+    struct pcpage *pg;
+    int n = 0;
+
+    acquire(&pcache.lock);
+    for (int i = 0; i < NPCHASH; i++)
+        for (pg = pcache.hash[i]; pg; pg = pg->next)
+            if (krefcnt(pg->pa) == 1) n++;
+    release(&pcache.lock);
+    return n;
+}
+
+// Report page cache usage for the stats device.
+int statspcache(char *buf, int sz) {
+    int n;
+
+    acquire(&pcache.lock);
+    n = snprintf(buf, sz,
+                 "--- pcache\npages %d, hits %d, misses %d, reclaimed %d\n",
+                 pcache.npages, pcache.nhit, pcache.nmiss, pcache.nreclaim);
+    release(&pcache.lock);
+    return n;
+}
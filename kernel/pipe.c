@@ -19,18 +19,30 @@ struct pipe {
     int writeopen;  // write fd is still open
 };
 
+static struct kmem_cache *pipecache;
+
+static void pipector(void *obj) {
+    initlock(&((struct pipe *)obj)->lock, "pipe");
+}
+
+static void pipedtor(void *obj) { freelock(&((struct pipe *)obj)->lock); }
+
+void pipeinit(void) {
+    pipecache = kmem_cache_create("pipe", sizeof(struct pipe), pipector,
+                                  pipedtor);
+}
+
 int pipealloc(struct file **f0, struct file **f1) {
     struct pipe *pi;
 
     pi = 0;
     *f0 = *f1 = 0;
     if ((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0) goto bad;
-    if ((pi = (struct pipe *)kalloc()) == 0) goto bad;
+    if ((pi = kmem_cache_alloc(pipecache)) == 0) goto bad;
     pi->readopen = 1;
     pi->writeopen = 1;
     pi->nwrite = 0;
     pi->nread = 0;
-    initlock(&pi->lock, "pipe");
     (*f0)->type = FD_PIPE;
     (*f0)->readable = 1;
     (*f0)->writable = 0;
@@ -42,7 +54,7 @@ int pipealloc(struct file **f0, struct file **f1) {
     return 0;
 
 bad:
-    if (pi) kfree((char *)pi);
+    if (pi) kmem_cache_free(pipecache, pi);
     if (*f0) fileclose(*f0);
     if (*f1) fileclose(*f1);
     return -1;
@@ -59,36 +71,39 @@ void pipeclose(struct pipe *pi, int writable) {
     }
     if (pi->readopen == 0 && pi->writeopen == 0) {
         release(&pi->lock);
-#ifdef LAB_LOCK
-        freelock(&pi->lock);
-#endif
-        kfree((char *)pi);
+        kmem_cache_free(pipecache, pi);
     } else
         release(&pi->lock);
 }
 
+// Data goes through buf on the kernel stack, since copyin()
+// and copyout() may fault a page in, which they can't do with
+// pi->lock held.
 int pipewrite(struct pipe *pi, uint64 addr, int n) {
-    int i = 0;
+    int i = 0, j, m;
     struct proc *pr = myproc();
+    char buf[PIPESIZE];
 
-    acquire(&pi->lock);
     while (i < n) {
-        if (pi->readopen == 0 || killed(pr)) {
-            release(&pi->lock);
-            return -1;
-        }
-        if (pi->nwrite == pi->nread + PIPESIZE) {  // DOC: pipewrite-full
-            wakeup(&pi->nread);
-            sleep(&pi->nwrite, &pi->lock);
-        } else {
-            char ch;
-            if (copyin(pr->pagetable, &ch, addr + i, 1) == -1) break;
-            pi->data[pi->nwrite++ % PIPESIZE] = ch;
-            i++;
+        m = n - i < PIPESIZE ? n - i : PIPESIZE;
+        if (copyin(pr->pagetable, buf, addr + i, m) == -1) break;
+        acquire(&pi->lock);
+        for (j = 0; j < m;) {
+            if (pi->readopen == 0 || killed(pr)) {
+                release(&pi->lock);
+                return -1;
+            }
+            if (pi->nwrite == pi->nread + PIPESIZE) {  // DOC: pipewrite-full
+                wakeup(&pi->nread);
+                sleep(&pi->nwrite, &pi->lock);
+            } else {
+                pi->data[pi->nwrite++ % PIPESIZE] = buf[j++];
+            }
         }
+        wakeup(&pi->nread);
+        release(&pi->lock);
+        i += m;
     }
-    wakeup(&pi->nread);
-    release(&pi->lock);
 
     return i;
 }
@@ -96,7 +111,7 @@ int pipewrite(struct pipe *pi, uint64 addr, int n) {
 int piperead(struct pipe *pi, uint64 addr, int n) {
     int i;
     struct proc *pr = myproc();
-    char ch;
+    char buf[PIPESIZE];
 
     acquire(&pi->lock);
     while (pi->nread == pi->nwrite && pi->writeopen) {  // DOC: pipe-empty
@@ -106,12 +121,13 @@ int piperead(struct pipe *pi, uint64 addr, int n) {
         }
         sleep(&pi->nread, &pi->lock);  // DOC: piperead-sleep
     }
+    // the pipe never holds more than buf does.
     for (i = 0; i < n; i++) {  // DOC: piperead-copy
         if (pi->nread == pi->nwrite) break;
-        ch = pi->data[pi->nread++ % PIPESIZE];
-        if (copyout(pr->pagetable, addr + i, &ch, 1) == -1) break;
+        buf[i] = pi->data[pi->nread++ % PIPESIZE];
     }
     wakeup(&pi->nwrite);  // DOC: piperead-wakeup
     release(&pi->lock);
+    if (i > 0 && copyout(pr->pagetable, addr, buf, i) == -1) return -1;
     return i;
 }
@@ -4,19 +4,105 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
+#include "timer.h"
+#include "sched.h"
 #include "defs.h"
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Process slots and pids.
+//
+// struct procs come from a slab cache as fork needs them,
+// up to maxproc live processes; there is no fixed table.
+// maxproc is set at boot from the free memory, allowing
+// PROCPAGES pages for each process, but at least NPROC. A
+// freed struct proc goes on a free list for the next fork
+// rather than back to the cache, so that memory that once
+// held a struct proc always does: code that looks at a
+// process without holding its lock, like wakeproc(), can
+// never touch memory put to another use. Every struct proc
+// ever made is on the procall list.
+//
+// Live processes are hashed by pid, so that kill need not
+// look at every process. Each process also lists its
+// children, for wait(), join() and exit().
+// pid_lock protects nextpid, the free list, procall, the
+// hash table, and nprocused; wait_lock protects the child
+// lists.
+//
+// Lock order: p->lock, then pid_lock.
+
+#define NPIDHASH 256
+#define PIDHASH(pid) ((uint)(pid) % NPIDHASH)
+#define PROCPAGES 64  // memory to allow for each process
+
+static struct kmem_cache *proccache;
+static struct proc *procall;   // every struct proc
+static struct proc *procfree;  // UNUSED ones
+static struct proc *pidhash[NPIDHASH];
+static int nprocused;          // processes not UNUSED
+static int maxproc;            // limit on nprocused
+
+// Kernel stacks.
+//
+// Each process has a page of kernel stack mapped high in
+// the kernel page table, above an unmapped guard page that
+// catches overflows. Stacks are made at fork when the pool
+// of free ones is empty, and go back to the pool, still
+// mapped, when their process is freed; they are never
+// unmapped, so no hart can hold a stale translation for one.
+// A hart may however remember that a new stack's address was
+// unmapped, so each hart flushes its TLB before it runs a
+// process after a new stack appeared (see scheduler()).
+
+static struct {
+    struct spinlock lock;
+    uint64 free;  // first free stack; each holds the address of the next
+    int n;        // stacks made so far
+    uint64 gen;   // bumped each time a stack is mapped
+} kstacks;
+
+// Threads.
+//
+// clone() makes a thread: a process that shares its
+// creator's address space (struct mm: the user page table,
+// heap size and memory areas) and its open files and
+// current directory (struct files), but has its own
+// registers, kernel stack, and pid, which serves as the
+// thread id. A thread is its creator's child, and is reaped
+// by join() rather than wait(). Each thread has its own
+// trapframe, mapped at THREADFRAME(p->tframe) in the shared
+// page table, where trampoline.S finds it; slot 0 belongs to
+// the first thread, and mm->frames has a bit for each slot in
+// use. mm->nthread counts the threads that have not exited,
+// and the last of them drops the memory areas; mm->ref counts
+// the struct procs that point to the mm, and the last of
+// them to be freed frees the page table.
+//
+// exitthread() ends one thread. exit(), from any thread,
+// ends the process: it kills the other threads, and the
+// first thread, which is the one the parent wait()s for,
+// waits for them to go before it becomes a zombie.
+//
+// Lock order: p->lock, then mm->lock.
+
+static struct kmem_cache *mmcache;
+
+extern pagetable_t kernel_pagetable;  // vm.c
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void mmput(struct proc *p);
+static void threadexit(struct proc *p, int status) __attribute__((noreturn));
+static void wakeproc(struct proc *p);
+static int runqidlest(void);
 
 extern char trampoline[];  // trampoline.S
 
@@ -26,31 +112,100 @@ extern char trampoline[];  // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
-void proc_mapstacks(pagetable_t kpgtbl) {
-    struct proc *p;
-
-    for (p = proc; p < &proc[NPROC]; p++) {
-        char *pa = kalloc();
-        if (pa == 0) panic("kalloc");
-        uint64 va = KSTACK((int)(p - proc));
-        kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+// Wait channels.
+//
+// A sleeping process is linked into the wait queue that its
+// channel hashes to, so that wakeup(chan) looks only at the
+// processes sleeping on channels with the same hash rather
+// than at every process. Whoever wakes a process takes it
+// off its queue.
+//
+// Lock order: a sleep() caller's lock, then a wait queue's
+// lock, then p->lock.
+
+#define NWAITQ 64
+#define WAITQHASH(chan) \
+    ((((uint64)(chan) >> 3) ^ ((uint64)(chan) >> 11)) % NWAITQ)
+
+static struct waitq {
+    struct spinlock lock;
+    struct proc *head;
+
+    // statistics, protected by lock.
+    int nwakeup;  // wakeup() calls
+    int nwoken;   // processes they woke
+    int nempty;   // calls that woke nobody
+    int nskip;    // sleepers passed over for another channel
+} waitq[NWAITQ];
+
+// Take a kernel stack from the pool, or make one.
+// Returns its address, or 0 if memory is exhausted.
+static uint64 kstackalloc(void) {
+    uint64 va;
+    char *pa;
+
+    acquire(&kstacks.lock);
+    if ((va = kstacks.free) != 0) {
+        kstacks.free = *(uint64 *)va;
+        release(&kstacks.lock);
+        return va;
     }
+    va = KSTACK(kstacks.n);
+    if ((pa = kalloc()) == 0 ||
+        mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) < 0) {
+        if (pa) kfree(pa);
+        release(&kstacks.lock);
+        return 0;
+    }
+    kstacks.n++;
+    __atomic_add_fetch(&kstacks.gen, 1, __ATOMIC_RELEASE);
+    release(&kstacks.lock);
+    return va;
+}
+
+// Put a kernel stack back in the pool.
+static void kstackfree(uint64 va) {
+    acquire(&kstacks.lock);
+    *(uint64 *)va = kstacks.free;
+    kstacks.free = va;
+    release(&kstacks.lock);
+}
+
+static void procctor(void *obj) {
+    struct proc *p = obj;
+
+    memset(p, 0, sizeof(*p));
+    initlock(&p->lock, "proc");
+    p->state = UNUSED;
+}
+
+static void mmctor(void *obj) {
+    struct mm *mm = obj;
+
+    initlock(&mm->lock, "mm");
+    initsleeplock(&mm->maplock, "maplock");
+}
+
+static void mmdtor(void *obj) {
+    struct mm *mm = obj;
+
+    freelock(&mm->lock);
+    freelock(&mm->maplock.lk);
 }
 
-// initialize the proc table.
+// initialize the process allocator.
 void procinit(void) {
-    struct proc *p;
+    struct cpu *c;
 
     initlock(&pid_lock, "nextpid");
     initlock(&wait_lock, "wait_lock");
-    for (p = proc; p < &proc[NPROC]; p++) {
-        initlock(&p->lock, "proc");
-        p->state = UNUSED;
-        p->kstack = KSTACK((int)(p - proc));
-    }
+    initlock(&kstacks.lock, "kstacks");
+    for (c = cpus; c < &cpus[NCPU]; c++) initlock(&c->rq.lock, "runq");
+    for (int i = 0; i < NWAITQ; i++) initlock(&waitq[i].lock, "waitq");
+    proccache = kmem_cache_create("proc", sizeof(struct proc), procctor, 0);
+    mmcache = kmem_cache_create("mm", sizeof(struct mm), mmctor, mmdtor);
+    maxproc = get_free_memory() / (PROCPAGES * PGSIZE);
+    if (maxproc < NPROC) maxproc = NPROC;
 }
 
 // Must be called with interrupts disabled,
@@ -78,48 +233,65 @@ struct proc *myproc(void) {
     return p;
 }
 
-int allocpid() {
-    int pid;
+// Return the process with the given pid, with p->lock
+// held, or 0 if there is none.
+static struct proc *pidlookup(int pid) {
+    struct proc *p;
 
     acquire(&pid_lock);
-    pid = nextpid;
-    nextpid = nextpid + 1;
+    for (p = pidhash[PIDHASH(pid)]; p && p->pid != pid; p = p->pidnext)
+        ;
     release(&pid_lock);
-
-    return pid;
+    if (p == 0) return 0;
+    acquire(&p->lock);
+    // it may have been freed, and the slot reused, meanwhile.
+    if (p->pid != pid || p->state == UNUSED) {
+        release(&p->lock);
+        return 0;
+    }
+    return p;
 }
 
-// Look in the process table for an UNUSED proc.
+// Take an UNUSED proc from the free list, or make one, and
+// give it a pid, a kernel stack and a trapframe, but no
+// address space yet (see mmalloc() and clone()).
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If there are maxproc processes, or a memory allocation fails, return 0.
 static struct proc *allocproc(void) {
     struct proc *p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->state == UNUSED) {
-            goto found;
-        } else {
-            release(&p->lock);
-        }
+    acquire(&pid_lock);
+    if (nprocused >= maxproc) {
+        release(&pid_lock);
+        return 0;
     }
-    return 0;
+    if ((p = procfree) != 0) {
+        procfree = p->pidnext;
+    } else if ((p = kmem_cache_alloc(proccache)) != 0) {
+        p->allnext = procall;
+        procall = p;
+    } else {
+        release(&pid_lock);
+        return 0;
+    }
+    p->pid = nextpid++;
+    p->pidnext = pidhash[PIDHASH(p->pid)];
+    pidhash[PIDHASH(p->pid)] = p;
+    nprocused++;
+    release(&pid_lock);
 
-found:
-    p->pid = allocpid();
+    acquire(&p->lock);
     p->state = USED;
 
-    // Allocate a trapframe page.
-    if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
+    if ((p->kstack = kstackalloc()) == 0) {
         freeproc(p);
         release(&p->lock);
         return 0;
     }
 
-    // An empty user page table.
-    p->pagetable = proc_pagetable(p);
-    if (p->pagetable == 0) {
+    // Allocate a trapframe page.
+    if ((p->trapframe = (struct trapframe *)kalloc()) == 0) {
         freeproc(p);
         release(&p->lock);
         return 0;
@@ -132,6 +304,13 @@ found:
     p->context.sp = p->kstack + PGSIZE;
 
     p->trace_mask = 0;
+    p->nfault = 0;
+    p->class = SCHED_FAIR;
+    p->nice = 0;
+    p->rtprio = 0;
+    p->pinned = 0;
+    p->vruntime = 0;
+    p->alarmticks = 0;
 
     return p;
 }
@@ -140,22 +319,86 @@ found:
 // including user pages.
 // p->lock must be held.
 static void freeproc(struct proc *p) {
+    struct proc **pp;
+
+    if (p->kstack) kstackfree(p->kstack);
+    p->kstack = 0;
+    if (p->mm) mmput(p);
     if (p->trapframe) kfree((void *)p->trapframe);
     p->trapframe = 0;
-    if (p->pagetable) proc_freepagetable(p->pagetable, p->sz);
-    p->pagetable = 0;
-    p->sz = 0;
-    p->pid = 0;
     p->parent = 0;
+    p->sibling = 0;
     p->name[0] = 0;
     p->chan = 0;
     p->killed = 0;
     p->xstate = 0;
     p->state = UNUSED;
+
+    // give back the pid and the slot.
+    acquire(&pid_lock);
+    for (pp = &pidhash[PIDHASH(p->pid)]; *pp != p; pp = &(*pp)->pidnext)
+        ;
+    *pp = p->pidnext;
+    p->pid = 0;
+    p->pidnext = procfree;
+    procfree = p;
+    nprocused--;
+    release(&pid_lock);
+}
+
+// Give p, the first thread of a new process, an address
+// space with no user memory.
+// Returns 0 on success, -1 if out of memory.
+static int mmalloc(struct proc *p) {
+    struct mm *mm;
+
+    if ((mm = kmem_cache_alloc(mmcache)) == 0) return -1;
+    if ((mm->pagetable = proc_pagetable(p)) == 0) {
+        kmem_cache_free(mmcache, mm);
+        return -1;
+    }
+    mm->ref = 1;
+    mm->nthread = 1;
+    mm->exiting = 0;
+    mm->frames = 1;
+    mm->sz = 0;
+    memset(mm->vma, 0, sizeof(mm->vma));
+    mm->asid = 0;
+    mm->tlbsync = 0;
+    p->mm = mm;
+    p->pagetable = mm->pagetable;
+    p->tframe = 0;
+    return 0;
+}
+
+// Drop p's use of its address space: unmap p's trapframe,
+// and free the page table if no other thread uses it.
+// p->lock must be held.
+static void mmput(struct proc *p) {
+    struct mm *mm = p->mm;
+    int last;
+
+    acquire(&mm->lock);
+    if ((last = --mm->ref == 0) == 0) {
+        uvmunmap(mm->pagetable, THREADFRAME(p->tframe), 1, 0);
+        mm->frames &= ~(1 << p->tframe);
+        // the caller may not be a thread of mm, so the
+        // unmap flushed no TLB; make sure that the next
+        // thread to get the slot doesn't find the old page.
+        __atomic_store_n(&mm->tlbsync, 0, __ATOMIC_RELAXED);
+    }
+    release(&mm->lock);
+    if (last) {
+        proc_freepagetable(mm->pagetable, mm->sz);
+        kmem_cache_free(mmcache, mm);
+    }
+    p->mm = 0;
+    p->pagetable = 0;
 }
 
 // Create a user page table for a given process, with no user memory,
-// but with trampoline and trapframe pages.
+// but with trampoline and trapframe pages. The trapframe goes
+// at TRAPFRAME, the first thread's slot.
 pagetable_t proc_pagetable(struct proc *p) {
     pagetable_t pagetable;
 
@@ -189,7 +432,7 @@ pagetable_t proc_pagetable(struct proc *p) {
 // physical memory it refers to.
 void proc_freepagetable(pagetable_t pagetable, uint64 sz) {
     uvmunmap(pagetable, TRAMPOLINE, 1, 0);
-    uvmunmap(pagetable, TRAPFRAME, 1, 0);
+    uvmunmap(pagetable, USERTOP, NTHREAD, 0);  // the trapframes
     uvmfree(pagetable, sz);
 }
 
@@ -209,61 +452,123 @@ void userinit(void) {
 
     p = allocproc();
     initproc = p;
+    if (mmalloc(p) < 0 || (p->files = filesalloc()) == 0)
+        panic("userinit");
 
     // allocate one user page and copy initcode's instructions
     // and data into it.
     uvmfirst(p->pagetable, initcode, sizeof(initcode));
-    p->sz = PGSIZE;
+    p->mm->sz = PGSIZE;
 
     // prepare for the very first "return" from kernel to user.
     p->trapframe->epc = 0;      // user program counter
     p->trapframe->sp = PGSIZE;  // user stack pointer
 
     safestrcpy(p->name, "initcode", sizeof(p->name));
-    p->cwd = namei("/");
+    p->files->cwd = namei("/");
 
-    p->state = RUNNABLE;
+    p->cpu = 0;
+    setrunnable(p);
 
     release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int growproc(int n) {
+// Growing only reserves the address space; usertrap()
+// maps each page when it is first touched. A request that
+// the free memory could not back right now fails, as an
+// eager allocation would.
+// Return the old size, or -1 on failure.
+uint64 growproc(int n) {
     uint64 sz;
     struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    uint64 r;
 
-    sz = p->sz;
+    acquiresleep(&mm->maplock);
+    acquire(&mm->lock);
+    r = sz = mm->sz;
     if (n > 0) {
-        if ((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
-            return -1;
-        }
+        uint64 npages = PGROUNDUP(sz + n) / PGSIZE - PGROUNDUP(sz) / PGSIZE;
+        npages += uvmptneed(p->pagetable, sz, sz + n);
+        if (sz + n >= USERTOP || vmaoverlap(p, sz, sz + n) ||
+            npages * PGSIZE > get_free_memory())
+            r = -1;
+        else
+            sz += n;
     } else if (n < 0) {
         sz = uvmdealloc(p->pagetable, sz, sz + n);
     }
-    p->sz = sz;
-    return 0;
+    mm->sz = sz;
+    release(&mm->lock);
+    releasesleep(&mm->maplock);
+    return r;
+}
+
+// Make np a child of p, in p's scheduling class, and let it
+// run. Returns np's pid.
+static int procstart(struct proc *np, struct proc *p) {
+    int pid = np->pid;
+
+    acquire(&wait_lock);
+    np->parent = p;
+    np->sibling = p->children;
+    p->children = np;
+    release(&wait_lock);
+
+    acquire(&np->lock);
+    np->class = p->class;
+    np->nice = p->nice;
+    np->rtprio = p->rtprio;
+    np->cpu = runqidlest();
+    np->vruntime = cpus[np->cpu].rq.minvruntime;
+    setrunnable(np);
+    release(&np->lock);
+
+    return pid;
 }
 
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int fork(void) {
-    int i, pid;
     struct proc *np;
     struct proc *p = myproc();
+    struct mm *mm = p->mm;
 
     // Allocate process.
     if ((np = allocproc()) == 0) {
         return -1;
     }
+    if (mmalloc(np) < 0) {
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+
+    // Copy user memory from parent to child, with the parent's
+    // other threads kept from changing it meanwhile.
+    acquire(&mm->lock);
+    if (uvmcopy(p->pagetable, np->pagetable, mm->sz) < 0) {
+        release(&mm->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    np->mm->sz = mm->sz;
+    if (vmadup(np, p) < 0) {
+        release(&mm->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    release(&mm->lock);
 
-    // Copy user memory from parent to child.
-    if (uvmcopy(p->pagetable, np->pagetable, p->sz) < 0) {
+    // increment reference counts on open file descriptors.
+    if ((np->files = filescopy(p->files)) == 0) {
         freeproc(np);
         release(&np->lock);
         return -1;
     }
-    np->sz = p->sz;
 
     // copy saved user registers.
     *(np->trapframe) = *(p->trapframe);
@@ -272,26 +577,115 @@ int fork(void) {
     // Cause fork to return 0 in the child.
     np->trapframe->a0 = 0;
 
-    // increment reference counts on open file descriptors.
-    for (i = 0; i < NOFILE; i++)
-        if (p->ofile[i]) np->ofile[i] = filedup(p->ofile[i]);
-    np->cwd = idup(p->cwd);
-
     safestrcpy(np->name, p->name, sizeof(p->name));
 
-    pid = np->pid;
-
     release(&np->lock);
 
-    acquire(&wait_lock);
-    np->parent = p;
-    release(&wait_lock);
+    return procstart(np, p);
+}
+
+// Create a thread of the current process, which shares its
+// address space and open files, and starts at fn(arg) with
+// its stack pointer at stack. Returns the new thread's id,
+// which is also its pid, or -1.
+int clone(uint64 fn, uint64 arg, uint64 stack) {
+    struct proc *np;
+    struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    int t;
+
+    if ((np = allocproc()) == 0) return -1;
+
+    // slot 0 is the first thread's, even after it is gone.
+    // once exit() has begun, killthreads() must see every
+    // thread, so none may be added.
+    acquire(&mm->lock);
+    for (t = 1; t < NTHREAD && (mm->frames & (1 << t)); t++)
+        ;
+    if (t == NTHREAD || mm->exiting || mappages(mm->pagetable, THREADFRAME(t), PGSIZE,
+                                 (uint64)np->trapframe, PTE_R | PTE_W) != 0) {
+        release(&mm->lock);
+        freeproc(np);
+        release(&np->lock);
+        return -1;
+    }
+    mm->frames |= 1 << t;
+    mm->ref++;
+    mm->nthread++;
+    np->mm = mm;
+    release(&mm->lock);
+    np->pagetable = mm->pagetable;
+    np->tframe = t;
+    np->files = filesdup(p->files);
+
+    *(np->trapframe) = *(p->trapframe);
+    np->trapframe->epc = fn;
+    np->trapframe->a0 = arg;
+    np->trapframe->sp = stack & ~0xfL;  // riscv sp must be 16-byte aligned
+    np->trapframe->ra = 0;
+    np->trace_mask = p->trace_mask;
+
+    safestrcpy(np->name, p->name, sizeof(p->name));
 
-    acquire(&np->lock);
-    np->state = RUNNABLE;
     release(&np->lock);
 
-    return pid;
+    return procstart(np, p);
+}
+
+// Call fn(mm, arg) for the address space of each process,
+// holding a reference to it so that fn may sleep.
+void mmforeach(void (*fn)(struct mm *, void *), void *arg) {
+    struct proc *q;
+    struct mm *mm;
+
+    // procall only grows at its head, and a struct proc is
+    // never freed, so the list can be followed unlocked.
+    acquire(&pid_lock);
+    q = procall;
+    release(&pid_lock);
+    for (; q; q = q->allnext) {
+        acquire(&q->lock);
+        // one call for the threads of a process.
+        if (q->state == UNUSED || (mm = q->mm) == 0 || q->tframe != 0) {
+            release(&q->lock);
+            continue;
+        }
+        acquire(&mm->lock);
+        mm->ref++;
+        release(&mm->lock);
+        release(&q->lock);
+
+        fn(mm, arg);
+
+        acquire(&mm->lock);
+        int last = --mm->ref == 0;
+        release(&mm->lock);
+        if (last) {
+            proc_freepagetable(mm->pagetable, mm->sz);
+            kmem_cache_free(mmcache, mm);
+        }
+    }
+}
+
+// Kill the other threads of p's process.
+static void killthreads(struct proc *p) {
+    int tid[NTHREAD], n = 0;
+    struct proc *q;
+
+    // a struct proc is never freed, so its mm can be looked
+    // at without its lock; pidlookup() then checks again.
+    acquire(&pid_lock);
+    for (q = procall; q && n < NTHREAD; q = q->allnext)
+        if (q != p && q->pid != 0 && q->mm == p->mm) tid[n++] = q->pid;
+    release(&pid_lock);
+
+    for (int i = 0; i < n; i++) {
+        if ((q = pidlookup(tid[i])) == 0) continue;
+        int mine = q->mm == p->mm;
+        if (mine) q->killed = 1;
+        release(&q->lock);
+        if (mine) wakeproc(q);
+    }
 }
 
 // Pass p's abandoned children to init.
@@ -299,43 +693,81 @@ int fork(void) {
 void reparent(struct proc *p) {
     struct proc *pp;
 
-    for (pp = proc; pp < &proc[NPROC]; pp++) {
-        if (pp->parent == p) {
-            pp->parent = initproc;
-            wakeup(initproc);
-        }
+    if (p->children == 0) return;
+    for (pp = p->children;; pp = pp->sibling) {
+        pp->parent = initproc;
+        if (pp->sibling == 0) break;
     }
+    pp->sibling = initproc->children;
+    initproc->children = p->children;
+    p->children = 0;
+    wakeup(initproc);
 }
 
-// Exit the current process.  Does not return.
-// An exited process remains in the zombie state
+// Exit the current process, with all its threads.  Does not
+// return. An exited process remains in the zombie state
 // until its parent calls wait().
 void exit(int status) {
     struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    int first;
 
     if (p == initproc) panic("init exiting");
 
-    // Close all open files.
-    for (int fd = 0; fd < NOFILE; fd++) {
-        if (p->ofile[fd]) {
-            struct file *f = p->ofile[fd];
-            fileclose(f);
-            p->ofile[fd] = 0;
-        }
+    // the first thread to call exit() sets the status, and
+    // kills the others, which then come here with -1.
+    acquire(&mm->lock);
+    if ((first = !mm->exiting) != 0) {
+        mm->exiting = 1;
+        mm->xstatus = status;
+    }
+    status = mm->xstatus;
+    release(&mm->lock);
+    if (first && mm->nthread > 1) killthreads(p);
+
+    // the parent may free the first thread as soon as it is
+    // a zombie, so it goes last.
+    if (p->tframe == 0) {
+        acquire(&wait_lock);
+        while (__atomic_load_n(&mm->nthread, __ATOMIC_SEQ_CST) > 1)
+            sleep(mm, &wait_lock);
+        release(&wait_lock);
     }
+    threadexit(p, status);
+}
+
+// End the calling thread. Does not return.
+// In the first thread, this ends the process.
+void exitthread(int status) {
+    struct proc *p = myproc();
+
+    if (p->tframe == 0) exit(status);
+    threadexit(p, status);
+}
+
+// Tear down thread p and make it a zombie, for join(),
+// or for wait() if it is the first thread.
+static void threadexit(struct proc *p, int status) {
+    // Close all open files, unless other threads share them.
+    filesput(p->files);
+    p->files = 0;
 
-    begin_op();
-    iput(p->cwd);
-    end_op();
-    p->cwd = 0;
+    // the last thread drops the memory areas; the page
+    // table goes when the last struct proc is freed.
+    acquire(&p->mm->lock);
+    int last = --p->mm->nthread == 0;
+    release(&p->mm->lock);
+    if (last) vmafree(p);
 
     acquire(&wait_lock);
 
     // Give any children to init.
     reparent(p);
 
-    // Parent might be sleeping in wait().
+    // Parent might be sleeping in wait() or join(), and the
+    // first thread in exit().
     wakeup(p->parent);
+    if (!last) wakeup(p->mm);
 
     acquire(&p->lock);
 
@@ -351,39 +783,42 @@ void exit(int status) {
 
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads of this process are left for join().
 int wait(uint64 addr) {
-    struct proc *pp;
-    int havekids, pid;
+    struct proc *pp, **link;
+    int havekids, pid, xstate;
     struct proc *p = myproc();
 
     acquire(&wait_lock);
 
     for (;;) {
-        // Scan through table looking for exited children.
+        // Scan through the children looking for exited ones.
         havekids = 0;
-        for (pp = proc; pp < &proc[NPROC]; pp++) {
-            if (pp->parent == p) {
-                // make sure the child isn't still in exit() or swtch().
-                acquire(&pp->lock);
-
-                havekids = 1;
-                if (pp->state == ZOMBIE) {
-                    // Found one.
-                    pid = pp->pid;
-                    if (addr != 0 &&
-                        copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                sizeof(pp->xstate)) < 0) {
-                        release(&pp->lock);
-                        release(&wait_lock);
-                        return -1;
-                    }
-                    freeproc(pp);
-                    release(&pp->lock);
-                    release(&wait_lock);
-                    return pid;
-                }
+        for (link = &p->children; (pp = *link) != 0; link = &pp->sibling) {
+            // a thread's mm doesn't change until it is freed.
+            if (pp->mm == p->mm) continue;
+
+            // make sure the child isn't still in exit() or swtch().
+            acquire(&pp->lock);
+
+            havekids = 1;
+            if (pp->state == ZOMBIE) {
+                // Found one.
+                pid = pp->pid;
+                xstate = pp->xstate;
+                *link = pp->sibling;
+                freeproc(pp);
                 release(&pp->lock);
+                release(&wait_lock);
+                // copyout() may fault, so not with the locks
+                // held; the child is gone even if it fails.
+                if (addr != 0 &&
+                    copyout(p->pagetable, addr, (char *)&xstate,
+                            sizeof(xstate)) < 0)
+                    return -1;
+                return pid;
             }
+            release(&pp->lock);
         }
 
         // No point waiting if we don't have any children.
@@ -397,38 +832,359 @@ int wait(uint64 addr) {
     }
 }
 
+// Wait for thread tid, which the caller created, to exit,
+// and reap it. Return tid, or -1 if tid is not such a
+// thread or the caller was killed.
+int join(int tid, uint64 addr) {
+    struct proc *pp, **link;
+    struct proc *p = myproc();
+    int xstate;
+
+    acquire(&wait_lock);
+
+    for (;;) {
+        for (link = &p->children; (pp = *link) != 0; link = &pp->sibling)
+            if (pp->pid == tid && pp->mm == p->mm) break;
+        if (pp == 0 || killed(p)) {
+            release(&wait_lock);
+            return -1;
+        }
+
+        // make sure the thread isn't still in exit() or swtch().
+        acquire(&pp->lock);
+        if (pp->state == ZOMBIE) {
+            xstate = pp->xstate;
+            *link = pp->sibling;
+            freeproc(pp);
+            release(&pp->lock);
+            release(&wait_lock);
+            // as in wait().
+            if (addr != 0 &&
+                copyout(p->pagetable, addr, (char *)&xstate,
+                        sizeof(xstate)) < 0)
+                return -1;
+            return tid;
+        }
+        release(&pp->lock);
+
+        sleep(p, &wait_lock);  // DOC: wait-sleep
+    }
+}
+
+// Run queues.
+//
+// Each CPU has a queue of the RUNNABLE processes that are
+// waiting for it, so that a CPU looking for work takes only
+// its own queue's lock rather than every p->lock. A process
+// joins the queue of the CPU it last ran on when it becomes
+// RUNNABLE, to find its cache state there; a new process
+// joins the shortest queue. A CPU whose queue is empty takes
+// the next process from the longest queue.
+// A CPU with nothing to run at all sleeps in wfi; whoever
+// queues work wakes it with an inter-processor interrupt.
+//
+// A queue holds two scheduling classes. Real-time processes
+// run first, highest priority first and round-robin within a
+// priority. Fair processes share the rest of the CPU in
+// proportion to weights derived from their nice values, as
+// in Linux's CFS: a fair process accrues virtual runtime, its
+// CPU time scaled by NICE0WEIGHT / its weight, and the CPU
+// runs the one with the least. The queue's minvruntime
+// follows the fair processes it runs; a process that was
+// asleep starts at most SLEEPCREDIT behind it, so that it
+// runs soon without having banked the time it slept.
+// A process that wakes up preempts the one running on its
+// CPU if it is of a higher class or priority, or if both are
+// fair and it trails by more than WAKEGRAN.
+//
+// Lock order: p->lock, then a run queue's lock.
+
+#define NICE0WEIGHT 1024
+#define SLEEPCREDIT 300000  // clock cycles; 30ms in qemu
+#define WAKEGRAN 10000      // clock cycles; 1ms in qemu
+
+// CPU share weights by nice value, from NICE_MIN up; each
+// step is about 1.25 times the next.
+static const int niceweight[NICE_MAX - NICE_MIN + 1] = {
+    /* -20 */ 88761, 71755, 56483, 46273, 36291,
+    /* -15 */ 29154, 23254, 18705, 14949, 11916,
+    /* -10 */ 9548,  7620,  6100,  4904,  3906,
+    /*  -5 */ 3121,  2501,  1991,  1586,  1277,
+    /*   0 */ 1024,  820,   655,   526,   423,
+    /*   5 */ 335,   272,   215,   172,   137,
+    /*  10 */ 110,   87,    70,    56,    45,
+    /*  15 */ 36,    29,    23,    18,    15,
+};
+
+// Add p to rq. A process that was asleep has its virtual
+// runtime brought up to near the queue's.
+static void runqput(struct runq *rq, struct proc *p, int woke) {
+    struct proc **pp;
+
+    acquire(&rq->lock);
+    if (p->class == SCHED_RT) {
+        p->rqnext = 0;
+        if (rq->rttail[p->rtprio])
+            rq->rttail[p->rtprio]->rqnext = p;
+        else
+            rq->rt[p->rtprio] = p;
+        rq->rttail[p->rtprio] = p;
+    } else {
+        uint64 floor = rq->minvruntime - SLEEPCREDIT;
+        if (woke && (long)(p->vruntime - floor) < 0) p->vruntime = floor;
+        // after those with the same virtual runtime.
+        for (pp = &rq->fair; *pp; pp = &(*pp)->rqnext)
+            if ((long)((*pp)->vruntime - p->vruntime) > 0) break;
+        p->rqnext = *pp;
+        *pp = p;
+    }
+    rq->n++;
+    if (p->pinned) rq->npinned++;
+    release(&rq->lock);
+}
+
+// Remove and return the process that should run next
+// from rq, or 0. A CPU stealing from another's queue
+// passes over the processes pinned to it.
+static struct proc *runqget(struct runq *rq, int steal) {
+    struct proc *p = 0, **pp, *prev;
+
+    acquire(&rq->lock);
+    for (int i = NRTPRIO - 1; i >= 0 && p == 0; i--) {
+        prev = 0;
+        for (pp = &rq->rt[i]; *pp; prev = *pp, pp = &(*pp)->rqnext) {
+            if (steal && (*pp)->pinned) continue;
+            p = *pp;
+            *pp = p->rqnext;
+            if (rq->rttail[i] == p) rq->rttail[i] = prev;
+            break;
+        }
+    }
+    for (pp = &rq->fair; p == 0 && *pp; pp = &(*pp)->rqnext) {
+        if (steal && (*pp)->pinned) continue;
+        p = *pp;
+        *pp = p->rqnext;
+        if ((long)(p->vruntime - rq->minvruntime) > 0)
+            rq->minvruntime = p->vruntime;
+    }
+    if (p) {
+        rq->n--;
+        if (p->pinned) rq->npinned--;
+    }
+    release(&rq->lock);
+    return p;
+}
+
+// Remove p from rq. Returns 0 if p was not there: a
+// scheduler may have taken it already.
+static int runqremove(struct runq *rq, struct proc *p) {
+    struct proc **pp, *prev = 0;
+    int found = 0;
+
+    acquire(&rq->lock);
+    pp = p->class == SCHED_RT ? &rq->rt[p->rtprio] : &rq->fair;
+    for (; *pp; prev = *pp, pp = &(*pp)->rqnext) {
+        if (*pp == p) {
+            *pp = p->rqnext;
+            if (p->class == SCHED_RT && rq->rttail[p->rtprio] == p)
+                rq->rttail[p->rtprio] = prev;
+            rq->n--;
+            if (p->pinned) rq->npinned--;
+            found = 1;
+            break;
+        }
+    }
+    release(&rq->lock);
+    return found;
+}
+
+// Take a process from the longest queue of another CPU,
+// for CPU id, whose own queue is empty. Returns 0 if every
+// queue is empty, or holds only pinned processes.
+static struct proc *runqsteal(int id) {
+    struct cpu *c, *busiest = 0;
+    struct proc *p;
+    int max = 0;
+
+    // the lengths are read without locks; they only
+    // guide the choice.
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+        if (c != &cpus[id] && c->rq.n - c->rq.npinned > max) {
+            max = c->rq.n - c->rq.npinned;
+            busiest = c;
+        }
+    }
+    if (busiest == 0 || (p = runqget(&busiest->rq, 1)) == 0) return 0;
+    // keep its place relative to the other queue's processes.
+    p->vruntime += cpus[id].rq.minvruntime - busiest->rq.minvruntime;
+    cpus[id].rq.nsteal++;
+    return p;
+}
+
+// Return the CPU with the fewest queued processes, for a
+// new process.
+static int runqidlest(void) {
+    struct cpu *c, *best = &cpus[0];
+
+    for (c = cpus; c < &cpus[NCPU]; c++)
+        if (c->online && c->rq.n < best->rq.n) best = c;
+    return best - cpus;
+}
+
+// Wake a sleeping CPU for work just queued on CPU id:
+// id itself if it sleeps, else another one to steal it.
+static void runqkick(int id) {
+    struct cpu *c;
+
+    __sync_synchronize();  // pairs with the one in idle()
+    if (cpus[id].idle) {
+        ipi(id);
+        return;
+    }
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+        if (c->idle) {
+            ipi(c - cpus);
+            return;
+        }
+    }
+}
+
+// Should p, just queued on CPU c, preempt the process
+// running there? c's process is read without its lock,
+// which makes the answer a hint.
+static int preempts(struct proc *p, struct cpu *c) {
+    struct proc *cur = c->proc;
+
+    if (cur == 0 || cur == p) return 0;
+    if (p->class != cur->class) return p->class == SCHED_RT;
+    if (p->class == SCHED_RT) return p->rtprio > cur->rtprio;
+    return (long)(cur->vruntime - p->vruntime) > WAKEGRAN;
+}
+
+// Charge running process p for the CPU time it has used
+// since it was last charged. Caller must hold p->lock.
+static void charge(struct proc *p) {
+    uint64 now = clocknow();
+    uint64 delta = now - p->runstart;
+
+    p->runstart = now;
+    if (p->class == SCHED_FAIR)
+        p->vruntime += delta * NICE0WEIGHT / niceweight[p->nice - NICE_MIN];
+}
+
+// Mark p RUNNABLE and queue it on its CPU.
+// Caller must hold p->lock.
+void setrunnable(struct proc *p) {
+    struct cpu *c = &cpus[p->cpu];
+
+    if (!holding(&p->lock)) panic("setrunnable");
+    // a yielding process is about to make room for itself.
+    if (p->state == RUNNING) {
+        charge(p);
+        p->state = RUNNABLE;
+        runqput(&c->rq, p, 0);
+        return;
+    }
+    int woke = p->state == SLEEPING;
+    p->state = RUNNABLE;
+    runqput(&c->rq, p, woke);
+    if (woke && preempts(p, c)) {
+        // the clock interrupt handler makes c's process yield.
+        mycpu()->rq.npreempt++;
+        ipi(p->cpu);
+    } else {
+        runqkick(p->cpu);
+    }
+}
+
+// Sleep until an interrupt, with nothing to run: until
+// another CPU queues work (see runqkick()), a device
+// interrupts, or the first pending timer is due.
+static void idle(struct cpu *c) {
+    uint t;
+    int work = 0;
+
+    intr_off();
+    c->idle = 1;
+    // look again now that runqkick() can see c->idle, in
+    // case work was queued before it could.
+    __sync_synchronize();
+    for (struct cpu *o = cpus; o < &cpus[NCPU]; o++)
+        if (o->rq.n - (o == c ? 0 : o->rq.npinned) > 0) work = 1;
+    if (!work) {
+        if (timernext(&t))
+            clockarm(t);
+        else
+            clockdisarm();
+        c->rq.nidle++;
+        wfi();
+        // ticks stood still if every CPU was asleep.
+        clockintr();
+    }
+    c->idle = 0;
+    intr_on();  // take the interrupt that woke us
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - choose a process to run, from this CPU's run queue
+//    or else from another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
 void scheduler(void) {
     struct proc *p;
     struct cpu *c = mycpu();
+    int id = cpuid();
 
     c->proc = 0;
+    c->online = 1;
     for (;;) {
         // Avoid deadlock by ensuring that devices can interrupt.
         intr_on();
 
-        for (p = proc; p < &proc[NPROC]; p++) {
-            acquire(&p->lock);
-            if (p->state == RUNNABLE) {
-                // Switch to chosen process.  It is the process's job
-                // to release its lock and then reacquire it
-                // before jumping back to us.
-                p->state = RUNNING;
-                c->proc = p;
-                swtch(&c->context, &p->context);
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-            }
+        if ((p = runqget(&c->rq, 0)) == 0 && (p = runqsteal(id)) == 0) {
+            // nothing to run: use the time to zero free pages,
+            // then sleep.
+            if (!kzerofill()) idle(c);
+            continue;
+        }
+
+        // a queued process stays RUNNABLE until a scheduler
+        // takes it off the queue.
+        acquire(&p->lock);
+        if (p->state != RUNNABLE) panic("scheduler: queued");
+        // setaffinity() pinned p elsewhere after we took it
+        // off the queue; send it there.
+        if (p->pinned && p->cpu != id) {
+            runqput(&cpus[p->cpu].rq, p, 0);
+            runqkick(p->cpu);
             release(&p->lock);
+            continue;
+        }
+
+        // Switch to chosen process.  It is the process's job
+        // to release its lock and then reacquire it
+        // before jumping back to us.
+        p->state = RUNNING;
+        p->cpu = id;
+        p->runstart = clocknow();
+        c->proc = p;
+        clockslice();
+        // p's kernel stack may be newer than this hart's TLB.
+        uint64 gen = __atomic_load_n(&kstacks.gen, __ATOMIC_ACQUIRE);
+        if (c->kstackgen != gen) {
+            sfence_vma();
+            c->kstackgen = gen;
         }
+        swtch(&c->context, &p->context);
+
+        // Process is done running for now.
+        // It should have changed its p->state before coming back.
+        c->proc = 0;
+        c->rq.nswitch++;
+        release(&p->lock);
     }
 }
 
@@ -448,6 +1204,7 @@ void sched(void) {
     if (p->state == RUNNING) panic("sched running");
     if (intr_get()) panic("sched interruptible");
 
+    charge(p);
     intena = mycpu()->intena;
     swtch(&p->context, &mycpu()->context);
     mycpu()->intena = intena;
@@ -457,7 +1214,7 @@ void sched(void) {
 void yield(void) {
     struct proc *p = myproc();
     acquire(&p->lock);
-    p->state = RUNNABLE;
+    setrunnable(p);
     sched();
     release(&p->lock);
 }
@@ -481,24 +1238,54 @@ void forkret(void) {
     usertrapret();
 }
 
+static struct waitq *chanwaitq(void *chan) { return &waitq[WAITQHASH(chan)]; }
+
+// Take p off wait queue wq and make it RUNNABLE.
+// Caller must hold wq->lock and p->lock.
+static void waitqwake(struct waitq *wq, struct proc *p) {
+    *p->wqprev = p->wqnext;
+    if (p->wqnext) p->wqnext->wqprev = p->wqprev;
+    p->wqnext = 0;
+    p->wqprev = 0;
+    setrunnable(p);
+}
+
 // Atomically release lock and sleep on chan.
-// Reacquires lock when awakened.
-void sleep(void *chan, struct spinlock *lk) {
+// Reacquires lock when awakened. If timed, this is
+// sleepuntil() and its timer may already have fired.
+static void sleep1(void *chan, struct spinlock *lk, int timed) {
     struct proc *p = myproc();
+    struct waitq *wq = chanwaitq(chan);
 
     // Must acquire p->lock in order to
     // change p->state and then call sched.
-    // Once we hold p->lock, we can be
-    // guaranteed that we won't miss any wakeup
-    // (wakeup locks p->lock),
+    // Once we hold the channel's wait queue
+    // lock, we can be guaranteed that we won't
+    // miss any wakeup (wakeup locks it),
     // so it's okay to release lk.
 
-    acquire(&p->lock);  // DOC: sleeplock1
+    acquire(&wq->lock);  // DOC: sleeplock1
+    acquire(&p->lock);
     release(lk);
 
+    // sleepuntil()'s deadline passed before we got here.
+    // A plain sleep() has no deadline, so pays no heed.
+    if (!timed) p->timedout = 0;
+    if (p->timedout) {
+        release(&p->lock);
+        release(&wq->lock);
+        acquire(lk);
+        return;
+    }
+
     // Go to sleep.
     p->chan = chan;
     p->state = SLEEPING;
+    p->wqnext = wq->head;
+    p->wqprev = &wq->head;
+    if (wq->head) wq->head->wqprev = &p->wqnext;
+    wq->head = p;
+    release(&wq->lock);
 
     sched();
 
@@ -510,42 +1297,195 @@ void sleep(void *chan, struct spinlock *lk) {
     acquire(lk);
 }
 
+void sleep(void *chan, struct spinlock *lk) { sleep1(chan, lk, 0); }
+
 // Wake up all processes sleeping on chan.
 // Must be called without any p->lock.
 void wakeup(void *chan) {
-    struct proc *p;
+    struct waitq *wq = chanwaitq(chan);
+    struct proc *p, *next;
+    int n = 0;
+
+    acquire(&wq->lock);
+    for (p = wq->head; p; p = next) {
+        // p->chan doesn't change while p is on the queue.
+        next = p->wqnext;
+        if (p->chan != chan) {
+            wq->nskip++;
+            continue;
+        }
+        // p->lock is held until p has finished going to sleep.
+        acquire(&p->lock);
+        waitqwake(wq, p);
+        release(&p->lock);
+        n++;
+    }
+    wq->nwakeup++;
+    wq->nwoken += n;
+    if (n == 0) wq->nempty++;
+    release(&wq->lock);
+}
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        if (p != myproc()) {
-            acquire(&p->lock);
-            if (p->state == SLEEPING && p->chan == chan) {
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
+// Wake p if it is sleeping, whatever its channel.
+// Must be called without any p->lock.
+static void wakeproc(struct proc *p) {
+    for (;;) {
+        acquire(&p->lock);
+        void *chan = p->chan;
+        int sleeping = p->state == SLEEPING;
+        release(&p->lock);
+        if (!sleeping) return;
+
+        struct waitq *wq = chanwaitq(chan);
+        acquire(&wq->lock);
+        acquire(&p->lock);
+        if (p->state == SLEEPING && p->chan == chan) {
+            waitqwake(wq, p);
+            sleeping = 0;
         }
+        release(&p->lock);
+        release(&wq->lock);
+        // otherwise p woke up and went to sleep on
+        // another channel meanwhile; try again.
+        if (!sleeping) return;
     }
 }
 
+// Timer function for sleepuntil().
+static void sleeptimeout(void *arg) {
+    struct proc *p = arg;
+
+    acquire(&p->lock);
+    p->timedout = 1;
+    release(&p->lock);
+    wakeproc(p);
+}
+
+// Like sleep(), but also wake up once the tick count
+// reaches deadline. Returns 1 if the deadline has passed,
+// 0 if woken before it. Like sleep(), may return early
+// for no reason; callers recheck their condition.
+int sleepuntil(void *chan, struct spinlock *lk, uint deadline) {
+    struct proc *p = myproc();
+    struct timer t;
+    int timedout;
+
+    t.prev = 0;
+    timerset(&t, deadline, sleeptimeout, p);
+    sleep1(chan, lk, 1);
+    // sleeptimeout() has finished or will never run.
+    timerdel(&t);
+
+    acquire(&p->lock);
+    timedout = p->timedout;
+    p->timedout = 0;
+    release(&p->lock);
+    return timedout;
+}
+
 // Kill the process with the given pid.
 // The victim won't exit until it tries to return
 // to user space (see usertrap() in trap.c).
 int kill(int pid) {
     struct proc *p;
 
-    for (p = proc; p < &proc[NPROC]; p++) {
-        acquire(&p->lock);
-        if (p->pid == pid) {
-            p->killed = 1;
-            if (p->state == SLEEPING) {
-                // Wake process from sleep().
-                p->state = RUNNABLE;
-            }
-            release(&p->lock);
-            return 0;
-        }
+    if ((p = pidlookup(pid)) == 0) return -1;
+    p->killed = 1;
+    release(&p->lock);
+    // Wake process from sleep().
+    wakeproc(p);
+    return 0;
+}
+
+// Return the process with the given pid, or the caller if
+// pid is 0, with p->lock held. Returns 0 if there is no such
+// process, or it has exited.
+static struct proc *findproc(int pid) {
+    struct proc *p;
+
+    if (pid == 0) pid = myproc()->pid;
+    if ((p = pidlookup(pid)) != 0 && p->state == ZOMBIE) {
         release(&p->lock);
+        p = 0;
+    }
+    return p;
+}
+
+// Set the scheduling class of process pid (0 for the
+// caller) and its priority in the class: a nice value for
+// SCHED_FAIR, a real-time priority for SCHED_RT.
+int setpriority(int pid, int class, int prio) {
+    struct proc *p;
+    int queued;
+
+    if (class == SCHED_FAIR) {
+        if (prio < NICE_MIN || prio > NICE_MAX) return -1;
+    } else if (class == SCHED_RT) {
+        if (prio < RTPRIO_MIN || prio > RTPRIO_MAX) return -1;
+    } else {
+        return -1;
+    }
+    if ((p = findproc(pid)) == 0) return -1;
+
+    // a queued process moves to its new place in the queue.
+    struct runq *rq = &cpus[p->cpu].rq;
+    queued = p->state == RUNNABLE && runqremove(rq, p);
+    if (p->state == RUNNING) charge(p);  // at the old weight
+    // a real-time process's virtual runtime is stale.
+    if (class == SCHED_FAIR && p->class == SCHED_RT)
+        p->vruntime = rq->minvruntime;
+    p->class = class;
+    if (class == SCHED_FAIR)
+        p->nice = prio;
+    else
+        p->rtprio = prio;
+    if (queued) runqput(rq, p, 0);
+    release(&p->lock);
+    return 0;
+}
+
+// Pin process pid (0 for the caller) to CPU cpu, so that no
+// other CPU steals it, or unpin it if cpu is -1. A process
+// running elsewhere moves when it next gives up its CPU; the
+// caller moves at once. Children start unpinned.
+int setaffinity(int pid, int cpu) {
+    struct proc *p;
+    int queued;
+
+    if (cpu < -1 || cpu >= NCPU || (cpu >= 0 && !cpus[cpu].online)) return -1;
+    if ((p = findproc(pid)) == 0) return -1;
+
+    // a RUNNABLE process that isn't queued has been taken by
+    // a scheduler that is waiting for p->lock; it checks
+    // p->pinned and p->cpu before running p.
+    struct runq *rq = &cpus[p->cpu].rq;
+    queued = p->state == RUNNABLE && runqremove(rq, p);
+    p->pinned = cpu >= 0;
+    if (cpu >= 0 && cpu != p->cpu) {
+        // keep its place relative to the new queue's processes.
+        p->vruntime += cpus[cpu].rq.minvruntime - rq->minvruntime;
+        p->cpu = cpu;
+    }
+    if (queued) {
+        runqput(&cpus[p->cpu].rq, p, 0);
+        runqkick(p->cpu);
     }
-    return -1;
+    int self = p == myproc();
+    release(&p->lock);
+    if (self && cpu >= 0) yield();
+    return 0;
+}
+
+// Get the scheduling class and priority of process pid
+// (0 for the caller).
+int getpriority(int pid, int *class, int *prio) {
+    struct proc *p;
+
+    if ((p = findproc(pid)) == 0) return -1;
+    *class = p->class;
+    *prio = p->class == SCHED_FAIR ? p->nice : p->rtprio;
+    release(&p->lock);
+    return 0;
 }
 
 void setkilled(struct proc *p) {
@@ -600,23 +1540,54 @@ void procdump(void) {
     char *state;
 
     printf("\n");
-    for (p = proc; p < &proc[NPROC]; p++) {
+    for (p = procall; p; p = p->allnext) {
         if (p->state == UNUSED) continue;
         if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
             state = states[p->state];
         else
             state = "???";
-        printf("%d %s %s", p->pid, state, p->name);
+        printf("%d %s %s faults %d", p->pid, state, p->name, (int)p->nfault);
         printf("\n");
     }
 }
 
+// Return the number of processes, for sysinfo.
 uint64 get_unused_process(void) {
-    int num = 0;
-    for (int i = 0; i < NPROC; i++) {
-        if (proc[i].state != UNUSED) {
-            num++;
-        }
+    return __atomic_load_n(&nprocused, __ATOMIC_RELAXED);
+}
+// Report each online CPU's run queue for the stats device.
+int statssched(char *buf, int sz) {
+    struct cpu *c;
+    int n;
+
+    n = snprintf(buf, sz, "--- sched\n");
+    for (c = cpus; c < &cpus[NCPU]; c++) {
+        if (!c->online) continue;
+        n += snprintf(buf + n, sz - n,
+                      "cpu %d: queued %d, switches %d, steals %d, idle %d, "
+                      "preemptions %d\n",
+                      (int)(c - cpus), c->rq.n, c->rq.nswitch, c->rq.nsteal,
+                      c->rq.nidle, c->rq.npreempt);
     }
-    return num;
-}
\ No newline at end of file
+    return n;
+}
+
+// Report wait queue activity for the stats device.
+int statswait(char *buf, int sz) {
+    int nwakeup = 0, nwoken = 0, nempty = 0, nskip = 0, nsleep = 0;
+    struct proc *p;
+
+    for (struct waitq *wq = waitq; wq < &waitq[NWAITQ]; wq++) {
+        acquire(&wq->lock);
+        nwakeup += wq->nwakeup;
+        nwoken += wq->nwoken;
+        nempty += wq->nempty;
+        nskip += wq->nskip;
+        for (p = wq->head; p; p = p->wqnext) nsleep++;
+        release(&wq->lock);
+    }
+    return snprintf(buf, sz,
+                    "--- wait\nwakeups %d, woken %d, without sleepers %d, "
+                    "other channels skipped %d, sleeping %d\n",
+                    nwakeup, nwoken, nempty, nskip, nsleep);
+}
@@ -18,12 +18,37 @@ struct context {
     uint64 s11;
 };
 
+// A CPU's queue of RUNNABLE processes; see proc.c.
+struct runq {
+    struct spinlock lock;
+    struct proc *rt[NRTPRIO];      // real-time processes, FIFO per priority
+    struct proc *rttail[NRTPRIO];
+    struct proc *fair;             // fair processes, by virtual runtime
+    uint64 minvruntime;            // never decreases; see proc.c
+    int n;                         // processes in the queue
+    int npinned;                   // of them, those pinned to this CPU
+
+    // statistics, written only by the queue's CPU.
+    int nswitch;   // processes this CPU switched to
+    int nsteal;    // processes this CPU took from other queues
+    int nidle;     // times this CPU slept for want of work
+    int npreempt;  // wakeups by this CPU that preempted a process
+};
+
 // Per-CPU state.
 struct cpu {
     struct proc *proc;       // The process running on this cpu, or null.
     struct context context;  // swtch() here to enter scheduler().
     int noff;                // Depth of push_off() nesting.
     int intena;              // Were interrupts enabled before push_off()?
+    uint64 asidgen;          // ASID generation the TLB was last flushed for
+    uint64 kstackgen;        // Kernel stacks mapped when the TLB was last flushed
+    int online;              // Has entered scheduler()?
+    struct runq rq;          // Processes waiting to run on this cpu
+    int idle;                // Waiting in wfi for work?
+    int tlbflush;            // Another hart wants this TLB flushed; see asid.c
+    uint rcuepoch;           // Epoch of the RCU read section, or 0; see rcu.c
+    int rcunest;             // Depth of rcureadlock() nesting.
 };
 
 extern struct cpu cpus[NCPU];
@@ -79,6 +104,18 @@ struct trapframe {
     /* 280 */ uint64 t6;
 };
 
+// A memory area; see vma.c.
+struct vma {
+    uint64 start;       // first address, page-aligned
+    uint64 end;         // one past the last address; 0 if the slot is free
+    int perm;           // PTE_R, PTE_W, PTE_X
+    int flags;          // MAP_* for mmap() areas; 0 for program segments
+    struct inode *ip;   // backing file; 0 for anonymous memory
+    uint off;           // file offset of start
+    uint filesz;        // bytes backed by the file; the rest read as 0
+    uint guard;         // MAP_STACK: pages per stack, the first a guard page
+};
+
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -91,18 +128,52 @@ struct proc {
     int killed;            // If non-zero, have been killed
     int xstate;            // Exit status to be returned to parent's wait
     int pid;               // Process ID
+    int cpu;               // CPU whose run queue it joins when RUNNABLE
+    int timedout;          // sleepuntil()'s deadline has passed
+    int class;             // Scheduling class, SCHED_FAIR or SCHED_RT
+    int nice;              // NICE_MIN..NICE_MAX, for SCHED_FAIR
+    int rtprio;            // RTPRIO_MIN..RTPRIO_MAX, for SCHED_RT
+    int pinned;            // Runs only on CPU cpu; see setaffinity()
+    uint64 vruntime;       // Weighted CPU time, for SCHED_FAIR
+    uint64 runstart;       // Clock when last switched to or charged
 
-    // wait_lock must be held when using this:
-    struct proc *parent;  // Parent process
+    // the run queue's lock must be held when using this:
+    struct proc *rqnext;  // Next in the run queue
+
+    // the wait queue's lock must be held when using these:
+    struct proc *wqnext;   // Next sleeper in the wait queue
+    struct proc **wqprev;  // Link that points to this one
+
+    // pid_lock must be held when using these:
+    struct proc *pidnext;  // Next in the pid hash chain or the free list
+    struct proc *allnext;  // Next on the list of every struct proc
+
+    // wait_lock must be held when using these:
+    struct proc *parent;    // Parent process
+    struct proc *children;  // First child
+    struct proc *sibling;   // Next child of the parent
 
     // these are private to the process, so p->lock need not be held.
     uint64 kstack;                // Virtual address of kernel stack
-    uint64 sz;                    // Size of process memory (bytes)
-    pagetable_t pagetable;        // User page table
+    struct mm *mm;                // Address space, shared by threads
+    pagetable_t pagetable;        // mm->pagetable, which only exec changes
+    struct files *files;          // Open files and cwd, shared by threads
+    int tframe;                   // Trapframe slot: mapped at THREADFRAME(tframe)
     struct trapframe *trapframe;  // data page for trampoline.S
     struct context context;       // swtch() here to run process
-    struct file *ofile[NOFILE];   // Open files
-    struct inode *cwd;            // Current directory
     char name[16];                // Process name (debugging)
     uint64 trace_mask;            // Trace mask
+    uint64 nfault;                // Lazy pages faulted in
+    int alarmticks;               // sigalarm() interval in ticks; 0 if off
+    uint alarmnext;               // Tick of the next alarm
+    uint64 alarmfn;               // User address of the alarm handler
+};
+
+// A process's open files and current directory, shared by
+// its threads. lock protects ofile and cwd.
+struct files {
+    struct spinlock lock;
+    int ref;                     // processes that use it
+    struct file *ofile[NOFILE];  // Open files
+    struct inode *cwd;           // Current directory
 };
@@ -0,0 +1,141 @@
+// Read-copy-update, by epochs.
+//
+// Readers of an RCU-protected structure take no locks: they
+// bracket their reads with rcureadlock() and rcureadunlock(),
+// and must not sleep in between. A writer, holding whatever
+// lock writers use, unlinks an object so that new readers
+// can't reach it, then hands it to rcuretire(), which frees
+// it once every reader that might still see it is done.
+//
+// A global epoch counts up. A hart in a read section
+// records the epoch it entered in, in c->rcuepoch, and 0
+// when it leaves. The epoch may move on from e once no hart
+// is in a section that entered before e; so by the time it
+// reaches e + 2, every reader that was in a section when an
+// object was retired in epoch e has left. Retired objects
+// wait on one of three lists, by epoch mod 3. rcupoll()
+// moves the epoch on when it can and frees what has waited
+// long enough; rcuretire() calls it, and a timer keeps
+// calling it while objects wait, since an idle hart may
+// never take another clock interrupt.
+//
+// Read sections run with interrupts off, so a hart's
+// context switches and idle time are all outside them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timer.h"
+#include "rcu.h"
+#include "defs.h"
+
+static struct {
+    struct spinlock lock;
+    uint epoch;                  // starts at 1; 0 means "not reading"
+    struct rcuhead *limbo[3];    // retired in epoch e, at e % 3
+    struct timer timer;          // polls while objects wait
+    int timerset;
+
+    // statistics, protected by lock.
+    int nretire;
+    int nfree;  // atomic
+    int nadvance;
+} rcu;
+
+static void rcutimer(void *);
+
+void rcuinit(void) {
+    initlock(&rcu.lock, "rcu");
+    rcu.epoch = 1;
+}
+
+void rcureadlock(void) {
+    push_off();
+    struct cpu *c = mycpu();
+    if (c->rcunest++ == 0) {
+        __atomic_store_n(&c->rcuepoch, __atomic_load_n(&rcu.epoch, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        // pairs with the barrier in rcupoll(): either it sees
+        // this epoch, or this section sees what was unlinked
+        // before the epoch moved on.
+        __sync_synchronize();
+    }
+}
+
+void rcureadunlock(void) {
+    struct cpu *c = mycpu();
+    if (c->rcunest < 1) panic("rcureadunlock");
+    if (--c->rcunest == 0) __atomic_store_n(&c->rcuepoch, 0, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+// Move the epoch on if every reader has caught up with it,
+// and free the objects that were retired two epochs ago.
+void rcupoll(void) {
+    struct rcuhead *h, *next;
+
+    acquire(&rcu.lock);
+    __sync_synchronize();
+    for (struct cpu *c = cpus; c < &cpus[NCPU]; c++) {
+        uint e = __atomic_load_n(&c->rcuepoch, __ATOMIC_ACQUIRE);
+        if (e != 0 && e != rcu.epoch) {
+            release(&rcu.lock);
+            return;
+        }
+    }
+    rcu.epoch++;
+    rcu.nadvance++;
+    // (epoch - 2) % 3: no reader can see these any more.
+    h = rcu.limbo[(rcu.epoch + 1) % 3];
+    rcu.limbo[(rcu.epoch + 1) % 3] = 0;
+    release(&rcu.lock);
+
+    for (; h; h = next) {
+        next = h->next;
+        h->fn(h->arg);
+        __atomic_fetch_add(&rcu.nfree, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Call fn(arg) once no reader can still see the object h
+// belongs to, which the caller has already unlinked.
+void rcuretire(struct rcuhead *h, void (*fn)(void *), void *arg) {
+    int set = 0;
+
+    h->fn = fn;
+    h->arg = arg;
+    acquire(&rcu.lock);
+    h->next = rcu.limbo[rcu.epoch % 3];
+    rcu.limbo[rcu.epoch % 3] = h;
+    rcu.nretire++;
+    if (!rcu.timerset) set = rcu.timerset = 1;
+    release(&rcu.lock);
+    if (set) timerset(&rcu.timer, getticks() + 1, rcutimer, 0);
+    rcupoll();
+}
+
+// Poll every tick while objects wait.
+static void rcutimer(void *arg) {
+    int set;
+
+    rcupoll();
+    acquire(&rcu.lock);
+    set = rcu.timerset = rcu.limbo[0] || rcu.limbo[1] || rcu.limbo[2];
+    release(&rcu.lock);
+    if (set) timerset(&rcu.timer, getticks() + 1, rcutimer, 0);
+}
+
+// Report RCU activity for the stats device.
+int statsrcu(char *buf, int sz) {
+    int n;
+
+    acquire(&rcu.lock);
+    n = snprintf(buf, sz,
+                 "--- rcu\nepoch %d, advances %d, retired %d, freed %d\n",
+                 (int)rcu.epoch, rcu.nadvance, rcu.nretire, rcu.nfree);
+    release(&rcu.lock);
+    return n;
+}
@@ -0,0 +1,6 @@
+// An object waiting for rcuretire()'s grace period.
+struct rcuhead {
+    struct rcuhead *next;
+    void (*fn)(void *);  // called with arg once no reader can see it
+    void *arg;
+};
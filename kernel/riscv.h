@@ -149,6 +149,12 @@ static inline void w_pmpaddr0(uint64 x) {
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// the address space identifier field of satp.
+#define SATP_ASID_SHIFT 44
+#define SATP_ASID_MASK (0xffffL << SATP_ASID_SHIFT)
+#define MAKE_SATP_ASID(pagetable, asid) \
+    (MAKE_SATP(pagetable) | ((uint64)(asid) << SATP_ASID_SHIFT))
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void w_satp(uint64 x) {
@@ -190,6 +196,19 @@ static inline uint64 r_mcounteren() {
     return x;
 }
 
+// Supervisor Counter-Enable
+#define COUNTEREN_TM (1L << 1)  // time
+
+static inline void w_scounteren(uint64 x) {
+    asm volatile("csrw scounteren, %0" : : "r"(x));
+}
+
+static inline uint64 r_scounteren() {
+    uint64 x;
+    asm volatile("csrr %0, scounteren" : "=r"(x));
+    return x;
+}
+
 // machine-mode cycle counter
 static inline uint64 r_time() {
     uint64 x;
@@ -209,6 +228,10 @@ static inline int intr_get() {
     return (x & SSTATUS_SIE) != 0;
 }
 
+// wait for an interrupt. returns when one is pending,
+// even if device interrupts are disabled.
+static inline void wfi() { asm volatile("wfi"); }
+
 static inline uint64 r_sp() {
     uint64 x;
     asm volatile("mv %0, sp" : "=r"(x));
@@ -243,6 +266,16 @@ static inline void sfence_vma() {
     asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of address space asid.
+static inline void sfence_vma_asid(uint64 asid) {
+    asm volatile("sfence.vma zero, %0" : : "r"(asid) : "memory");
+}
+
+// flush the TLB entries for va in address space asid.
+static inline void sfence_vma_page(uint64 va, uint64 asid) {
+    asm volatile("sfence.vma %0, %1" : : "r"(va), "r"(asid) : "memory");
+}
+
 typedef uint64 pte_t;
 typedef uint64 *pagetable_t;  // 512 PTEs
 
@@ -254,11 +287,17 @@ typedef uint64 *pagetable_t;  // 512 PTEs
 #define PGROUNDUP(sz) (((sz) + PGSIZE - 1) & ~(PGSIZE - 1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE - 1))
 
+// a superpage is a 2 MiB mapping made by a leaf PTE
+// in a level-1 page table.
+#define SUPERPGORDER 9                         // 2^9 pages per superpage
+#define SUPERPGSIZE (PGSIZE << SUPERPGORDER)  // bytes per superpage
+
 #define PTE_V (1L << 0)  // valid
 #define PTE_R (1L << 1)
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4)    // user can access
+#define PTE_D (1L << 7)    // dirty
 #define PTE_COW (1L << 8)  // copy on write
 
 // shift a physical address to the right place for a PTE.
@@ -268,6 +307,9 @@ typedef uint64 *pagetable_t;  // 512 PTEs
 
 #define PTE_FLAGS(pte) ((pte)&0x3FF)
 
+// a valid PTE with any of R, W, X set is a leaf.
+#define PTE_LEAF(pte) ((pte) & (PTE_R | PTE_W | PTE_X))
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK 0x1FF  // 9 bits
 #define PXSHIFT(level) (PGSHIFT + (9 * (level)))
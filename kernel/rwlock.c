@@ -0,0 +1,85 @@
+// Reader-writer spin locks.
+//
+// Any number of harts may hold an rwlock for reading, or one
+// for writing. Like a spinlock, an rwlock is held with
+// interrupts off, and its holders must not sleep.
+//
+// Writers come first: a writer that finds the lock held
+// sets RW_WAITING, which keeps new readers out until the
+// readers inside have left and a writer has got in. A
+// reader that gets in costs one amoadd on the lock word and
+// one on the way out, and readers don't wait for each other.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "rwlock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "defs.h"
+
+#define RW_WRITER 1
+#define RW_WAITING 2
+#define RW_READER 4
+
+void initrwlock(struct rwlock *lk, char *name) {
+    lk->name = name;
+    lk->state = 0;
+    lk->cpu = 0;
+}
+
+void acquireread(struct rwlock *lk) {
+    push_off();
+    if (holdingwrite(lk)) panic("acquireread");
+    for (;;) {
+        uint s = __atomic_load_n(&lk->state, __ATOMIC_RELAXED);
+        if ((s & (RW_WRITER | RW_WAITING)) == 0 &&
+            __atomic_compare_exchange_n(&lk->state, &s, s + RW_READER, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        // the writer may be waiting in tlbshootdown() for
+        // this hart, which can't take the interrupt.
+        tlbcheck();
+    }
+}
+
+void releaseread(struct rwlock *lk) {
+    if (__atomic_load_n(&lk->state, __ATOMIC_RELAXED) < RW_READER)
+        panic("releaseread");
+    __atomic_fetch_sub(&lk->state, RW_READER, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+void acquirewrite(struct rwlock *lk) {
+    push_off();
+    if (holdingwrite(lk)) panic("acquirewrite");
+    for (;;) {
+        uint s = __atomic_load_n(&lk->state, __ATOMIC_RELAXED);
+        if ((s & ~RW_WAITING) == 0) {
+            // also clears RW_WAITING; other waiting writers
+            // set it again.
+            if (__atomic_compare_exchange_n(&lk->state, &s, RW_WRITER, 0,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+                break;
+        } else if ((s & RW_WAITING) == 0) {
+            __atomic_fetch_or(&lk->state, RW_WAITING, __ATOMIC_RELAXED);
+        }
+        tlbcheck();
+    }
+    lk->cpu = mycpu();
+}
+
+void releasewrite(struct rwlock *lk) {
+    if (!holdingwrite(lk)) panic("releasewrite");
+    lk->cpu = 0;
+    __atomic_fetch_and(&lk->state, ~RW_WRITER, __ATOMIC_RELEASE);
+    pop_off();
+}
+
+// Check whether this cpu holds the lock for writing.
+// Interrupts must be off.
+int holdingwrite(struct rwlock *lk) {
+    return (__atomic_load_n(&lk->state, __ATOMIC_RELAXED) & RW_WRITER) &&
+           lk->cpu == mycpu();
+}
@@ -0,0 +1,8 @@
+// Reader-writer spin lock.
+struct rwlock {
+    uint state;  // readers * RW_READER, plus RW_WRITER and RW_WAITING bits
+
+    // For debugging:
+    char *name;       // Name of lock.
+    struct cpu *cpu;  // The cpu holding it for writing.
+};
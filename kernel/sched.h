@@ -0,0 +1,12 @@
+// scheduling classes, for setpriority() and getpriority().
+#define SCHED_FAIR 0  // share the CPU in proportion to nice values
+#define SCHED_RT 1    // fixed priority, ahead of every fair process
+
+// nice values of the fair class; lower gets more of the CPU.
+#define NICE_MIN -20
+#define NICE_MAX 19
+
+// priorities of the real-time class; higher runs first.
+// RTPRIO_MAX is NRTPRIO - 1 (param.h).
+#define RTPRIO_MIN 0
+#define RTPRIO_MAX 7
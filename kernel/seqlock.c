@@ -0,0 +1,51 @@
+// Sequence locks.
+//
+// A reader never writes to the lock, so readers on many
+// harts don't fight over its cache line. Instead, a reader
+// notes seq before it reads the data, and reads again if a
+// writer was busy then or has been since:
+//
+//   do {
+//       seq = readseqbegin(&sl);
+//       ... copy the data ...
+//   } while (readseqretry(&sl, seq));
+//
+// Writers bump seq before and after each update, and must
+// exclude each other some other way, usually with a
+// spinlock. A reader may see a half-made update, so it must
+// only copy the data, and use the copy once it is sure of it.
+
+#include "types.h"
+#include "riscv.h"
+#include "seqlock.h"
+#include "defs.h"
+
+void initseqlock(struct seqlock *sl) { sl->seq = 0; }
+
+// Wait until no writer is busy, and return the sequence
+// number to pass to readseqretry().
+uint readseqbegin(struct seqlock *sl) {
+    uint seq;
+
+    while ((seq = __atomic_load_n(&sl->seq, __ATOMIC_ACQUIRE)) & 1)
+        ;
+    return seq;
+}
+
+// Did a writer change the data since readseqbegin()
+// returned seq?
+int readseqretry(struct seqlock *sl, uint seq) {
+    // order the reads of the data before the reread of seq.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->seq, __ATOMIC_RELAXED) != seq;
+}
+
+void writeseqbegin(struct seqlock *sl) {
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELAXED);
+    // order the bump before the writes of the data.
+    __sync_synchronize();
+}
+
+void writeseqend(struct seqlock *sl) {
+    __atomic_store_n(&sl->seq, sl->seq + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,4 @@
+// Sequence lock, for data written rarely and read often.
+struct seqlock {
+    uint seq;  // odd while a writer is in the middle of an update
+};
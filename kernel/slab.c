@@ -0,0 +1,240 @@
+// Slab allocator for small kernel objects.
+//
+// A cache hands out fixed-size objects carved from
+// single-page slabs obtained from kalloc(). Objects are
+// constructed once, when their slab is created, and keep
+// that state across kmem_cache_free()/kmem_cache_alloc().
+// Each CPU holds a small magazine of free objects per
+// cache, so most allocations and frees take no lock.
+//
+// Interface:
+// * kmem_cache_create(name, size, ctor, dtor) makes a cache.
+// * kmem_cache_alloc(c) returns a constructed object, or 0.
+// * kmem_cache_free(c, obj) gives the object back.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define NCACHE 16   // maximum number of caches
+#define MAGSIZE 16  // objects in a per-CPU magazine
+
+// header at the start of every slab page.
+struct slab {
+    struct slab *next;
+    struct slab *prev;
+    struct kmem_cache *cache;
+    int nfree;       // number of entries on free[]
+    ushort free[];  // indices of the free objects
+};
+
+struct kmem_cache {
+    struct spinlock lock;
+    char *name;
+    uint size;     // object size, rounded up to 8 bytes
+    int nobj;      // objects per slab
+    uint objoff;   // offset of the first object in a slab
+    void (*ctor)(void *);
+    void (*dtor)(void *);
+
+    // lock must be held when using these:
+    struct slab *partial;  // slabs with free objects
+    struct slab *full;     // slabs without free objects
+    int nslabs;            // slab pages owned by the cache
+    int nempty;            // slabs whose objects are all free
+
+    // per-CPU magazines, used with interrupts off.
+    struct {
+        int n;
+        void *obj[MAGSIZE];
+        uint64 nalloc;
+        uint64 nfree;
+    } mag[NCPU];
+};
+
+static struct {
+    struct spinlock lock;
+    struct kmem_cache cache[NCACHE];
+    int n;
+} slabs;
+
+void slabinit(void) { initlock(&slabs.lock, "slabs"); }
+
+// Create a cache of objects of the given size. ctor, if
+// non-zero, is called on every object when its slab is
+// created; dtor, if non-zero, when the slab is destroyed.
+struct kmem_cache *kmem_cache_create(char *name, uint size,
+                                     void (*ctor)(void *),
+                                     void (*dtor)(void *)) {
+    struct kmem_cache *c;
+
+    acquire(&slabs.lock);
+    if (slabs.n >= NCACHE) panic("kmem_cache_create: too many");
+    c = &slabs.cache[slabs.n++];
+    release(&slabs.lock);
+
+    memset(c, 0, sizeof(*c));
+    initlock(&c->lock, name);
+    c->name = name;
+    c->size = (size + 7) & ~7;
+    c->ctor = ctor;
+    c->dtor = dtor;
+
+    c->nobj = (PGSIZE - sizeof(struct slab)) / (c->size + sizeof(ushort));
+    for (;;) {
+        c->objoff = (sizeof(struct slab) + c->nobj * sizeof(ushort) + 7) & ~7;
+        if (c->objoff + c->nobj * c->size <= PGSIZE) break;
+        c->nobj--;
+    }
+    if (c->nobj <= 0) panic("kmem_cache_create: size");
+    return c;
+}
+
+static void slab_insert(struct slab **head, struct slab *s) {
+    s->prev = 0;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void slab_remove(struct slab **head, struct slab *s) {
+    if (s->prev)
+        s->prev->next = s->next;
+    else
+        *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+}
+
+static void *slab_obj(struct kmem_cache *c, struct slab *s, int i) {
+    return (char *)s + c->objoff + i * c->size;
+}
+
+// Add a slab to the cache. Caller must hold c->lock.
+static int slab_grow(struct kmem_cache *c) {
+    struct slab *s;
+
+    if ((s = (struct slab *)kalloc()) == 0) return -1;
+    s->cache = c;
+    s->nfree = c->nobj;
+    for (int i = 0; i < c->nobj; i++) {
+        s->free[i] = c->nobj - 1 - i;
+        if (c->ctor) c->ctor(slab_obj(c, s, i));
+    }
+    slab_insert(&c->partial, s);
+    c->nslabs++;
+    c->nempty++;
+    return 0;
+}
+
+// Give an empty slab back to kalloc(). Caller must hold c->lock.
+static void slab_destroy(struct kmem_cache *c, struct slab *s) {
+    slab_remove(&c->partial, s);
+    if (c->dtor)
+        for (int i = 0; i < c->nobj; i++) c->dtor(slab_obj(c, s, i));
+    c->nslabs--;
+    c->nempty--;
+    kfree((void *)s);
+}
+
+// Take a free object from the slabs. Caller must hold c->lock.
+static void *slab_get(struct kmem_cache *c) {
+    struct slab *s;
+
+    if (c->partial == 0 && slab_grow(c) < 0) return 0;
+    s = c->partial;
+    if (s->nfree == c->nobj) c->nempty--;
+    void *obj = slab_obj(c, s, s->free[--s->nfree]);
+    if (s->nfree == 0) {
+        slab_remove(&c->partial, s);
+        slab_insert(&c->full, s);
+    }
+    return obj;
+}
+
+// Return an object to its slab. At most one empty slab
+// is kept; further ones are destroyed.
+// Caller must hold c->lock.
+static void slab_put(struct kmem_cache *c, void *obj) {
+    struct slab *s = (struct slab *)PGROUNDDOWN((uint64)obj);
+
+    if (s->cache != c) panic("kmem_cache_free: wrong cache");
+    if (s->nfree == 0) {
+        slab_remove(&c->full, s);
+        slab_insert(&c->partial, s);
+    }
+    s->free[s->nfree++] = ((char *)obj - (char *)slab_obj(c, s, 0)) / c->size;
+    if (s->nfree == c->nobj) {
+        c->nempty++;
+        if (c->nempty > 1) slab_destroy(c, s);
+    }
+}
+
+// Allocate a constructed object from cache c.
+// Returns 0 if memory is exhausted.
+void *kmem_cache_alloc(struct kmem_cache *c) {
+    void *obj = 0;
+
+    push_off();
+    int cpu = cpuid();
+    if (c->mag[cpu].n == 0) {
+        // refill half the magazine under the cache lock.
+        acquire(&c->lock);
+        while (c->mag[cpu].n < MAGSIZE / 2) {
+            if ((obj = slab_get(c)) == 0) break;
+            c->mag[cpu].obj[c->mag[cpu].n++] = obj;
+        }
+        release(&c->lock);
+    }
+    if (c->mag[cpu].n > 0) {
+        obj = c->mag[cpu].obj[--c->mag[cpu].n];
+        c->mag[cpu].nalloc++;
+    }
+    pop_off();
+    return obj;
+}
+
+// Free an object allocated from cache c. The object must
+// be back in its constructed state.
+void kmem_cache_free(struct kmem_cache *c, void *obj) {
+    push_off();
+    int cpu = cpuid();
+    if (c->mag[cpu].n == MAGSIZE) {
+        // flush half the magazine back to the slabs.
+        acquire(&c->lock);
+        while (c->mag[cpu].n > MAGSIZE / 2)
+            slab_put(c, c->mag[cpu].obj[--c->mag[cpu].n]);
+        release(&c->lock);
+    }
+    c->mag[cpu].obj[c->mag[cpu].n++] = obj;
+    c->mag[cpu].nfree++;
+    pop_off();
+}
+
+// Report every cache for the stats device.
+int statsslab(char *buf, int sz) {
+    int n;
+
+    n = snprintf(buf, sz, "--- slab caches\n");
+    acquire(&slabs.lock);
+    for (int i = 0; i < slabs.n; i++) {
+        struct kmem_cache *c = &slabs.cache[i];
+        uint64 nalloc = 0, nfree = 0;
+
+        for (int cpu = 0; cpu < NCPU; cpu++) {
+            nalloc += c->mag[cpu].nalloc;
+            nfree += c->mag[cpu].nfree;
+        }
+        acquire(&c->lock);
+        n += snprintf(buf + n, sz - n,
+                      "%s: size %d, %d per slab, slabs %d, inuse %d, "
+                      "allocs %d, frees %d\n",
+                      c->name, c->size, c->nobj, c->nslabs,
+                      (int)(nalloc - nfree), (int)nalloc, (int)nfree);
+        release(&c->lock);
+    }
+    release(&slabs.lock);
+    return n;
+}
@@ -1,4 +1,11 @@
 // Sleeping locks
+//
+// A process that finds a sleep lock held spins for a while
+// if the holder is running on another hart, since it will
+// likely let go sooner than two context switches would
+// take; it sleeps if the holder isn't running, or is taking
+// too long. A holder that has gone to sleep, say to wait
+// for the disk, isn't worth spinning for.
 
 #include "types.h"
 #include "riscv.h"
@@ -9,28 +16,73 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+#define SPINMAX 2000  // polls of the lock before sleeping
+
+// per-CPU statistics, so that lockers don't share a line.
+static struct {
+    int nfree;   // acquisitions that found the lock free
+    int nspin;   // acquisitions that spun, but didn't sleep
+    int nsleep;  // acquisitions that slept
+} __attribute__((aligned(64))) sstats[NCPU];
+
 void initsleeplock(struct sleeplock *lk, char *name) {
     initlock(&lk->lk, "sleep lock");
     lk->name = name;
     lk->locked = 0;
-    lk->pid = 0;
+    lk->nwaiting = 0;
+    lk->owner = 0;
+}
+
+// Wait, without lk->lk, while lk is held by owner and owner
+// is running on another hart. Returns the polls left.
+static int spinwait(struct sleeplock *lk, struct proc *owner, int spins) {
+    while (spins > 0 && __atomic_load_n(&lk->locked, __ATOMIC_RELAXED) &&
+           __atomic_load_n(&lk->owner, __ATOMIC_RELAXED) == owner &&
+           __atomic_load_n(&owner->state, __ATOMIC_RELAXED) == RUNNING)
+        spins--;
+    return spins;
 }
 
 void acquiresleep(struct sleeplock *lk) {
+    struct proc *p = myproc(), *owner;
+    int spins = SPINMAX, slept = 0;
+
     acquire(&lk->lk);
     while (lk->locked) {
+        // procs are never freed, so owner is safe to look at
+        // once lk->lk is released.
+        owner = lk->owner;
+        if (spins > 0 && owner != p && owner->state == RUNNING) {
+            release(&lk->lk);
+            spins = spinwait(lk, owner, spins);
+            acquire(&lk->lk);
+            continue;
+        }
+        slept = 1;
+        lk->nwaiting++;
         sleep(lk, &lk->lk);
+        lk->nwaiting--;
     }
     lk->locked = 1;
-    lk->pid = myproc()->pid;
+    lk->owner = p;
     release(&lk->lk);
+
+    push_off();
+    int id = cpuid();
+    if (slept)
+        sstats[id].nsleep++;
+    else if (spins < SPINMAX)
+        sstats[id].nspin++;
+    else
+        sstats[id].nfree++;
+    pop_off();
 }
 
 void releasesleep(struct sleeplock *lk) {
     acquire(&lk->lk);
     lk->locked = 0;
-    lk->pid = 0;
-    wakeup(lk);
+    lk->owner = 0;
+    if (lk->nwaiting > 0) wakeup(lk);
     release(&lk->lk);
 }
 
@@ -38,7 +90,23 @@ int holdingsleep(struct sleeplock *lk) {
     int r;
 
     acquire(&lk->lk);
-    r = lk->locked && (lk->pid == myproc()->pid);
+    r = lk->locked && (lk->owner == myproc());
     release(&lk->lk);
     return r;
 }
+
+// Report how sleep locks were acquired, for the stats
+// device.
+int statssleeplock(char *buf, int sz) {
+    int nfree = 0, nspin = 0, nsleep = 0;
+
+    for (int i = 0; i < NCPU; i++) {
+        nfree += sstats[i].nfree;
+        nspin += sstats[i].nspin;
+        nsleep += sstats[i].nsleep;
+    }
+    return snprintf(buf, sz,
+                    "--- sleeplock\nacquired free %d, after spinning %d, "
+                    "after sleeping %d\n",
+                    nfree, nspin, nsleep);
+}
@@ -2,8 +2,9 @@
 struct sleeplock {
     uint locked;         // Is the lock held?
     struct spinlock lk;  // spinlock protecting this sleep lock
+    int nwaiting;        // Processes asleep waiting for it
 
     // For debugging:
-    char *name;  // Name of lock.
-    int pid;     // Process holding lock
+    char *name;          // Name of lock.
+    struct proc *owner;  // Process holding lock
 };
@@ -1,4 +1,17 @@
 // Mutual exclusion spin locks.
+//
+// A spinlock is a ticket lock: acquire() takes the next
+// ticket and waits until owner reaches it, so harts get the
+// lock in the order they asked for it, and while they wait
+// they only read owner. A waiter backs off in proportion to
+// how many tickets are ahead of it, so that the line holding
+// owner isn't read by every waiter each time it changes.
+//
+// Every lock counts its acquisitions and waits, and the
+// longest it was held and waited for. initlock() enters the
+// lock in locks[], for the "lock" report of the stats device;
+// a lock in memory that is freed must be taken out again with
+// freelock(). Locks beyond NLOCK work, but aren't reported.
 
 #include "types.h"
 #include "param.h"
@@ -8,8 +21,8 @@
 #include "proc.h"
 #include "defs.h"
 
-#ifdef LAB_LOCK
 #define NLOCK 500
+#define BACKOFF 50  // polls of owner are this many loops apart per waiter ahead
 
 static struct spinlock *locks[NLOCK];
 struct spinlock lock_locks;
@@ -32,45 +45,44 @@ static void findslot(struct spinlock *lk) {
     for (i = 0; i < NLOCK; i++) {
         if (locks[i] == 0) {
             locks[i] = lk;
-            release(&lock_locks);
-            return;
+            break;
         }
     }
-    panic("findslot");
+    release(&lock_locks);
 }
-#endif
 
 void initlock(struct spinlock *lk, char *name) {
     lk->name = name;
-    lk->locked = 0;
+    lk->next = 0;
+    lk->owner = 0;
     lk->cpu = 0;
-#ifdef LAB_LOCK
-    lk->nts = 0;
     lk->n = 0;
+    lk->ncontend = 0;
+    lk->nspin = 0;
+    lk->maxhold = 0;
+    lk->maxwait = 0;
     findslot(lk);
-#endif
 }
 
 // Acquire the lock.
 // Loops (spins) until the lock is acquired.
 void acquire(struct spinlock *lk) {
+    uint ticket, owner, t0 = 0;
+    int nspin = 0;
+
     push_off();  // disable interrupts to avoid deadlock.
     if (holding(lk)) panic("acquire");
 
-#ifdef LAB_LOCK
-    __sync_fetch_and_add(&(lk->n), 1);
-#endif
-
-    // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
-    //   a5 = 1
-    //   s1 = &lk->locked
-    //   amoswap.w.aq a5, a5, (s1)
-    while (__sync_lock_test_and_set(&lk->locked, 1) != 0) {
-#ifdef LAB_LOCK
-        __sync_fetch_and_add(&(lk->nts), 1);
-#else
-        ;
-#endif
+    // On RISC-V, this is an amoadd.w.
+    ticket = __atomic_fetch_add(&lk->next, 1, __ATOMIC_RELAXED);
+    while ((owner = __atomic_load_n(&lk->owner, __ATOMIC_RELAXED)) != ticket) {
+        if (nspin == 0) t0 = r_time();
+        nspin++;
+        // the holder may be waiting in tlbshootdown() for
+        // this hart, which can't take the interrupt.
+        tlbcheck();
+        for (int i = (ticket - owner) * BACKOFF; i > 0; i--)
+            asm volatile("nop");
     }
 
     // Tell the C compiler and the processor to not move loads or stores
@@ -81,12 +93,21 @@ void acquire(struct spinlock *lk) {
 
     // Record info about lock acquisition for holding() and debugging.
     lk->cpu = mycpu();
+    lk->start = r_time();
+    lk->n++;
+    if (nspin > 0) {
+        lk->ncontend++;
+        lk->nspin += nspin;
+        if (lk->start - t0 > lk->maxwait) lk->maxwait = lk->start - t0;
+    }
 }
 
 // Release the lock.
 void release(struct spinlock *lk) {
     if (!holding(lk)) panic("release");
 
+    uint hold = r_time() - lk->start;
+    if (hold > lk->maxhold) lk->maxhold = hold;
     lk->cpu = 0;
 
     // Tell the C compiler and the CPU to not move loads or stores
@@ -97,14 +118,9 @@ void release(struct spinlock *lk) {
     // On RISC-V, this emits a fence instruction.
     __sync_synchronize();
 
-    // Release the lock, equivalent to lk->locked = 0.
-    // This code doesn't use a C assignment, since the C standard
-    // implies that an assignment might be implemented with
-    // multiple store instructions.
-    // On RISC-V, sync_lock_release turns into an atomic swap:
-    //   s1 = &lk->locked
-    //   amoswap.w zero, zero, (s1)
-    __sync_lock_release(&lk->locked);
+    // Serve the next ticket. Only the holder writes owner,
+    // but the store must be a single one.
+    __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELAXED);
 
     pop_off();
 }
@@ -113,7 +129,9 @@ void release(struct spinlock *lk) {
 // Interrupts must be off.
 int holding(struct spinlock *lk) {
     int r;
-    r = (lk->locked && lk->cpu == mycpu());
+    r = (__atomic_load_n(&lk->owner, __ATOMIC_RELAXED) !=
+             __atomic_load_n(&lk->next, __ATOMIC_RELAXED) &&
+         lk->cpu == mycpu());
     return r;
 }
 
@@ -144,47 +162,58 @@ int atomic_read4(int *addr) {
     return val;
 }
 
-#ifdef LAB_LOCK
-int snprint_lock(char *buf, int sz, struct spinlock *lk) {
+static int snprint_lock(char *buf, int sz, struct spinlock *lk) {
     int n = 0;
     if (lk->n > 0) {
-        n = snprintf(buf, sz, "lock: %s: #test-and-set %d #acquire() %d\n",
-                     lk->name, lk->nts, lk->n);
+        n = snprintf(buf, sz,
+                     "lock: %s: #acquire() %d #contended %d #spin %d "
+                     "max hold %d max wait %d\n",
+                     lk->name, lk->n, lk->ncontend, lk->nspin, (int)lk->maxhold,
+                     (int)lk->maxwait);
     }
     return n;
 }
 
+// Report the kmem and bcache locks, the five most contended
+// locks, and totals for the kmem and bcache locks, for the
+// stats device. Times are in time CSR ticks, 100ns on qemu.
+// tot= counts the acquisitions that found the lock held,
+// as the test-and-set lock's failed swaps did: it is 0 just
+// when that count was, which is what kalloctest and
+// bcachetest look for. Polls of owner, which backoff makes
+// fewer than the swaps were, go in spins=.
 int statslock(char *buf, int sz) {
+    struct spinlock *top[5];
     int n;
-    int tot = 0;
+    int tot = 0, spins = 0;
 
     acquire(&lock_locks);
     n = snprintf(buf, sz, "--- lock kmem/bcache stats\n");
     for (int i = 0; i < NLOCK; i++) {
-        if (locks[i] == 0) break;
+        if (locks[i] == 0) continue;
         if (strncmp(locks[i]->name, "bcache", strlen("bcache")) == 0 ||
             strncmp(locks[i]->name, "kmem", strlen("kmem")) == 0) {
-            tot += locks[i]->nts;
+            tot += locks[i]->ncontend;
+            spins += locks[i]->nspin;
             n += snprint_lock(buf + n, sz - n, locks[i]);
         }
     }
 
     n += snprintf(buf + n, sz - n, "--- top 5 contended locks:\n");
-    int last = 100000000;
-    // stupid way to compute top 5 contended locks
-    for (int t = 0; t < 5; t++) {
-        int top = 0;
+    for (int t = 0; t < NELEM(top); t++) {
+        top[t] = 0;
         for (int i = 0; i < NLOCK; i++) {
-            if (locks[i] == 0) break;
-            if (locks[i]->nts > locks[top]->nts && locks[i]->nts < last) {
-                top = i;
-            }
+            struct spinlock *lk = locks[i];
+            int seen = 0;
+            if (lk == 0 || lk->ncontend == 0) continue;
+            for (int j = 0; j < t; j++) seen |= top[j] == lk;
+            if (!seen && (top[t] == 0 || lk->nspin > top[t]->nspin)) top[t] = lk;
         }
-        n += snprint_lock(buf + n, sz - n, locks[top]);
-        last = locks[top]->nts;
+        if (top[t] == 0) break;
+        n += snprint_lock(buf + n, sz - n, top[t]);
     }
     n += snprintf(buf + n, sz - n, "tot= %d\n", tot);
+    n += snprintf(buf + n, sz - n, "spins= %d\n", spins);
     release(&lock_locks);
     return n;
 }
-#endif
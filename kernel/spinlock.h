@@ -1,12 +1,17 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock: a ticket lock.
 struct spinlock {
-    uint locked;  // Is the lock held?
+    uint next;   // ticket the next acquire() takes
+    uint owner;  // ticket being served; held while != next
 
     // For debugging:
     char *name;       // Name of lock.
     struct cpu *cpu;  // The cpu holding the lock.
-#ifdef LAB_LOCK
-    int nts;          // the number of times the loop
-    int n;            // the count of calls 
-#endif
+
+    // statistics, written only by the holder.
+    uint start;    // time it was acquired, from the time CSR
+    int n;         // acquisitions
+    int ncontend;  // acquisitions that had to wait
+    int nspin;     // times a waiter polled owner
+    uint maxhold;  // longest hold, in time CSR ticks
+    uint maxwait;  // longest wait, in time CSR ticks
 };
@@ -41,6 +41,9 @@ void start() {
     w_mcounteren(r_mcounteren() | 0x3);
 #endif
 
+    // allow supervisor and user mode to read the time.
+    w_mcounteren(r_mcounteren() | COUNTEREN_TM);
+
     // configure Physical Memory Protection to give supervisor mode
     // access to all of physical memory.
     w_pmpaddr0(0x3fffffffffffffull);
@@ -57,7 +60,7 @@ void start() {
     asm volatile("mret");
 }
 
-// arrange to receive timer interrupts.
+// arrange to receive timer and inter-processor interrupts.
 // they will arrive in machine mode at
 // at timervec in kernelvec.S,
 // which turns them into software interrupts for
@@ -66,17 +69,17 @@ void timerinit() {
     // each CPU has a separate source of timer interrupts.
     int id = r_mhartid();
 
-    // ask the CLINT for a timer interrupt.
-    int interval = 1000000;  // cycles; about 1/10th second in qemu.
-    *(uint64 *)CLINT_MTIMECMP(id) = *(uint64 *)CLINT_MTIME + interval;
+    // no timer interrupt until the kernel asks for one;
+    // see clockarm() in trap.c.
+    *(uint64 *)CLINT_MTIMECMP(id) = -1;
 
     // prepare information in scratch[] for timervec.
     // scratch[0..2] : space for timervec to save registers.
     // scratch[3] : address of CLINT MTIMECMP register.
-    // scratch[4] : desired interval (in cycles) between timer interrupts.
+    // scratch[4] : address of CLINT MSIP register.
     uint64 *scratch = &timer_scratch[id][0];
     scratch[3] = CLINT_MTIMECMP(id);
-    scratch[4] = interval;
+    scratch[4] = CLINT_MSIP(id);
     w_mscratch((uint64)scratch);
 
     // set the machine-mode trap handler.
@@ -85,6 +88,6 @@ void timerinit() {
     // enable machine-mode interrupts.
     w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-    // enable machine-mode timer interrupts.
-    w_mie(r_mie() | MIE_MTIE);
+    // enable machine-mode timer and software interrupts.
+    w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
 }
@@ -10,30 +10,71 @@
 #include "defs.h"
 
 #define BUFSZ 4096
+// lock is a sleeplock, since statsread() copies out while
+// holding it and copyout() may fault a page in.
 static struct {
-    struct spinlock lock;
+    struct sleeplock lock;
     char buf[BUFSZ];
     int sz;
     int off;
+    int cur;  // index into reports[] of the report being read
 } stats;
 
 int statscopyin(char*, int);
-int statslock(char*, int);
 
-int statswrite(int user_src, uint64 src, int n) { return -1; }
+// Reports the stats device can produce. The first one is
+// the default; writing a report's name to the device selects
+// it for the next read, after which the default is restored.
+static struct {
+    char *name;
+    int (*fn)(char *, int);
+} reports[] = {
+#ifdef LAB_PGTBL
+    {"copyin", statscopyin},
+#endif
+    {"lock", statslock},
+    {"kalloc", statskalloc},
+    {"slab", statsslab},
+    {"pcache", statspcache},
+    {"asid", statsasid},
+    {"sched", statssched},
+    {"wait", statswait},
+    {"futex", statsfutex},
+    {"timer", statstimer},
+    {"rcu", statsrcu},
+    {"dcache", statsdcache},
+    {"sleeplock", statssleeplock},
+    {"bcache", statsbcache},
+};
+
+int statswrite(int user_src, uint64 src, int n) {
+    char name[16];
+
+    if (n <= 0 || n >= sizeof(name)) return -1;
+    if (either_copyin(name, user_src, src, n) == -1) return -1;
+    name[n] = 0;
+    if (name[n - 1] == '\n') name[n - 1] = 0;
+
+    for (int i = 0; i < NELEM(reports); i++) {
+        if (strncmp(name, reports[i].name, sizeof(name)) == 0) {
+            acquiresleep(&stats.lock);
+            stats.cur = i;
+            stats.sz = 0;
+            stats.off = 0;
+            releasesleep(&stats.lock);
+            return n;
+        }
+    }
+    return -1;
+}
 
 int statsread(int user_dst, uint64 dst, int n) {
     int m;
 
-    acquire(&stats.lock);
+    acquiresleep(&stats.lock);
 
     if (stats.sz == 0) {
-#ifdef LAB_PGTBL
-        stats.sz = statscopyin(stats.buf, BUFSZ);
-#endif
-#ifdef LAB_LOCK
-        stats.sz = statslock(stats.buf, BUFSZ);
-#endif
+        stats.sz = reports[stats.cur].fn(stats.buf, BUFSZ);
     }
     m = stats.sz - stats.off;
 
@@ -46,13 +87,14 @@ int statsread(int user_dst, uint64 dst, int n) {
         m = -1;
         stats.sz = 0;
         stats.off = 0;
+        stats.cur = 0;
     }
-    release(&stats.lock);
+    releasesleep(&stats.lock);
     return m;
 }
 
 void statsinit(void) {
-    initlock(&stats.lock, "stats");
+    initsleeplock(&stats.lock, "stats");
 
     devsw[STATS].read = statsread;
     devsw[STATS].write = statswrite;
@@ -4,14 +4,16 @@
 #include "riscv.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
 #include "syscall.h"
 #include "defs.h"
 
 // Fetch the uint64 at addr from the current process.
 int fetchaddr(uint64 addr, uint64 *ip) {
     struct proc *p = myproc();
-    if (addr >= p->sz || addr + sizeof(uint64) >
-                             p->sz)  // both tests needed, in case of overflow
+    if (addr >= p->mm->sz || addr + sizeof(uint64) >
+                                 p->mm->sz)  // both tests needed, in case of overflow
         return -1;
     if (copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0) return -1;
     return 0;
@@ -86,6 +88,18 @@ extern uint64 sys_mkdir(void);
 extern uint64 sys_close(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpriority(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_sigalarm(void);
+extern uint64 sys_sigreturn(void);
+extern uint64 sys_exitthread(void);
 
 // An array mapping syscall numbers from syscall.h
 // to the function that handles the system call.
@@ -97,7 +111,13 @@ static uint64 (*syscalls[])(void) = {
     [SYS_sleep] sys_sleep, [SYS_uptime] sys_uptime,   [SYS_open] sys_open,
     [SYS_write] sys_write, [SYS_mknod] sys_mknod,     [SYS_unlink] sys_unlink,
     [SYS_link] sys_link,   [SYS_mkdir] sys_mkdir,     [SYS_close] sys_close,
-    [SYS_trace] sys_trace, [SYS_sysinfo] sys_sysinfo,
+    [SYS_trace] sys_trace, [SYS_sysinfo] sys_sysinfo, [SYS_mmap] sys_mmap,
+    [SYS_munmap] sys_munmap, [SYS_setpriority] sys_setpriority,
+    [SYS_getpriority] sys_getpriority, [SYS_clone] sys_clone,
+    [SYS_join] sys_join, [SYS_futex_wait] sys_futex_wait,
+    [SYS_futex_wake] sys_futex_wake, [SYS_setaffinity] sys_setaffinity,
+    [SYS_sigalarm] sys_sigalarm, [SYS_sigreturn] sys_sigreturn,
+    [SYS_exitthread] sys_exitthread,
 };
 const char *syscall_names[] = {
     [SYS_fork] "fork",   [SYS_exit] "exit",       [SYS_wait] "wait",
@@ -107,7 +127,13 @@ const char *syscall_names[] = {
     [SYS_sleep] "sleep", [SYS_uptime] "uptime",   [SYS_open] "open",
     [SYS_write] "write", [SYS_mknod] "mknod",     [SYS_unlink] "unlink",
     [SYS_link] "link",   [SYS_mkdir] "mkdir",     [SYS_close] "close",
-    [SYS_trace] "trace", [SYS_sysinfo] "sysinfo",
+    [SYS_trace] "trace", [SYS_sysinfo] "sysinfo", [SYS_mmap] "mmap",
+    [SYS_munmap] "munmap", [SYS_setpriority] "setpriority",
+    [SYS_getpriority] "getpriority", [SYS_clone] "clone",
+    [SYS_join] "join", [SYS_futex_wait] "futex_wait",
+    [SYS_futex_wake] "futex_wake", [SYS_setaffinity] "setaffinity",
+    [SYS_sigalarm] "sigalarm", [SYS_sigreturn] "sigreturn",
+    [SYS_exitthread] "exitthread",
 };
 
 void syscall(void) {
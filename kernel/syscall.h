@@ -22,3 +22,15 @@
 #define SYS_close 21
 #define SYS_trace 22
 #define SYS_sysinfo 23
+#define SYS_mmap 24
+#define SYS_munmap 25
+#define SYS_setpriority 26
+#define SYS_getpriority 27
+#define SYS_clone 28
+#define SYS_join 29
+#define SYS_futex_wait 30
+#define SYS_futex_wake 31
+#define SYS_setaffinity 32
+#define SYS_sigalarm 33
+#define SYS_sigreturn 34
+#define SYS_exitthread 35
@@ -18,14 +18,25 @@
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
+// The caller gets its own reference to the file, so that another
+// thread closing the descriptor can't free it, and must
+// fileclose() it when done.
 static int argfd(int n, int *pfd, struct file **pf) {
     int fd;
     struct file *f;
+    struct files *fs = myproc()->files;
 
     argint(n, &fd);
-    if (fd < 0 || fd >= NOFILE || (f = myproc()->ofile[fd]) == 0) return -1;
+    if (fd < 0 || fd >= NOFILE) return -1;
+    acquire(&fs->lock);
+    if ((f = fs->ofile[fd]) == 0) {
+        release(&fs->lock);
+        return -1;
+    }
+    filedup(f);
+    release(&fs->lock);
     if (pfd) *pfd = fd;
-    if (pf) *pf = f;
+    *pf = f;
     return 0;
 }
 
@@ -33,24 +44,42 @@ static int argfd(int n, int *pfd, struct file **pf) {
 // Takes over file reference from caller on success.
 static int fdalloc(struct file *f) {
     int fd;
-    struct proc *p = myproc();
+    struct files *fs = myproc()->files;
 
+    acquire(&fs->lock);
     for (fd = 0; fd < NOFILE; fd++) {
-        if (p->ofile[fd] == 0) {
-            p->ofile[fd] = f;
+        if (fs->ofile[fd] == 0) {
+            fs->ofile[fd] = f;
+            release(&fs->lock);
             return fd;
         }
     }
+    release(&fs->lock);
     return -1;
 }
 
+// Free descriptor fd and return its file, or 0 if it
+// was not open.
+static struct file *fdfree(int fd) {
+    struct files *fs = myproc()->files;
+    struct file *f;
+
+    acquire(&fs->lock);
+    f = fs->ofile[fd];
+    fs->ofile[fd] = 0;
+    release(&fs->lock);
+    return f;
+}
+
 uint64 sys_dup(void) {
     struct file *f;
     int fd;
 
     if (argfd(0, 0, &f) < 0) return -1;
-    if ((fd = fdalloc(f)) < 0) return -1;
-    filedup(f);
+    if ((fd = fdalloc(f)) < 0) {
+        fileclose(f);
+        return -1;
+    }
     return fd;
 }
 
@@ -62,7 +91,9 @@ uint64 sys_read(void) {
     argaddr(1, &p);
     argint(2, &n);
     if (argfd(0, 0, &f) < 0) return -1;
-    return fileread(f, p, n);
+    n = fileread(f, p, n);
+    fileclose(f);
+    return n;
 }
 
 uint64 sys_write(void) {
@@ -73,16 +104,17 @@ uint64 sys_write(void) {
     argaddr(1, &p);
     argint(2, &n);
     if (argfd(0, 0, &f) < 0) return -1;
-
-    return filewrite(f, p, n);
+    n = filewrite(f, p, n);
+    fileclose(f);
+    return n;
 }
 
 uint64 sys_close(void) {
     int fd;
     struct file *f;
 
-    if (argfd(0, &fd, &f) < 0) return -1;
-    myproc()->ofile[fd] = 0;
+    argint(0, &fd);
+    if (fd < 0 || fd >= NOFILE || (f = fdfree(fd)) == 0) return -1;
     fileclose(f);
     return 0;
 }
@@ -91,9 +123,13 @@ uint64 sys_fstat(void) {
     struct file *f;
     uint64 st;  // user pointer to struct stat
 
+    int r;
+
     argaddr(1, &st);
     if (argfd(0, 0, &f) < 0) return -1;
-    return filestat(f, st);
+    r = filestat(f, st);
+    fileclose(f);
+    return r;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -186,6 +222,7 @@ uint64 sys_unlink(void) {
     memset(&de, 0, sizeof(de));
     if (writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
         panic("unlink: writei");
+    dcacheremove(dp->dev, dp->inum, name);
     if (ip->type == T_DIR) {
         dp->nlink--;
         iupdate(dp);
@@ -223,6 +260,8 @@ static struct inode *create(char *path, short type, short major, short minor) {
         return 0;
     }
 
+    // dirlookup() also fails if out of memory; dirlink()
+    // below then refuses the name that is there.
     if ((ip = ialloc(dp->dev, type)) == 0) {
         iunlockput(dp);
         return 0;
@@ -265,7 +304,7 @@ uint64 sys_open(void) {
     char path[MAXPATH];
     int fd, omode;
     struct file *f;
-    struct inode *ip;
+    struct inode *ip, *mapped = 0;
     int n;
 
     argint(1, &omode);
@@ -298,8 +337,17 @@ uint64 sys_open(void) {
         return -1;
     }
 
+    // a running program can't be written or truncated.
+    int writer = ip->type == T_FILE && (omode & (O_WRONLY | O_RDWR | O_TRUNC));
+    if (writer && iwrite(ip, 1) < 0) {
+        iunlockput(ip);
+        end_op();
+        return -1;
+    }
+
     if ((f = filealloc()) == 0 || (fd = fdalloc(f)) < 0) {
         if (f) fileclose(f);
+        if (writer) iwrite(ip, -1);
         iunlockput(ip);
         end_op();
         return -1;
@@ -317,12 +365,23 @@ uint64 sys_open(void) {
     f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
 
     if ((omode & O_TRUNC) && ip->type == T_FILE) {
-        itrunc(ip);
+        if (itrunc(ip)) mapped = idup(ip);
     }
+    // fileclose() drops writers' counts.
+    if (writer && !f->writable) iwrite(ip, -1);
 
     iunlock(ip);
     end_op();
 
+    // processes may map the old pages; vmatruncate() can't
+    // run with ip locked.
+    if (mapped) {
+        vmatruncate(mapped);
+        begin_op();
+        iput(mapped);
+        end_op();
+    }
+
     return fd;
 }
 
@@ -375,9 +434,12 @@ uint64 sys_chdir(void) {
         return -1;
     }
     iunlock(ip);
-    iput(p->cwd);
+    acquire(&p->files->lock);
+    struct inode *old = p->files->cwd;
+    p->files->cwd = ip;
+    release(&p->files->lock);
+    iput(old);
     end_op();
-    p->cwd = ip;
     return 0;
 }
 
@@ -428,7 +490,7 @@ uint64 sys_pipe(void) {
     if (pipealloc(&rf, &wf) < 0) return -1;
     fd0 = -1;
     if ((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0) {
-        if (fd0 >= 0) p->ofile[fd0] = 0;
+        if (fd0 >= 0) fdfree(fd0);
         fileclose(rf);
         fileclose(wf);
         return -1;
@@ -436,11 +498,36 @@ uint64 sys_pipe(void) {
     if (copyout(p->pagetable, fdarray, (char *)&fd0, sizeof(fd0)) < 0 ||
         copyout(p->pagetable, fdarray + sizeof(fd0), (char *)&fd1,
                 sizeof(fd1)) < 0) {
-        p->ofile[fd0] = 0;
-        p->ofile[fd1] = 0;
+        fdfree(fd0);
+        fdfree(fd1);
         fileclose(rf);
         fileclose(wf);
         return -1;
     }
     return 0;
 }
+
+uint64 sys_mmap(void) {
+    uint64 addr, len;
+    int prot, flags, off;
+    struct file *f = 0;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    argint(2, &prot);
+    argint(3, &flags);
+    argint(5, &off);
+    if (off < 0) return -1;
+    if ((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0) return -1;
+    addr = vmammap(addr, len, prot, flags, f, off);
+    if (f) fileclose(f);
+    return addr;
+}
+
+uint64 sys_munmap(void) {
+    uint64 addr, len;
+
+    argaddr(0, &addr);
+    argaddr(1, &len);
+    return vmamunmap(addr, len);
+}
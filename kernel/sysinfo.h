@@ -1,4 +1,5 @@
 struct sysinfo {
     uint64 freemem;  // amount of free memory (bytes)
     uint64 nproc;    // number of process
+    uint64 nfault;   // lazy page faults taken by the calling process
 };
@@ -5,6 +5,8 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
 #include "sysinfo.h"
 
 uint64 sys_exit(void) {
@@ -25,13 +27,10 @@ uint64 sys_wait(void) {
 }
 
 uint64 sys_sbrk(void) {
-    uint64 addr;
     int n;
 
     argint(0, &n);
-    addr = myproc()->sz;
-    if (growproc(n) < 0) return -1;
-    return addr;
+    return growproc(n);
 }
 
 uint64 sys_sleep(void) {
@@ -47,7 +46,8 @@ uint64 sys_sleep(void) {
             release(&tickslock);
             return -1;
         }
-        sleep(&ticks, &tickslock);
+        // nothing wakes this channel; only the deadline does.
+        sleepuntil(&ticks0, &tickslock, ticks0 + n);
     }
     release(&tickslock);
     return 0;
@@ -62,14 +62,7 @@ uint64 sys_kill(void) {
 
 // return how many clock tick interrupts have occurred
 // since start.
-uint64 sys_uptime(void) {
-    uint xticks;
-
-    acquire(&tickslock);
-    xticks = ticks;
-    release(&tickslock);
-    return xticks;
-}
+uint64 sys_uptime(void) { return getticks(); }
 
 uint64 sys_trace(void) {
     int mask;
@@ -84,6 +77,117 @@ uint64 sys_trace(void) {
     return 0;
 }
 
+uint64 sys_setpriority(void) {
+    int pid, class, prio;
+
+    argint(0, &pid);
+    argint(1, &class);
+    argint(2, &prio);
+    return setpriority(pid, class, prio);
+}
+
+uint64 sys_getpriority(void) {
+    int pid, class, prio;
+    uint64 uclass, uprio;  // user pointers to int
+    struct proc *p = myproc();
+
+    argint(0, &pid);
+    argaddr(1, &uclass);
+    argaddr(2, &uprio);
+    if (getpriority(pid, &class, &prio) < 0) return -1;
+    if (copyout(p->pagetable, uclass, (char *)&class, sizeof(class)) < 0 ||
+        copyout(p->pagetable, uprio, (char *)&prio, sizeof(prio)) < 0)
+        return -1;
+    return 0;
+}
+
+uint64 sys_setaffinity(void) {
+    int pid, cpu;
+
+    argint(0, &pid);
+    argint(1, &cpu);
+    return setaffinity(pid, cpu);
+}
+
+// Call handler(frame) every n ticks, interrupting the
+// thread wherever it is in user space; n == 0 turns the
+// alarm off. See alarm() in trap.c.
+uint64 sys_sigalarm(void) {
+    struct proc *p = myproc();
+    int n;
+    uint64 handler;
+
+    argint(0, &n);
+    argaddr(1, &handler);
+    if (n < 0) return -1;
+    p->alarmticks = n;
+    p->alarmfn = handler;
+    p->alarmnext = getticks() + n;
+    return 0;
+}
+
+// Return from an alarm handler to the user registers saved
+// in frame.
+uint64 sys_sigreturn(void) {
+    struct proc *p = myproc();
+    struct trapframe *tf = p->trapframe;
+    struct trapframe f;
+    uint64 frame;
+
+    argaddr(0, &frame);
+    if (copyin(p->pagetable, (char *)&f, frame, sizeof(f)) < 0) return -1;
+    f.kernel_satp = tf->kernel_satp;
+    f.kernel_sp = tf->kernel_sp;
+    f.kernel_trap = tf->kernel_trap;
+    f.kernel_hartid = tf->kernel_hartid;
+    *tf = f;
+    return tf->a0;  // syscall() stores this in a0
+}
+
+uint64 sys_clone(void) {
+    uint64 fn, arg, stack;
+
+    argaddr(0, &fn);
+    argaddr(1, &arg);
+    argaddr(2, &stack);
+    return clone(fn, arg, stack);
+}
+
+uint64 sys_exitthread(void) {
+    int n;
+    argint(0, &n);
+    exitthread(n);
+    return 0;  // not reached
+}
+
+uint64 sys_join(void) {
+    int tid;
+    uint64 p;
+
+    argint(0, &tid);
+    argaddr(1, &p);
+    return join(tid, p);
+}
+
+uint64 sys_futex_wait(void) {
+    uint64 addr;
+    int val, timeout;
+
+    argaddr(0, &addr);
+    argint(1, &val);
+    argint(2, &timeout);
+    return futexwait(addr, val, timeout);
+}
+
+uint64 sys_futex_wake(void) {
+    uint64 addr;
+    int n;
+
+    argaddr(0, &addr);
+    argint(1, &n);
+    return futexwake(addr, n);
+}
+
 uint64 sys_sysinfo(void) {
     //   sysinfo needs to copy a struct sysinfo back to user space; see
     //   sys_fstat() (kernel/sysfile.c) and filestat() (kernel/file.c) for
@@ -102,6 +206,7 @@ uint64 sys_sysinfo(void) {
     struct sysinfo p;
     p.freemem = get_free_memory();
     p.nproc = get_unused_process();
+    p.nfault = myproc()->nfault;
     uint64 addr;
     argaddr(0, &addr);
     // argaddr(0,p);
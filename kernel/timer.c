@@ -0,0 +1,172 @@
+// Kernel timers.
+//
+// A timer calls a function once the tick count reaches its
+// expiry time. Pending timers hang off a hashed timing wheel:
+// NTSLOT slots indexed by expiry time, so that each clock
+// tick looks only at the timers in one slot, and adding or
+// removing a timer takes constant time. A slot holds the
+// timers for every tick that maps to it; those for later
+// turns of the wheel stay put until their turn.
+//
+// Interface:
+// * timerset(t, expires, fn, arg) arranges for fn(arg) to be
+//   called at tick expires, or at the next tick if that has
+//   passed.
+// * timerdel(t) cancels t; if fn is running, it first waits
+//   for it to finish, so that t can be freed afterwards.
+// * timertick(ticks) runs the timers due by ticks; the clock
+//   interrupt calls it on whichever hart takes it. One hart
+//   at a time works through the wheel, a slot at a time; a
+//   hart that finds it busy leaves its tick to that hart.
+// * timernext(&t) finds when the first pending timer is due,
+//   for an idle hart to set its clock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "timer.h"
+#include "defs.h"
+
+#define NTSLOT 256
+
+static struct {
+    struct spinlock lock;
+    struct timer *slot[NTSLOT];
+    uint now;               // last tick processed
+    uint due;               // latest tick passed to timertick()
+    int busy;               // a hart is running timers
+    struct timer *running;  // timer whose fn is being called
+
+    // statistics, protected by lock.
+    int nset;
+    int nfired;
+    int ncancel;
+} wheel;
+
+void timerwheelinit(void) { initlock(&wheel.lock, "timer"); }
+
+// Unlink t from its slot. Caller must hold wheel.lock.
+static void unlink(struct timer *t) {
+    *t->prev = t->next;
+    if (t->next) t->next->prev = t->prev;
+    t->next = 0;
+    t->prev = 0;
+}
+
+// Call fn(arg) at tick expires. t must not be pending.
+void timerset(struct timer *t, uint expires, void (*fn)(void *), void *arg) {
+    acquire(&wheel.lock);
+    if (t->prev) panic("timerset: pending");
+    t->expires = expires;
+    t->fn = fn;
+    t->arg = arg;
+    // a time that has passed fires at the next tick.
+    if ((int)(expires - wheel.now) <= 0) expires = wheel.now + 1;
+    struct timer **head = &wheel.slot[expires % NTSLOT];
+    t->next = *head;
+    t->prev = head;
+    if (*head) (*head)->prev = &t->next;
+    *head = t;
+    wheel.nset++;
+    release(&wheel.lock);
+}
+
+// Cancel t. Returns 1 if it was pending, 0 if it had
+// already fired; either way, its fn is not running when
+// timerdel() returns. Must not be called from t's own fn.
+int timerdel(struct timer *t) {
+    int pending;
+
+    acquire(&wheel.lock);
+    while (wheel.running == t) {
+        release(&wheel.lock);
+        acquire(&wheel.lock);
+    }
+    pending = t->prev != 0;
+    if (pending) {
+        unlink(t);
+        wheel.ncancel++;
+    }
+    release(&wheel.lock);
+    return pending;
+}
+
+// Find a timer in slot that is due by tick now.
+// Caller must hold wheel.lock.
+static struct timer *duetimer(uint now) {
+    struct timer *t;
+
+    for (t = wheel.slot[now % NTSLOT]; t; t = t->next)
+        if ((int)(t->expires - now) <= 0) return t;
+    return 0;  // the rest are for later turns
+}
+
+// Run the timers that are due at or before tick ticks.
+// Called with no locks held.
+void timertick(uint ticks) {
+    struct timer *t;
+
+    acquire(&wheel.lock);
+    if ((int)(ticks - wheel.due) > 0) wheel.due = ticks;
+    // the hart already at work will get to ticks too.
+    if (wheel.busy) {
+        release(&wheel.lock);
+        return;
+    }
+    wheel.busy = 1;
+    while ((int)(wheel.due - wheel.now) > 0) {
+        wheel.now++;
+        // empty the slot before moving on; fn may add or
+        // remove timers, so look again from the head each time.
+        while ((t = duetimer(wheel.now)) != 0) {
+            unlink(t);
+            wheel.nfired++;
+            // fn may take other locks, including ones held by
+            // code that calls timerset() or timerdel().
+            wheel.running = t;
+            release(&wheel.lock);
+            t->fn(t->arg);
+            acquire(&wheel.lock);
+            wheel.running = 0;
+        }
+    }
+    wheel.busy = 0;
+    release(&wheel.lock);
+}
+
+// Set *t to the tick at which the first pending timer will
+// fire and return 1, or return 0 if none is pending.
+int timernext(uint *t) {
+    int found = 0;
+    uint due, min = 0;
+
+    acquire(&wheel.lock);
+    for (int i = 0; i < NTSLOT; i++) {
+        for (struct timer *x = wheel.slot[i]; x; x = x->next) {
+            // overdue timers fire at the next tick.
+            due = (int)(x->expires - wheel.now) > 0 ? x->expires : wheel.now + 1;
+            if (!found || (int)(due - min) < 0) min = due;
+            found = 1;
+        }
+    }
+    release(&wheel.lock);
+    *t = min;
+    return found;
+}
+
+// Report timer activity for the stats device.
+int statstimer(char *buf, int sz) {
+    int n, pending = 0;
+
+    acquire(&wheel.lock);
+    for (int i = 0; i < NTSLOT; i++)
+        for (struct timer *t = wheel.slot[i]; t; t = t->next) pending++;
+    n = snprintf(buf, sz,
+                 "--- timer\nset %d, fired %d, cancelled %d, pending %d\n",
+                 wheel.nset, wheel.nfired, wheel.ncancel, pending);
+    release(&wheel.lock);
+    return n;
+}
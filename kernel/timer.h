@@ -0,0 +1,8 @@
+// Kernel timers; see timer.c.
+struct timer {
+    uint expires;         // Tick at which fn is called
+    void (*fn)(void *);   // Called from the clock interrupt, no locks held
+    void *arg;            // Argument for fn
+    struct timer *next;   // Next in the wheel slot
+    struct timer **prev;  // Link that points to this one; 0 if not pending
+};
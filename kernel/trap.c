@@ -3,11 +3,14 @@
 #include "memlayout.h"
 #include "riscv.h"
 #include "spinlock.h"
+#include "seqlock.h"
 #include "proc.h"
 #include "defs.h"
 
-struct spinlock tickslock;
+struct spinlock tickslock;  // serializes updates of ticks
 uint ticks;
+static struct seqlock tickseq;  // for readers of ticks
+static uint64 tick0;  // mtime at tick 0
 
 extern char trampoline[], uservec[], userret[];
 
@@ -15,11 +18,20 @@ extern char trampoline[], uservec[], userret[];
 void kernelvec();
 
 extern int devintr();
+static void alarm(struct proc *);
 
-void trapinit(void) { initlock(&tickslock, "time"); }
+void trapinit(void) {
+    initlock(&tickslock, "time");
+    initseqlock(&tickseq);
+    tick0 = clocknow();
+}
 
 // set up to take exceptions and traps while in the kernel.
-void trapinithart(void) { w_stvec((uint64)kernelvec); }
+void trapinithart(void) {
+    w_stvec((uint64)kernelvec);
+    // let user programs read the time, for benchmarks.
+    w_scounteren(r_scounteren() | COUNTEREN_TM);
+}
 
 //
 // handle an interrupt, exception, or system call from user space.
@@ -60,6 +72,14 @@ void usertrap(void) {
         if (uvmcowcopy(r_stval()) == -1) {  // 如果内存不足，则杀死进程
             p->killed = 1;
         }
+    } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+               uvmchecklazypage(r_stval())) {  // first touch of a lazy page
+        if (uvmlazyalloc(r_stval()) == -1) {
+            setkilled(p);
+        }
+    } else if ((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+               uvmcheckstale(r_stval(), r_scause())) {
+        // another thread mapped the page; the TLB was out of date.
     } else {
         printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
         printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -69,11 +89,38 @@ void usertrap(void) {
     if (killed(p)) exit(-1);
 
     // give up the CPU if this is a timer interrupt.
-    if (which_dev == 2) yield();
+    if (which_dev == 2) {
+        alarm(p);
+        yield();
+    }
 
     usertrapret();
 }
 
+// Deliver p's sigalarm() if it is due: save the user
+// registers in a frame on the user stack, and return to the
+// handler with the frame's address as its argument, on the
+// stack below the frame. sigreturn(frame) resumes where the
+// alarm struck, on whichever thread calls it.
+static void alarm(struct proc *p) {
+    struct trapframe *tf = p->trapframe;
+    struct trapframe f;
+
+    if (p->alarmticks == 0 || (int)(ticks - p->alarmnext) < 0) return;
+    p->alarmnext = ticks + p->alarmticks;
+
+    f = *tf;
+    f.kernel_satp = f.kernel_sp = f.kernel_trap = f.kernel_hartid = 0;
+    uint64 sp = (tf->sp - sizeof(f)) & ~0xfL;  // riscv sp must be 16-byte aligned
+    if (copyout(p->pagetable, sp, (char *)&f, sizeof(f)) < 0) {
+        setkilled(p);
+        return;
+    }
+    tf->sp = sp;
+    tf->a0 = sp;
+    tf->epc = p->alarmfn;
+}
+
 //
 // return to user space
 //
@@ -109,13 +156,15 @@ void usertrapret(void) {
     w_sepc(p->trapframe->epc);
 
     // tell trampoline.S the user page table to switch to.
-    uint64 satp = MAKE_SATP(p->pagetable);
+    uint64 satp = asidswitch(p);
 
     // jump to userret in trampoline.S at the top of memory, which
-    // switches to the user page table, restores user registers,
-    // and switches to user mode with sret.
+    // switches to the user page table, restores user registers
+    // from this thread's trapframe, and switches to user mode
+    // with sret.
     uint64 trampoline_userret = TRAMPOLINE + (userret - trampoline);
-    ((void (*)(uint64))trampoline_userret)(satp);
+    ((void (*)(uint64, uint64))trampoline_userret)(satp,
+                                                   THREADFRAME(p->tframe));
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -145,11 +194,67 @@ void kerneltrap() {
     w_sstatus(sstatus);
 }
 
+// The clock.
+//
+// A hart's timer interrupts it only when it has something
+// to do at a given time: a running process's time slice
+// ends at the next tick, and an idle hart sleeps until the
+// first pending kernel timer is due, or for good if there
+// is none. ticks counts the TICKCYCLES intervals since
+// boot; whichever hart takes a clock interrupt brings it up
+// to date, so it may advance by several at a time.
+
+#define TICKCYCLES 1000000  // about 1/10th second in qemu.
+
+// The clock's cycle count since boot.
+uint64 clocknow(void) { return *(volatile uint64 *)CLINT_MTIME; }
+
+static void clockset(uint64 when) {
+    *(volatile uint64 *)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Interrupt this hart at the start of tick t, or at once
+// if that has passed. Interrupts must be disabled.
+void clockarm(uint t) { clockset(tick0 + (uint64)t * TICKCYCLES); }
+
+// Interrupt this hart at the start of the next tick.
+// Interrupts must be disabled.
+void clockslice(void) {
+    clockset(tick0 + ((clocknow() - tick0) / TICKCYCLES + 1) * TICKCYCLES);
+}
+
+// No timer interrupts for this hart.
+// Interrupts must be disabled.
+void clockdisarm(void) { clockset(-1); }
+
+// Interrupt hart id, to wake it from wfi.
+void ipi(int id) { *(volatile uint32 *)CLINT_MSIP(id) = 1; }
+
 void clockintr() {
+    uint t;
+
     acquire(&tickslock);
-    ticks++;
-    wakeup(&ticks);
+    t = (clocknow() - tick0) / TICKCYCLES;
+    if ((int)(t - ticks) > 0) {
+        writeseqbegin(&tickseq);
+        ticks = t;
+        writeseqend(&tickseq);
+    }
+    t = ticks;
     release(&tickslock);
+    timertick(t);
+}
+
+// Read ticks without tickslock, so that processes polling
+// the time don't contend with the clock interrupt.
+uint getticks(void) {
+    uint seq, t;
+
+    do {
+        seq = readseqbegin(&tickseq);
+        t = ticks;
+    } while (readseqretry(&tickseq, seq));
+    return t;
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -181,17 +286,22 @@ int devintr() {
 
         return 1;
     } else if (scause == 0x8000000000000001L) {
-        // software interrupt from a machine-mode timer interrupt,
-        // forwarded by timervec in kernelvec.S.
-
-        if (cpuid() == 0) {
-            clockintr();
-        }
+        // software interrupt from a machine-mode timer interrupt
+        // or another hart's ipi(), forwarded by timervec in
+        // kernelvec.S.
 
         // acknowledge the software interrupt by clearing
-        // the SSIP bit in sip.
+        // the SSIP bit in sip, before looking at the time,
+        // so that a later ipi() is not lost.
         w_sip(r_sip() & ~2);
 
+        tlbcheck();
+        clockintr();
+
+        // the timer is off; a running process needs it for
+        // its time slice. the scheduler sets it when idle.
+        if (mycpu()->proc) clockslice();
+
         return 2;
     } else {
         return 0;
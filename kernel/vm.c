@@ -7,6 +7,8 @@
 #include "fs.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "sleeplock.h"
+#include "mm.h"
 
 /*
  * the kernel's page table.
@@ -21,8 +23,7 @@ extern char trampoline[];  // trampoline.S
 pagetable_t kvmmake(void) {
     pagetable_t kpgtbl;
 
-    kpgtbl = (pagetable_t)kalloc();
-    memset(kpgtbl, 0, PGSIZE);
+    kpgtbl = (pagetable_t)kalloc_zeroed();
 
     // uart registers
     kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
@@ -30,6 +31,9 @@ pagetable_t kvmmake(void) {
     // virtio mmio disk interface
     kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
 
+    // CLINT, for the timer and inter-processor interrupts
+    kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
     // PLIC
     kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
@@ -44,8 +48,7 @@ pagetable_t kvmmake(void) {
     // the highest virtual address in the kernel.
     kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-    // allocate and map a kernel stack for each process.
-    proc_mapstacks(kpgtbl);
+    // kernel stacks are mapped as processes are made; see proc.c.
 
     return kpgtbl;
 }
@@ -65,9 +68,59 @@ void kvminithart() {
     sfence_vma();
 }
 
+// Replace the superpage leaf *pte with a level-0 page table
+// that maps the same memory with 4096-byte pages. User
+// superpages are also split into single pages, so that each
+// can be freed or shared copy-on-write on its own.
+// Returns 0 on success, -1 if out of memory.
+static int demote(pte_t *pte) {
+    pagetable_t pagetable;
+    uint64 pa = PTE2PA(*pte);
+    uint64 flags = PTE_FLAGS(*pte);
+
+    // every entry is written below, so no need to zero it.
+    if ((pagetable = (pagetable_t)kalloc()) == 0) return -1;
+    if (flags & PTE_U) ksplit((void *)pa, SUPERPGORDER);
+    for (int i = 0; i < 512; i++)
+        pagetable[i] = PA2PTE(pa + i * PGSIZE) | flags;
+    *pte = PA2PTE(pagetable) | PTE_V;
+    return 0;
+}
+
+// Like walk(), but a superpage's level-1 leaf PTE is returned
+// as is when alloc is 0, with *level set to 1. Otherwise
+// *level is set to 0.
+static pte_t *walklevel(pagetable_t pagetable, uint64 va, int alloc,
+                        int *level) {
+    if (va >= MAXVA) panic("walk");
+
+    *level = 0;
+    for (int lv = 2; lv > 0; lv--) {
+        pte_t *pte = &pagetable[PX(lv, va)];
+        if ((*pte & PTE_V) && PTE_LEAF(*pte)) {
+            if (!alloc) {
+                *level = lv;
+                return pte;
+            }
+            if (lv != 1 || demote(pte) < 0) return 0;
+        }
+        if (*pte & PTE_V) {
+            pagetable = (pagetable_t)PTE2PA(*pte);
+        } else {
+            if (!alloc || (pagetable = (pde_t *)kalloc_zeroed()) == 0)
+                return 0;
+            *pte = PA2PTE(pagetable) | PTE_V;
+        }
+    }
+    return &pagetable[PX(0, va)];
+}
+
 // Return the address of the PTE in page table pagetable
 // that corresponds to virtual address va.  If alloc!=0,
-// create any required page-table pages.
+// create any required page-table pages, and split a
+// superpage that covers va into 4096-byte pages.
+// If alloc==0 and va lies in a superpage, return the
+// superpage's level-1 PTE.
 //
 // The risc-v Sv39 scheme has three levels of page-table
 // pages. A page-table page contains 512 64-bit PTEs.
@@ -78,35 +131,27 @@ void kvminithart() {
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
 pte_t *walk(pagetable_t pagetable, uint64 va, int alloc) {
-    if (va >= MAXVA) panic("walk");
+    int level;
 
-    for (int level = 2; level > 0; level--) {
-        pte_t *pte = &pagetable[PX(level, va)];
-        if (*pte & PTE_V) {
-            pagetable = (pagetable_t)PTE2PA(*pte);
-        } else {
-            if (!alloc || (pagetable = (pde_t *)kalloc()) == 0) return 0;
-            memset(pagetable, 0, PGSIZE);
-            *pte = PA2PTE(pagetable) | PTE_V;
-        }
-    }
-    return &pagetable[PX(0, va)];
+    return walklevel(pagetable, va, alloc, &level);
 }
 
-// Look up a virtual address, return the physical address,
-// or 0 if not mapped.
+// Look up a virtual address, return the physical address
+// of its page, or 0 if not mapped.
 // Can only be used to look up user pages.
 uint64 walkaddr(pagetable_t pagetable, uint64 va) {
     pte_t *pte;
     uint64 pa;
+    int level;
 
     if (va >= MAXVA) return 0;
 
-    pte = walk(pagetable, va, 0);
+    pte = walklevel(pagetable, va, 0, &level);
     if (pte == 0) return 0;
     if ((*pte & PTE_V) == 0) return 0;
     if ((*pte & PTE_U) == 0) return 0;
     pa = PTE2PA(*pte);
+    if (level == 1) pa += PGROUNDDOWN(va) & (SUPERPGSIZE - 1);
     return pa;
 }
 
@@ -117,10 +162,30 @@ void kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm) {
     if (mappages(kpgtbl, va, sz, pa, perm) != 0) panic("kvmmap");
 }
 
+// Install a superpage leaf for va -> pa if both are 2 MiB
+// aligned and nothing is mapped at level 1 for va yet.
+// Returns 0 on success, -1 if a superpage can't be used.
+static int mapsuper(pagetable_t pagetable, uint64 va, uint64 pa, int perm) {
+    pte_t *pte;
+
+    if ((va % SUPERPGSIZE) != 0 || (pa % SUPERPGSIZE) != 0) return -1;
+    pte = &pagetable[PX(2, va)];
+    if ((*pte & PTE_V) == 0) {
+        if ((pagetable = (pde_t *)kalloc_zeroed()) == 0) return -1;
+        *pte = PA2PTE(pagetable) | PTE_V;
+    }
+    if (PTE_LEAF(*pte)) return -1;
+    pte = &((pagetable_t)PTE2PA(*pte))[PX(1, va)];
+    if (*pte & PTE_V) return -1;
+    *pte = PA2PTE(pa) | perm | PTE_V;
+    return 0;
+}
+
 // Create PTEs for virtual addresses starting at va that refer to
 // physical addresses starting at pa. va and size might not
-// be page-aligned. Returns 0 on success, -1 if walk() couldn't
-// allocate a needed page-table page.
+// be page-aligned. 2 MiB stretches in which both addresses are
+// suitably aligned are mapped with superpages. Returns 0 on
+// success, -1 if walk() couldn't allocate a needed page-table page.
 int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa,
              int perm) {
     uint64 a, last;
@@ -132,6 +197,13 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa,
     last = PGROUNDDOWN(va + size - 1);
 
     for (;;) {
+        if (last - a >= SUPERPGSIZE - PGSIZE &&
+            mapsuper(pagetable, a, pa, perm) == 0) {
+            if (last - a == SUPERPGSIZE - PGSIZE) break;
+            a += SUPERPGSIZE;
+            pa += SUPERPGSIZE;
+            continue;
+        }
         if ((pte = walk(pagetable, a, 1)) == 0) return -1;
         // if (*pte & PTE_V)
         // continue;
@@ -144,34 +216,102 @@ int mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa,
     return 0;
 }
 
-// Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
-// Optionally free the physical memory.
-void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
-    uint64 a;
+// Return the PTE for va that uvmunmap() made invalid but
+// has not cleared yet, or 0; *level is 1 for a superpage's.
+static pte_t *walkunmapped(pagetable_t pagetable, uint64 va, int *level) {
+    for (int lv = 2; lv > 0; lv--) {
+        pte_t *pte = &pagetable[PX(lv, va)];
+        if ((*pte & PTE_V) == 0 || PTE_LEAF(*pte)) {
+            *level = lv;
+            return (*pte & PTE_V) == 0 && *pte != 0 ? pte : 0;
+        }
+        pagetable = (pagetable_t)PTE2PA(*pte);
+    }
+    *level = 0;
+    pte_t *pte = &pagetable[PX(0, va)];
+    return (*pte & PTE_V) == 0 && *pte != 0 ? pte : 0;
+}
+
+// The work of uvmunmap() and uvmunmapmm(). The TLBs are
+// flushed for mm if it is not 0, else as uvmflush() does.
+static void unmap(pagetable_t pagetable, struct mm *mm, uint64 va,
+                  uint64 npages, int do_free) {
+    uint64 a, end = va + npages * PGSIZE;
     pte_t *pte;
+    int level;
 
     if ((va % PGSIZE) != 0) panic("uvmunmap: not aligned");
 
-    for (a = va; a < va + npages * PGSIZE; a += PGSIZE) {
-        if ((pte = walk(pagetable, a, 0)) == 0) panic("uvmunmap: walk");
-        if ((*pte & PTE_V) == 0) panic("uvmunmap: not mapped");
+    for (a = va; a < end; a += PGSIZE) {
+        // skip lazy heap pages that were never touched.
+        if ((pte = walklevel(pagetable, a, 0, &level)) == 0) continue;
+        if ((*pte & PTE_V) == 0) continue;
+        if (level == 1) {
+            if ((a % SUPERPGSIZE) == 0 && a + SUPERPGSIZE <= end) {
+                *pte &= ~PTE_V;
+                a += SUPERPGSIZE - PGSIZE;
+                continue;
+            }
+            if ((pte = walk(pagetable, a, 1)) == 0) panic("uvmunmap: split");
+        }
         if (PTE_FLAGS(*pte) == PTE_V) panic("uvmunmap: not a leaf");
+        *pte &= ~PTE_V;
+    }
+    if (mm)
+        tlbshootdown(mm, va, npages);
+    else
+        uvmflush(pagetable, va, npages);
+
+    for (a = va; a < end; a += PGSIZE) {
+        if ((pte = walkunmapped(pagetable, a, &level)) == 0) continue;
         if (do_free) {
-            uint64 pa = PTE2PA(*pte);
-            kfree((void *)pa);
+            if (level == 1)
+                kfree_order((void *)PTE2PA(*pte), SUPERPGORDER);
+            else
+                kfree((void *)PTE2PA(*pte));
         }
         *pte = 0;
+        if (level == 1) a += SUPERPGSIZE - PGSIZE;
     }
 }
 
+// Remove npages of mappings starting from va. va must be
+// page-aligned. Pages that are not mapped are skipped. A
+// superpage that is only partly removed is first split into
+// 4096-byte pages.
+// Optionally free the physical memory.
+// The PTEs are made invalid first, and cleared and their
+// pages freed only after the TLB flush, since until then
+// other threads of the process may still use the pages.
+void uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free) {
+    unmap(pagetable, 0, va, npages, do_free);
+}
+
+// Like uvmunmap(mm->pagetable, va, npages, 1), for an
+// address space that need not be the current process's.
+// Caller must hold mm->lock.
+void uvmunmapmm(struct mm *mm, uint64 va, uint64 npages) {
+    unmap(mm->pagetable, mm, va, npages, 1);
+}
+
+// Flush the TLB entries for npages pages at va if pagetable
+// belongs to the current process, after a change to it,
+// on every hart that runs a thread of the process.
+// Other page tables are either not in use or get a new ASID
+// before they are next used.
+void uvmflush(pagetable_t pagetable, uint64 va, uint64 npages) {
+    struct proc *p = myproc();
+
+    if (p && p->pagetable == pagetable)
+        tlbshootdown(p->mm, PGROUNDDOWN(va), npages);
+}
+
 // create an empty user page table.
 // returns 0 if out of memory.
 pagetable_t uvmcreate() {
     pagetable_t pagetable;
-    pagetable = (pagetable_t)kalloc();
+    pagetable = (pagetable_t)kalloc_zeroed();
     if (pagetable == 0) return 0;
-    memset(pagetable, 0, PGSIZE);
     return pagetable;
 }
 
@@ -182,8 +322,7 @@ void uvmfirst(pagetable_t pagetable, uchar *src, uint sz) {
     char *mem;
 
     if (sz >= PGSIZE) panic("uvmfirst: more than a page");
-    mem = kalloc();
-    memset(mem, 0, PGSIZE);
+    mem = kalloc_zeroed();
     mappages(pagetable, 0, PGSIZE, (uint64)mem, PTE_W | PTE_R | PTE_X | PTE_U);
     memmove(mem, src, sz);
 }
@@ -198,12 +337,25 @@ uint64 uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz, int xperm) {
 
     oldsz = PGROUNDUP(oldsz);
     for (a = oldsz; a < newsz; a += PGSIZE) {
-        mem = kalloc();
+        // use a superpage for each aligned 2 MiB of the region,
+        // when physically contiguous memory is available.
+        if ((a % SUPERPGSIZE) == 0 && newsz - a >= SUPERPGSIZE &&
+            (mem = kalloc_order(SUPERPGORDER)) != 0) {
+            memset(mem, 0, SUPERPGSIZE);
+            if (mappages(pagetable, a, SUPERPGSIZE, (uint64)mem,
+                         PTE_R | PTE_U | xperm) != 0) {
+                kfree_order(mem, SUPERPGORDER);
+                uvmdealloc(pagetable, a, oldsz);
+                return 0;
+            }
+            a += SUPERPGSIZE - PGSIZE;
+            continue;
+        }
+        mem = kalloc_zeroed();
         if (mem == 0) {
             uvmdealloc(pagetable, a, oldsz);
             return 0;
         }
-        memset(mem, 0, PGSIZE);
         if (mappages(pagetable, a, PGSIZE, (uint64)mem,
                      PTE_R | PTE_U | xperm) != 0) {
             kfree(mem);
@@ -256,28 +408,48 @@ void uvmfree(pagetable_t pagetable, uint64 sz) {
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// The pages are shared copy-on-write; the parent's
+// superpages are split first so that each page can be
+// copied on its own.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
+    return uvmcopyrange(old, new, 0, PGROUNDUP(sz), 0);
+}
+
+// Copy the mappings of [start, end) from old to new, as
+// uvmcopy() does. If share is set, writable pages stay
+// writable and are shared instead of copied on write,
+// for MAP_SHARED areas.
+int uvmcopyrange(pagetable_t old, pagetable_t new, uint64 start, uint64 end,
+                 int share) {
     pte_t *pte;
     uint64 pa, i;
     uint flags;
-
-    for (i = 0; i < sz; i += PGSIZE) {
-        if ((pte = walk(old, i, 0)) == 0) panic("uvmcopy: pte should exist");
-        if ((*pte & PTE_V) == 0) panic("uvmcopy: page not present");
+    int level;
+
+    for (i = start; i < end; i += PGSIZE) {
+        // lazy heap pages that were never touched stay
+        // unmapped in the child as well.
+        if ((pte = walklevel(old, i, 0, &level)) == 0) continue;
+        if ((*pte & PTE_V) == 0) continue;
+        if (level == 1 && (pte = walk(old, i, 1)) == 0) goto bad;
         pa = PTE2PA(*pte);
-        *pte = (*pte & ~PTE_W) | PTE_COW;
+        // only writable pages need copy-on-write; read-only
+        // ones, such as shared program text, are just shared.
+        if (!share && (*pte & PTE_W)) *pte = (*pte & ~PTE_W) | PTE_COW;
         flags = PTE_FLAGS(*pte);
-        if (mappages(new, i, PGSIZE, (uint64)pa, flags) != 0) {
-            uvmunmap(new, 0, i / PGSIZE, 1);
-            return -1;
-        }
+        if (mappages(new, i, PGSIZE, (uint64)pa, flags) != 0) goto bad;
         addref((void *)pa);
     }
+    // the parent's pages became copy-on-write.
+    uvmflush(old, start, (end - start) / PGSIZE);
     return 0;
+
+bad:
+    uvmflush(old, start, (end - start) / PGSIZE);
+    uvmunmap(new, start, (i - start) / PGSIZE, 1);
+    return -1;
 }
 
 // mark a PTE invalid for user access.
@@ -285,20 +457,58 @@ int uvmcopy(pagetable_t old, pagetable_t new, uint64 sz) {
 void uvmclear(pagetable_t pagetable, uint64 va) {
     pte_t *pte;
 
-    pte = walk(pagetable, va, 0);
+    pte = walk(pagetable, va, 1);
     if (pte == 0) panic("uvmclear");
     *pte &= ~PTE_U;
 }
 
+// Like walkaddr(), but first fault in va0 if it is a lazy
+// page of the current process, and break copy-on-write
+// sharing of the page if write is set. Fails for a write
+// to a read-only page.
+static uint64 walkaddrfault(pagetable_t pagetable, uint64 va0, int write) {
+    struct proc *p = myproc();
+
+    if (p && pagetable == p->pagetable) {
+        if (uvmchecklazypage(va0) && uvmlazyalloc(va0) < 0) return 0;
+        if (write && uvmcheckcowpage(va0) && uvmcowcopy(va0) < 0) return 0;
+        if (write && va0 < MAXVA) {
+            // the hardware won't mark a page dirty for a store
+            // by the kernel; do it here so that a shared
+            // mapping gets written back.
+            acquire(&p->mm->lock);
+            pte_t *pte = walk(pagetable, va0, 0);
+            int ok = pte != 0 && (*pte & PTE_W) != 0;
+            if (ok) *pte |= PTE_D;
+            release(&p->mm->lock);
+            if (!ok) return 0;
+        }
+    }
+    return walkaddr(pagetable, va0);
+}
+
+// Return the physical address of the current process's
+// user address va, after faulting it in and breaking
+// copy-on-write sharing, so that it stays at that address
+// until it is unmapped or the process forks. Returns 0 if
+// va can't be written.
+uint64 uvmwriteaddr(uint64 va) {
+    uint64 va0 = PGROUNDDOWN(va);
+    uint64 pa0 = walkaddrfault(myproc()->pagetable, va0, 1);
+
+    if (pa0 == 0) return 0;
+    return pa0 + (va - va0);
+}
+
 // Copy from kernel to user.
 // Copy len bytes from src to virtual address dstva in a given page table.
 // Return 0 on success, -1 on error.
 int copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len) {
     uint64 n, va0, pa0;
-    if (uvmcheckcowpage(dstva)) uvmcowcopy(dstva);
+
     while (len > 0) {
         va0 = PGROUNDDOWN(dstva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = walkaddrfault(pagetable, va0, 1);
 
         if (pa0 == 0) return -1;
         n = PGSIZE - (dstva - va0);
@@ -320,7 +530,7 @@ int copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len) {
 
     while (len > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = walkaddrfault(pagetable, va0, 0);
         if (pa0 == 0) return -1;
         n = PGSIZE - (srcva - va0);
         if (n > len) n = len;
@@ -343,7 +553,7 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
 
     while (got_null == 0 && max > 0) {
         va0 = PGROUNDDOWN(srcva);
-        pa0 = walkaddr(pagetable, va0);
+        pa0 = walkaddrfault(pagetable, va0, 0);
         if (pa0 == 0) return -1;
         n = PGSIZE - (srcva - va0);
         if (n > max) n = max;
@@ -372,25 +582,173 @@ int copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max) {
     }
 }
 
+// Is va a copy-on-write page of the current process?
+// Like uvmchecklazypage(), a hint: uvmcowcopy() looks again
+// with the lock held.
 int uvmcheckcowpage(uint64 va) {
     pte_t *pte;
     struct proc *p = myproc();
 
-    return va < p->sz && ((pte = walk(p->pagetable, va, 0)) != 0) &&
-           (*pte & PTE_V) && (*pte & PTE_COW);
+    return (va < p->mm->sz || vmalookup(p, va)) &&
+           ((pte = walk(p->pagetable, va, 0)) != 0) && (*pte & PTE_V) &&
+           (*pte & PTE_COW);
 }
 
+// Give the current process its own writable copy of the
+// copy-on-write page va, or just make the page writable if
+// no one else shares it. Returns 0 on success, -1 if out of
+// memory.
 int uvmcowcopy(uint64 va) {
     struct proc *p = myproc();
-    pte_t *pte = walk(p->pagetable, va, 0);
-    uint64 pa = PTE2PA(*pte);
-    uint64 new = (uint64)kcowcopy((void *)pa);
-    if (new == 0) return -1;
+    struct mm *mm = p->mm;
+    uint64 pa, new;
+    pte_t *pte;
+
+    acquire(&mm->lock);
+    pte = walk(p->pagetable, va, 0);
+    if (pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0) {
+        // another thread got there first.
+        release(&mm->lock);
+        return 0;
+    }
+    pa = new = PTE2PA(*pte);
+    if (krefcnt((void *)pa) > 1) {
+        if ((new = (uint64)kalloc()) == 0) {
+            release(&mm->lock);
+            return -1;
+        }
+        memmove((void *)new, (void *)pa, PGSIZE);
+    }
+    *pte = PA2PTE(new) | ((PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW);
+    release(&mm->lock);
 
-    uint64 flags = (PTE_FLAGS(*pte) | PTE_W) & ~PTE_COW;
-    uvmunmap(p->pagetable, PGROUNDDOWN(va), 1, 0);
-    if (mappages(p->pagetable, PGROUNDDOWN(va), PGSIZE, new, flags) == -1) {
-        panic("uvmcowcopy: mappages");
+    if (new == pa) {
+        asidflush(mm, PGROUNDDOWN(va), 1);
+    } else {
+        // other threads may still read the old page until
+        // their TLBs are flushed. the other sharers may have
+        // gone away meanwhile, in which case this frees pa.
+        tlbshootdown(mm, PGROUNDDOWN(va), 1);
+        kfree((void *)pa);
     }
     return 0;
 }
+
+// Return the number of page-table pages that may have to be
+// allocated to map every page in [oldsz, newsz): one for each
+// 2 MiB stretch that has no level-0 page table yet.
+uint64 uvmptneed(pagetable_t pagetable, uint64 oldsz, uint64 newsz) {
+    uint64 a, n = 0;
+
+    for (a = PGROUNDUP(oldsz) & ~(SUPERPGSIZE - 1); a < newsz; a += SUPERPGSIZE)
+        if (walk(pagetable, a, 0) == 0) n++;
+    return n;
+}
+
+// Is va a page of the current process that is not mapped
+// yet: a heap page that sbrk() reserved, or a page of a
+// program segment that exec() has not read in?
+// The answer is a hint, since another thread may change the
+// address space meanwhile; uvmlazyalloc() looks again with
+// the lock held.
+int uvmchecklazypage(uint64 va) {
+    pte_t *pte;
+    struct proc *p = myproc();
+
+    return (va < p->mm->sz || vmalookup(p, va)) &&
+           ((pte = walk(p->pagetable, va, 0)) == 0 || (*pte & PTE_V) == 0);
+}
+
+// Replace the 512 pages that map the aligned 2 MiB at a
+// with one superpage holding a copy of them, if every one
+// of them is a private, writable heap page. Called as each
+// lazy heap page is mapped, so that a region is promoted
+// once the program has touched all of it, and not before.
+// Caller must hold mm->lock.
+static void promote(struct proc *p, uint64 a) {
+    struct mm *mm = p->mm;
+    pagetable_t pt;
+    pte_t *pte;
+    char *mem;
+    int level, i;
+
+    if (a + SUPERPGSIZE > mm->sz || vmaoverlap(p, a, a + SUPERPGSIZE)) return;
+    if ((pte = walklevel(p->pagetable, a, 0, &level)) == 0 || level != 0)
+        return;
+    pt = (pagetable_t)PTE2PA(p->pagetable[PX(2, a)]);
+    pte = &((pagetable_t)PTE2PA(pt[PX(1, a)]))[0];
+    // scan down, so that a region being filled from the
+    // bottom up is turned down at its first entry.
+    for (i = 511; i >= 0; i--)
+        if ((pte[i] & (PTE_V | PTE_R | PTE_W | PTE_X | PTE_U | PTE_COW)) !=
+            (PTE_V | PTE_R | PTE_W | PTE_U))
+            return;
+    if ((mem = kalloc_order(SUPERPGORDER)) == 0) return;
+
+    // other threads must not write to the old pages while
+    // they are copied; they fault, and wait for mm->lock.
+    for (i = 0; i < 512; i++) pte[i] &= ~PTE_V;
+    tlbshootdown(mm, a, 512);
+    for (i = 0; i < 512; i++) {
+        memmove(mem + i * PGSIZE, (void *)PTE2PA(pte[i]), PGSIZE);
+        kfree((void *)PTE2PA(pte[i]));
+    }
+    pt[PX(1, a)] = PA2PTE(mem) | PTE_W | PTE_R | PTE_U | PTE_V;
+    kfree((void *)pte);
+    asidflush(mm, a, 512);
+}
+
+// Map memory at the lazy page va: the file content for a page
+// in a memory area, zeroed memory otherwise. A heap page gets
+// a single 4096-byte page; promote() turns a 2 MiB region
+// into a superpage only once all of it has been touched.
+// Memory is allocated before taking mm->lock, and given back
+// if another thread mapped the page meanwhile.
+// Returns 0 on success, -1 if out of memory.
+int uvmlazyalloc(uint64 va) {
+    struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    pte_t *pte;
+    char *mem;
+    int r = 0;
+
+    if (vmalookup(p, va) != 0) return vmafault(p, va);
+
+    if ((mem = kalloc_zeroed()) == 0 &&
+        (pcache_reclaim() == 0 || (mem = kalloc_zeroed()) == 0))
+        return -1;
+    acquire(&mm->lock);
+    if ((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+        // another thread mapped it.
+        kfree(mem);
+    } else if (va >= mm->sz ||
+               mappages(p->pagetable, PGROUNDDOWN(va), PGSIZE, (uint64)mem,
+                        PTE_W | PTE_R | PTE_U) != 0) {
+        // sbrk() took it back, or out of memory.
+        kfree(mem);
+        r = -1;
+    } else {
+        p->nfault++;
+        asidflush(mm, PGROUNDDOWN(va), 1);
+        promote(p, va & ~(SUPERPGSIZE - 1));
+    }
+    release(&mm->lock);
+    return r;
+}
+
+// Is a fault at va of kind scause one that the page table
+// no longer calls for, because another thread mapped the
+// page, or made it writable, after this hart's TLB cached
+// the old entry? If so, flush the entry so the access can
+// be retried.
+int uvmcheckstale(uint64 va, uint64 scause) {
+    struct proc *p = myproc();
+    int need = scause == 12 ? PTE_X : scause == 13 ? PTE_R : PTE_W;
+    pte_t *pte;
+
+    if (va >= MAXVA || (pte = walk(p->pagetable, va, 0)) == 0) return 0;
+    if ((*pte & PTE_V) == 0 || (*pte & PTE_U) == 0 || (*pte & need) == 0)
+        return 0;
+    asidflush(p->mm, PGROUNDDOWN(va), 1);
+    return 1;
+}
@@ -0,0 +1,461 @@
+// Memory areas: regions of a process's address space whose
+// pages are filled in on first touch.
+//
+// exec() describes each loadable program segment with a
+// struct vma instead of reading it into memory. A page fault
+// in an area maps the page: whole pages of read-only areas
+// come from the page cache (pcache.c) and are shared by all
+// processes running the program; other pages are private
+// copies of the file content, zero-filled past the end of
+// the file-backed part.
+//
+// mmap() adds areas above the heap, placed downwards from
+// USERTOP:
+// * MAP_SHARED file areas map the page cache's pages
+//   directly, so every process mapping the file sees the
+//   same memory, and so does read() once the pages are
+//   written back. Pages the hardware marked dirty (PTE_D)
+//   are written back to the file by munmap() and exit().
+// * MAP_PRIVATE file areas map the page cache's pages
+//   copy-on-write; the first store gives the process its
+//   own copy.
+// * MAP_ANONYMOUS areas are zero-filled memory. Shared ones
+//   are allocated up front, so that a fork()ed child maps
+//   the same pages as the parent. A MAP_STACK area is a row
+//   of thread stacks, each with a guard page below it that
+//   is never mapped, so that running off the end of a stack
+//   kills the process instead of corrupting its neighbour.
+//   off gives the size of each; one area holds many stacks
+//   without using a slot for each.
+//
+// The areas belong to the address space (struct mm), which
+// the threads of a process share. mmap(), munmap() and exit()
+// hold mm->maplock throughout, and mm->lock as well while
+// they change the table or unmap pages; a fault in an area
+// holds mm->maplock while it reads the file, so that the
+// area and its inode stay, and takes mm->lock to map the
+// page. Each file area holds a reference to its inode,
+// which must be dropped inside a transaction. Program
+// segments also count as the file's text, and writable
+// MAP_SHARED areas as its writers (see itext() in fs.c), so
+// that nothing can write a program that is running.
+//
+// A fault in an area sleeps, so copyin() and copyout(),
+// which fault pages in for the kernel, must not be called
+// with a spinlock held; code that copies under a spinlock
+// goes through a buffer on the kernel stack instead. The
+// other locks a copy may be made under are an inode's and a
+// buffer's, in readi() and writei(); a fault taking them
+// again would deadlock, so fileread() and filewrite() fault
+// the user range in with vmaprefault() before they lock.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "proc.h"
+#include "mm.h"
+#include "defs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
+
+// Return the area of p containing va, or 0.
+struct vma *vmalookup(struct proc *p, uint64 va) {
+    for (struct vma *v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->end && v->start <= va && va < v->end) return v;
+    return 0;
+}
+
+// Does any area of p overlap [start, end)?
+int vmaoverlap(struct proc *p, uint64 start, uint64 end) {
+    for (struct vma *v = p->mm->vma; v < &p->mm->vma[NVMA]; v++)
+        if (v->end && v->start < end && start < v->end) return 1;
+    return 0;
+}
+
+// Map the page that contains va of one of p's areas into
+// p's page table, unless another thread did meanwhile.
+// Returns 0 on success, -1 if va is in no area, out of
+// memory, or the file can't be read.
+int vmafault(struct proc *p, uint64 va) {
+    struct mm *mm = p->mm;
+    uint64 a = PGROUNDDOWN(va);
+    struct vma *v;
+    pte_t *pte;
+    char *mem;
+
+    // reading the file may sleep; see the comment at the top.
+    push_off();
+    if (mycpu()->noff > 1) panic("vmafault: spinlock held");
+    pop_off();
+
+    acquiresleep(&mm->maplock);
+    if ((v = vmalookup(p, va)) == 0) {
+        releasesleep(&mm->maplock);
+        return -1;
+    }
+
+    uint64 pgoff = a - v->start;
+    uint off = v->off + pgoff;
+    uint n = 0;
+    int perm = v->perm;
+
+    if (pgoff < v->filesz) n = min(v->filesz - pgoff, PGSIZE);
+    // off counts the pages munmap() took from the start.
+    if (v->guard && (off / PGSIZE) % v->guard == 0) goto bad;
+
+    if (v->ip == 0) {
+        if ((mem = kalloc_zeroed()) == 0 &&
+            (pcache_reclaim() == 0 || (mem = kalloc_zeroed()) == 0))
+            goto bad;
+    } else if (v->flags) {
+        // mmap() of a file: map the cached page, copy-on-write
+        // for a private area.
+        if ((mem = pcache_get(v->ip, off)) == 0 &&
+            (pcache_reclaim() == 0 || (mem = pcache_get(v->ip, off)) == 0))
+            goto bad;
+        if ((v->flags & MAP_PRIVATE) && (perm & PTE_W))
+            perm = (perm & ~PTE_W) | PTE_COW;
+    } else if ((v->perm & PTE_W) == 0 && n == PGSIZE) {
+        // a whole read-only page: share it.
+        if ((mem = pcache_get(v->ip, off)) == 0 &&
+            (pcache_reclaim() == 0 || (mem = pcache_get(v->ip, off)) == 0))
+            goto bad;
+    } else {
+        if ((mem = kalloc_zeroed()) == 0 &&
+            (pcache_reclaim() == 0 || (mem = kalloc_zeroed()) == 0))
+            goto bad;
+        if (n > 0) {
+            ilock(v->ip);
+            int r = readi(v->ip, 0, (uint64)mem, off, n);
+            iunlock(v->ip);
+            if (r != n) {
+                kfree(mem);
+                goto bad;
+            }
+        }
+    }
+
+    acquire(&mm->lock);
+    if ((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V)) {
+        // another thread mapped it.
+        release(&mm->lock);
+        kfree(mem);
+        releasesleep(&mm->maplock);
+        return 0;
+    }
+    if (mappages(p->pagetable, a, PGSIZE, (uint64)mem, perm | PTE_U) != 0) {
+        release(&mm->lock);
+        kfree(mem);
+        goto bad;
+    }
+    p->nfault++;
+    release(&mm->lock);
+    releasesleep(&mm->maplock);
+    asidflush(mm, a, 1);
+    return 0;
+
+bad:
+    releasesleep(&mm->maplock);
+    return -1;
+}
+
+// Fault in the area pages of the current process that
+// [va, va+len) touches, before taking the inode lock that
+// a fault might need; see the comment at the top.
+void vmaprefault(uint64 va, uint64 len) {
+    struct proc *p = myproc();
+    pte_t *pte;
+
+    for (uint64 a = PGROUNDDOWN(va); a < va + len; a += PGSIZE) {
+        if (vmalookup(p, a) == 0) continue;
+        if ((pte = walk(p->pagetable, a, 0)) != 0 && (*pte & PTE_V)) continue;
+        if (vmafault(p, a) < 0) return;
+    }
+}
+
+// Does area v write to its file?
+static int vmawriter(struct vma *v) {
+    return v->ip && (v->flags & MAP_SHARED) && (v->perm & PTE_W);
+}
+
+// Take a reference to the file of v, a new area. Returns -1
+// if v is a writer and the file is program text, else 0.
+static int vmaget(struct vma *v) {
+    if (v->ip == 0) return 0;
+    if (v->flags == 0 && itext(v->ip, 1) < 0) return -1;
+    if (vmawriter(v) && iwrite(v->ip, 1) < 0) return -1;
+    idup(v->ip);
+    return 0;
+}
+
+// Give np copies of p's areas, for fork(). The pages that p
+// has mapped in its mmap() areas are copied to np as well;
+// the rest of p's memory is copied by uvmcopy().
+// Caller must hold p->mm->lock.
+// Returns 0 on success, -1 if out of memory.
+int vmadup(struct proc *np, struct proc *p) {
+    struct vma *vma = p->mm->vma, *v;
+
+    for (v = vma; v < &vma[NVMA]; v++) {
+        if (v->flags == 0) continue;
+        if (uvmcopyrange(p->pagetable, np->pagetable, v->start, v->end,
+                         v->flags & MAP_SHARED) < 0) {
+            while (--v >= vma)
+                if (v->flags)
+                    uvmunmap(np->pagetable, v->start,
+                             (v->end - v->start) / PGSIZE, 1);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < NVMA; i++) {
+        np->mm->vma[i] = vma[i];
+        vmaget(&np->mm->vma[i]);
+    }
+    return 0;
+}
+
+// Write the dirty pages of area v in [start, end) back to
+// the file if v is a shared file mapping.
+// Caller must hold p->mm->maplock, and must not be inside a
+// transaction.
+static void vmasync(struct proc *p, struct vma *v, uint64 start, uint64 end) {
+    pte_t *pte;
+
+    if (v->ip == 0 || (v->flags & MAP_SHARED) == 0) return;
+    for (uint64 a = start; a < end; a += PGSIZE) {
+        if ((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0 ||
+            (*pte & PTE_D) == 0)
+            continue;
+        // only bytes within the file are written back;
+        // munmap() never grows the file.
+        uint off = v->off + (a - v->start);
+        begin_op();
+        ilock(v->ip);
+        if (off < v->ip->size)
+            writei(v->ip, 0, PTE2PA(*pte), off, min(v->ip->size - off, PGSIZE));
+        iunlock(v->ip);
+        end_op();
+    }
+}
+
+// Drop area v's reference to its file.
+static void vmaput(struct vma *v) {
+    if (v->ip == 0) return;
+    if (v->flags == 0) itext(v->ip, -1);
+    if (vmawriter(v)) iwrite(v->ip, -1);
+    begin_op();
+    iput(v->ip);
+    end_op();
+}
+
+// Drop all of p's areas. The pages of mmap() areas are
+// written back and unmapped; those of program segments stay
+// mapped until the page table is freed.
+// Caller must not be inside a transaction.
+void vmafree(struct proc *p) {
+    struct mm *mm = p->mm;
+
+    acquiresleep(&mm->maplock);
+    for (struct vma *v = mm->vma; v < &mm->vma[NVMA]; v++) {
+        if (v->end == 0) continue;
+        vmasync(p, v, v->start, v->end);
+        struct vma old = *v;
+        acquire(&mm->lock);
+        if (v->flags)
+            uvmunmap(p->pagetable, v->start, (v->end - v->start) / PGSIZE, 1);
+        memset(v, 0, sizeof(*v));
+        release(&mm->lock);
+        vmaput(&old);
+    }
+    releasesleep(&mm->maplock);
+}
+
+static void vmazap(struct mm *mm, void *ip) {
+    acquiresleep(&mm->maplock);
+    acquire(&mm->lock);
+    for (struct vma *v = mm->vma; v < &mm->vma[NVMA]; v++)
+        if (v->ip == ip && (v->flags & MAP_SHARED))
+            uvmunmapmm(mm, v->start, (v->end - v->start) / PGSIZE);
+    release(&mm->lock);
+    releasesleep(&mm->maplock);
+}
+
+// ip has just been truncated: unmap the pages of ip's
+// MAP_SHARED areas in every process, without writing them
+// back, so that no process goes on using the old content or
+// writes it back over the file's new content; they fault
+// in again from the file. MAP_PRIVATE areas keep the pages
+// they have, as they would private copies.
+// Caller must not hold ip's lock, since a fault holds
+// mm->maplock while it locks ip.
+void vmatruncate(struct inode *ip) {
+    mmforeach(vmazap, ip);
+}
+
+// Find len bytes of unused address space above the heap,
+// as high as possible below USERTOP. Returns 0 if there
+// is no room.
+static uint64 vmaplace(struct proc *p, uint64 len) {
+    uint64 top = USERTOP;
+
+again:
+    if (top < len || top - len < PGROUNDUP(p->mm->sz)) return 0;
+    for (struct vma *v = p->mm->vma; v < &p->mm->vma[NVMA]; v++) {
+        if (v->end && v->start < top && top - len < v->end) {
+            top = v->start;
+            goto again;
+        }
+    }
+    return top - len;
+}
+
+// Create an mmap() area of len bytes for the current process,
+// at addr if that is free, else wherever there is room.
+// f is the file to map at offset off, unless flags has
+// MAP_ANONYMOUS. Returns the address of the area, or -1.
+uint64 vmammap(uint64 addr, uint64 len, int prot, int flags, struct file *f,
+               uint off) {
+    struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    struct vma *v;
+    int perm = 0;
+    int type = flags & (MAP_SHARED | MAP_PRIVATE);
+
+    if (type != MAP_SHARED && type != MAP_PRIVATE) return -1;
+    if (flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK))
+        return -1;
+    if (len == 0 || len >= USERTOP || off % PGSIZE != 0) return -1;
+    len = PGROUNDUP(len);
+
+    if (flags & MAP_STACK) {
+        if (flags != (MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK)) return -1;
+        if (off < 2 * PGSIZE || len % off != 0) return -1;
+    }
+
+    if ((flags & MAP_ANONYMOUS) == 0) {
+        if (f == 0 || f->type != FD_INODE || !f->readable) return -1;
+        if (type == MAP_SHARED && (prot & PROT_WRITE) && !f->writable)
+            return -1;
+        if ((uint64)off + len > MAXFILE * BSIZE) return -1;
+    }
+
+    // RISC-V has no write-only pages.
+    if (prot & (PROT_READ | PROT_WRITE)) perm |= PTE_R;
+    if (prot & PROT_WRITE) perm |= PTE_W;
+    if (prot & PROT_EXEC) perm |= PTE_X;
+    if (perm == 0) return -1;
+
+    acquiresleep(&mm->maplock);
+    for (v = mm->vma; v < &mm->vma[NVMA]; v++)
+        if (v->end == 0) break;
+    if (v == &mm->vma[NVMA]) goto bad;
+
+    if (addr == 0 || addr % PGSIZE != 0 || addr < PGROUNDUP(mm->sz) ||
+        addr + len > USERTOP || vmaoverlap(p, addr, addr + len)) {
+        if ((addr = vmaplace(p, len)) == 0) goto bad;
+    }
+
+    acquire(&mm->lock);
+    if ((flags & MAP_ANONYMOUS) && type == MAP_SHARED) {
+        for (uint64 a = addr; a < addr + len; a += PGSIZE) {
+            char *mem = kalloc_zeroed();
+            if (mem == 0 || mappages(p->pagetable, a, PGSIZE, (uint64)mem,
+                                     perm | PTE_U) != 0) {
+                if (mem) kfree(mem);
+                uvmunmap(p->pagetable, addr, (a - addr) / PGSIZE, 1);
+                release(&mm->lock);
+                goto bad;
+            }
+        }
+        asidflush(mm, addr, len / PGSIZE);
+    }
+
+    v->start = addr;
+    v->end = addr + len;
+    v->perm = perm;
+    v->flags = flags;
+    if ((flags & MAP_ANONYMOUS) == 0) {
+        v->ip = f->ip;
+        v->off = off;
+    }
+    if (flags & MAP_STACK) v->guard = off / PGSIZE;
+    if (vmaget(v) < 0) {
+        memset(v, 0, sizeof(*v));
+        release(&mm->lock);
+        goto bad;
+    }
+    release(&mm->lock);
+    releasesleep(&mm->maplock);
+    return addr;
+
+bad:
+    releasesleep(&mm->maplock);
+    return -1;
+}
+
+// Unmap the pages of the current process's mmap() areas in
+// [addr, addr+len). An area can lose its start, its end, or
+// the whole of it; unmapping the middle splits it in two.
+// Returns 0 on success, -1 on a bad range or if a split
+// needs a free slot and there is none.
+int vmamunmap(uint64 addr, uint64 len) {
+    struct proc *p = myproc();
+    struct mm *mm = p->mm;
+    struct vma *v, *nv;
+    uint64 end;
+    int r = 0;
+
+    if (addr % PGSIZE != 0 || len == 0 || len >= USERTOP) return -1;
+    end = PGROUNDUP(addr + len);
+    if (end > USERTOP) return -1;
+
+    acquiresleep(&mm->maplock);
+    for (v = mm->vma; v < &mm->vma[NVMA]; v++) {
+        if (v->flags == 0 || end <= v->start || v->end <= addr) continue;
+        uint64 s = max(addr, v->start);
+        uint64 e = min(end, v->end);
+        struct vma old;
+
+        old.ip = 0;
+        nv = 0;
+        if (v->start < s && e < v->end) {
+            for (nv = mm->vma; nv < &mm->vma[NVMA]; nv++)
+                if (nv->end == 0) break;
+            if (nv == &mm->vma[NVMA]) {
+                r = -1;
+                break;
+            }
+        }
+        vmasync(p, v, s, e);
+
+        acquire(&mm->lock);
+        if (nv) {
+            *nv = *v;
+            nv->start = e;
+            nv->off += e - v->start;
+            vmaget(nv);
+            v->end = s;
+        } else if (s == v->start && e == v->end) {
+            old = *v;
+            memset(v, 0, sizeof(*v));
+        } else if (s == v->start) {
+            v->off += e - v->start;
+            v->start = e;
+        } else {
+            v->end = s;
+        }
+        uvmunmap(p->pagetable, s, (e - s) / PGSIZE, 1);
+        release(&mm->lock);
+        vmaput(&old);
+    }
+    releasesleep(&mm->maplock);
+    return r;
+}
@@ -0,0 +1,125 @@
+//
+// barrier benchmark, after notxv6/barrier.c.
+//
+// nthread threads go through NROUND rounds of a barrier,
+// each doing a little random work between rounds, and check
+// that nobody gets ahead. Run it once with the futex-based
+// pthread_barrier_wait() and once with notxv6's barrier,
+// built from a mutex and a condition variable, and report
+// rounds per tick and the kernel's futex counters.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/pthread.h"
+
+#define NROUND 2000
+
+static int nthread = 2;
+
+static pthread_barrier_t fbarrier;
+
+// notxv6/barrier.c's barrier.
+static struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int nthread;  // threads that have reached this round
+    int round;    // barrier round
+} bstate;
+
+static void condbarrier() {
+    pthread_mutex_lock(&bstate.mutex);
+    bstate.nthread++;
+    if (bstate.nthread == nthread) {
+        bstate.round++;
+        bstate.nthread = 0;
+        pthread_cond_broadcast(&bstate.cond);
+    } else {
+        // a wakeup may be spurious, or from an earlier round.
+        int round = bstate.round;
+        while (bstate.round == round)
+            pthread_cond_wait(&bstate.cond, &bstate.mutex);
+    }
+    pthread_mutex_unlock(&bstate.mutex);
+}
+
+// a little work between rounds, in place of usleep(random() % 100).
+static void work(uint *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    for (volatile int i = 0; i < (*seed >> 16) % 100; i++)
+        ;
+}
+
+static volatile int usecond;  // which barrier to use
+
+static void *thread(void *arg) {
+    uint seed = 1 + (uint64)arg;
+
+    for (int i = 0; i < NROUND; i++) {
+        int round = usecond ? bstate.round : fbarrier.round;
+        if (round != i) {
+            printf("barrier: round %d, expected %d\n", round, i);
+            exit(1);
+        }
+        if (usecond)
+            condbarrier();
+        else
+            pthread_barrier_wait(&fbarrier);
+        work(&seed);
+    }
+    return 0;
+}
+
+static void printfutex() {
+    char buf[256];
+    int fd, n;
+
+    if ((fd = open("statistics", O_RDWR)) < 0) return;
+    write(fd, "futex", 5);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) write(1, buf, n);
+    close(fd);
+}
+
+static void run(char *name, int cond) {
+    pthread_t tha[NTHREAD];
+
+    usecond = cond;
+    pthread_barrier_init(&fbarrier, nthread);
+    pthread_mutex_init(&bstate.mutex);
+    pthread_cond_init(&bstate.cond);
+    bstate.nthread = 0;
+    bstate.round = 0;
+
+    int t0 = uptime();
+    for (int i = 0; i < nthread; i++) {
+        if (pthread_create(&tha[i], thread, (void *)(uint64)i) < 0) {
+            printf("barrier: pthread_create failed\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < nthread; i++) {
+        if (pthread_join(tha[i], 0) < 0) {
+            printf("barrier: pthread_join failed\n");
+            exit(1);
+        }
+    }
+    int t = uptime() - t0;
+    if (t == 0) t = 1;
+    printf("%s: %d threads, %d rounds in %d ticks, %d rounds/tick\n", name,
+           nthread, NROUND, t, NROUND / t);
+    printfutex();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) nthread = atoi(argv[1]);
+    if (nthread < 1 || nthread >= NTHREAD) {
+        printf("usage: barrier [nthread], with 0 < nthread < %d\n", NTHREAD);
+        exit(1);
+    }
+    run("futex barrier", 0);
+    run("mutex and condvar barrier", 1);
+    printf("OK; passed\n");
+    exit(0);
+}
@@ -8,6 +8,7 @@
 
 void test0();
 void test1();
+void bstats(void);
 
 #define SZ 4096
 char buf[SZ];
@@ -174,5 +175,24 @@ void test1() {
     for (int i = 0; i < NCHILD; i++) {
         wait(0);
     }
+    bstats();
     printf("test1 OK\n");
 }
+
+// print the bcache report: hits, misses and evictions.
+void bstats(void) {
+    int fd, n;
+
+    if ((fd = open("statistics", O_WRONLY)) < 0) {
+        fprintf(2, "bstats: no stats\n");
+        return;
+    }
+    n = write(fd, "bcache", 6);
+    close(fd);
+    if (n != 6) {
+        fprintf(2, "bstats: no bcache report\n");
+        return;
+    }
+    n = statistics(buf, SZ);
+    write(1, buf, n);
+}
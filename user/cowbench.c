@@ -0,0 +1,89 @@
+//
+// fork and copy-on-write fault benchmark.
+//
+// For 1, 2, 4 and 8 workers, each worker repeatedly forks
+// a child that writes to every page of a shared region,
+// taking one copy-on-write fault per page, and waits for it.
+// Prints forks and faults per tick for each worker count;
+// on a kernel that scales, these grow with the worker count
+// up to the number of harts.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+
+#define NPAGES 64  // pages each child writes
+#define NFORK 100  // forks per worker
+#define MAXWORKER 8
+
+char *region;
+
+void worker(int go) {
+    char c;
+
+    // wait until all workers exist.
+    if (read(go, &c, 1) != 0) {
+        printf("cowbench: barrier\n");
+        exit(-1);
+    }
+    for (int i = 0; i < NFORK; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("cowbench: fork failed\n");
+            exit(-1);
+        }
+        if (pid == 0) {
+            for (int j = 0; j < NPAGES; j++) region[j * PGSIZE] = i;
+            exit(0);
+        }
+        wait(0);
+    }
+    exit(0);
+}
+
+void run(int nworker) {
+    int fds[2];
+
+    if (pipe(fds) < 0) {
+        printf("cowbench: pipe failed\n");
+        exit(-1);
+    }
+    for (int i = 0; i < nworker; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("cowbench: fork failed\n");
+            exit(-1);
+        }
+        if (pid == 0) {
+            close(fds[1]);
+            worker(fds[0]);
+        }
+    }
+
+    // start everyone at once by closing the write end.
+    close(fds[0]);
+    int t0 = uptime();
+    close(fds[1]);
+    for (int i = 0; i < nworker; i++) wait(0);
+    int t = uptime() - t0;
+    if (t == 0) t = 1;
+
+    int nfork = nworker * NFORK;
+    printf("workers %d: %d forks, %d faults in %d ticks, %d forks/tick, "
+           "%d faults/tick\n",
+           nworker, nfork, nfork * NPAGES, t, nfork / t, nfork * NPAGES / t);
+}
+
+int main(int argc, char *argv[]) {
+    region = sbrk(NPAGES * PGSIZE);
+    if (region == (char *)-1) {
+        printf("cowbench: sbrk failed\n");
+        exit(-1);
+    }
+    // touch the region so that every fork shares real pages.
+    for (int j = 0; j < NPAGES; j++) region[j * PGSIZE] = 1;
+
+    for (int n = 1; n <= MAXWORKER; n *= 2) run(n);
+    exit(0);
+}
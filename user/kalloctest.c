@@ -13,6 +13,7 @@
 void test1(void);
 void test2(void);
 void test3(void);
+void kstats(void);
 char buf[SZ];
 
 int main(int argc, char *argv[]) {
@@ -35,6 +36,25 @@ int ntas(int print) {
     return n;
 }
 
+// print the kalloc report: per-CPU free pages,
+// steals and returns to the buddy allocator.
+void kstats(void) {
+    int fd, n;
+
+    if ((fd = open("statistics", O_WRONLY)) < 0) {
+        fprintf(2, "kstats: no stats\n");
+        return;
+    }
+    n = write(fd, "kalloc", 6);
+    close(fd);
+    if (n != 6) {
+        fprintf(2, "kstats: no kalloc report\n");
+        return;
+    }
+    n = statistics(buf, SZ);
+    write(1, buf, n);
+}
+
 // Test concurrent kallocs and kfrees
 void test1(void) {
     void *a, *a1;
@@ -66,6 +86,7 @@ void test1(void) {
     }
     printf("test1 results:\n");
     n = ntas(1);
+    kstats();
     if (n - m < 10)
         printf("test1 OK\n");
     else
@@ -148,5 +169,6 @@ void test3(void) {
     for (int i = 0; i < NCHILD; i++) {
         wait(0);
     }
+    kstats();
     printf("test3 OK\n");
 }
@@ -0,0 +1,204 @@
+//
+// tests for lazy sbrk().
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+void sinfo(struct sysinfo *info) {
+    if (sysinfo(info) < 0) {
+        printf("sysinfo failed\n");
+        exit(-1);
+    }
+}
+
+// reserve a big heap but touch only a few pages of it.
+// only those pages should be faulted in, each with at most
+// a level-0 page table, plus one level-1 page table.
+void sparsetest() {
+    struct sysinfo before, after;
+    int sz = 64 * 1024 * 1024;
+
+    printf("sparse: ");
+
+    sinfo(&before);
+    char *p = sbrk(sz);
+    if (p == (char *)0xffffffffffffffffL) {
+        printf("sbrk(%d) failed\n", sz);
+        exit(-1);
+    }
+    for (int i = 0; i < 10; i++) p[i * (sz / 10)] = i;
+    sinfo(&after);
+
+    if (after.nfault - before.nfault != 10) {
+        printf("%d faults instead of 10\n", (int)(after.nfault - before.nfault));
+        exit(-1);
+    }
+    if (before.freemem - after.freemem > (10 + 10 + 1) * PGSIZE) {
+        printf("%d bytes allocated for 10 pages\n",
+               (int)(before.freemem - after.freemem));
+        exit(-1);
+    }
+    for (int i = 0; i < 10; i++) {
+        if (p[i * (sz / 10)] != i) {
+            printf("wrong content\n");
+            exit(-1);
+        }
+    }
+
+    if (sbrk(-sz) == (char *)0xffffffffffffffffL) {
+        printf("sbrk(-%d) failed\n", sz);
+        exit(-1);
+    }
+    printf("ok\n");
+}
+
+// touching every page of an aligned 2 MiB of heap turns it
+// into a superpage, which must keep what was written.
+void densetest() {
+    int sz = 2 * SUPERPGSIZE;
+
+    printf("dense: ");
+
+    char *p = sbrk(sz);
+    if (p == (char *)0xffffffffffffffffL) {
+        printf("sbrk(%d) failed\n", sz);
+        exit(-1);
+    }
+    for (int i = 0; i < sz / PGSIZE; i++) p[i * PGSIZE] = i;
+    for (int i = 0; i < sz / PGSIZE; i++) {
+        if (p[i * PGSIZE] != (char)i) {
+            printf("wrong content at page %d\n", i);
+            exit(-1);
+        }
+    }
+    if (sbrk(-sz) == (char *)0xffffffffffffffffL) {
+        printf("sbrk(-%d) failed\n", sz);
+        exit(-1);
+    }
+    printf("ok\n");
+}
+
+// system calls must fault in lazy pages that they
+// read from or write to.
+void syscalltest() {
+    int fds[2];
+
+    printf("syscall: ");
+
+    char *p = sbrk(2 * PGSIZE);
+    if (p == (char *)0xffffffffffffffffL) {
+        printf("sbrk failed\n");
+        exit(-1);
+    }
+    if (pipe(fds) < 0) {
+        printf("pipe failed\n");
+        exit(-1);
+    }
+    // copyin() from an untouched page.
+    if (write(fds[1], p, 100) != 100) {
+        printf("write from lazy page failed\n");
+        exit(-1);
+    }
+    // copyout() to an untouched page.
+    if (read(fds[0], p + PGSIZE, 100) != 100) {
+        printf("read into lazy page failed\n");
+        exit(-1);
+    }
+    for (int i = 0; i < 100; i++) {
+        if (p[PGSIZE + i] != 0) {
+            printf("wrong content\n");
+            exit(-1);
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    sbrk(-2 * PGSIZE);
+    printf("ok\n");
+}
+
+// fork a process whose heap has holes in it.
+void forktest() {
+    int n = 16;
+
+    printf("fork: ");
+
+    char *p = sbrk(n * PGSIZE);
+    if (p == (char *)0xffffffffffffffffL) {
+        printf("sbrk failed\n");
+        exit(-1);
+    }
+    for (int i = 1; i < n; i += 2) p[i * PGSIZE] = i;
+
+    int pid = fork();
+    if (pid < 0) {
+        printf("fork failed\n");
+        exit(-1);
+    }
+    if (pid == 0) {
+        for (int i = 0; i < n; i++) {
+            if (p[i * PGSIZE] != (i % 2 ? i : 0)) {
+                printf("wrong content in child\n");
+                exit(-1);
+            }
+        }
+        exit(0);
+    }
+
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0) exit(-1);
+    sbrk(-n * PGSIZE);
+    printf("ok\n");
+}
+
+// exec() reads program pages on demand; run a program
+// a few times over, with several copies alive at once.
+void exectest() {
+    char *argv[] = {"echo", 0};
+    int n = 4;
+
+    printf("exec: ");
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) {
+            printf("fork failed\n");
+            exit(-1);
+        }
+        if (pid == 0) {
+            exec("echo", argv);
+            printf("exec failed\n");
+            exit(-1);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        int xstatus;
+        wait(&xstatus);
+        if (xstatus != 0) exit(-1);
+    }
+    printf("ok\n");
+}
+
+// a heap that memory could not back must be refused.
+void oomtest() {
+    printf("oom: ");
+    if (sbrk(PHYSTOP - KERNBASE) != (char *)0xffffffffffffffffL) {
+        printf("sbrk of all memory succeeded\n");
+        exit(-1);
+    }
+    printf("ok\n");
+}
+
+int main(int argc, char *argv[]) {
+    sparsetest();
+    densetest();
+    syscalltest();
+    forktest();
+    exectest();
+    oomtest();
+    printf("ALL LAZY TESTS PASSED\n");
+    exit(0);
+}
@@ -0,0 +1,307 @@
+//
+// tests for mmap() and munmap().
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "kernel/sysinfo.h"
+#include "user/user.h"
+
+#define MAP_FAILED ((char *)-1)
+
+char *testname = "???";
+
+void err(char *why) {
+    printf("mmaptest: %s failed: %s, pid=%d\n", testname, why, getpid());
+    exit(1);
+}
+
+// create a file of 2.5 pages: each byte holds its offset
+// modulo 256, except that the last half page is zero.
+void makefile(const char *f) {
+    char buf[PGSIZE / 2];
+    int fd;
+
+    unlink(f);
+    if ((fd = open(f, O_WRONLY | O_CREATE)) < 0) err("open");
+    for (int i = 0; i < 5; i++) {
+        for (int j = 0; j < sizeof(buf); j++)
+            buf[j] = i < 4 ? (i * sizeof(buf) + j) : 0;
+        if (write(fd, buf, sizeof(buf)) != sizeof(buf)) err("write");
+    }
+    if (close(fd) < 0) err("close");
+}
+
+// check that p holds the content makefile() wrote, and zeros
+// after the end of the file up to the end of the page.
+void checkfile(char *p) {
+    for (int i = 0; i < 3 * PGSIZE; i++) {
+        char want = i < 2 * PGSIZE ? i : 0;
+        if (p[i] != want) err("wrong content");
+    }
+}
+
+// MAP_PRIVATE: stores go to a private copy, not to the file.
+void privatetest() {
+    char *f = "mmap.private";
+    int fd;
+
+    testname = "private";
+    printf("%s: ", testname);
+    makefile(f);
+    if ((fd = open(f, O_RDONLY)) < 0) err("open");
+    char *p = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) err("mmap");
+    close(fd);  // the mapping keeps the file
+
+    checkfile(p);
+    for (int i = 0; i < PGSIZE; i++) p[i] = 'Z';
+    if (munmap(p, 3 * PGSIZE) < 0) err("munmap");
+
+    if ((fd = open(f, O_RDONLY)) < 0) err("open");
+    p = mmap(0, 3 * PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) err("mmap");
+    close(fd);
+    checkfile(p);
+    if (munmap(p, 3 * PGSIZE) < 0) err("munmap");
+    unlink(f);
+    printf("ok\n");
+}
+
+// MAP_SHARED: stores reach the file when the area is unmapped.
+void sharedtest() {
+    char *f = "mmap.shared";
+    char buf[PGSIZE];
+    int fd;
+
+    testname = "shared";
+    printf("%s: ", testname);
+    makefile(f);
+    if ((fd = open(f, O_RDWR)) < 0) err("open");
+
+    // a read-only file can't be mapped shared and writable.
+    int rfd = open(f, O_RDONLY);
+    if (mmap(0, PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, rfd, 0) !=
+        MAP_FAILED)
+        err("writable mapping of a read-only file");
+    close(rfd);
+
+    char *p = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) err("mmap");
+    checkfile(p);
+    for (int i = 0; i < PGSIZE; i++) p[PGSIZE + i] = 'Z';
+    // a second mapping of the file sees the stores at once.
+    char *q = mmap(0, 3 * PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (q == MAP_FAILED) err("second mmap");
+    if (q[PGSIZE] != 'Z' || q[2 * PGSIZE - 1] != 'Z') err("second mapping");
+    // unmap in pieces.
+    if (munmap(q, 3 * PGSIZE) < 0) err("munmap");
+    if (munmap(p, PGSIZE) < 0) err("munmap start");
+    if (munmap(p + PGSIZE, 2 * PGSIZE) < 0) err("munmap rest");
+    close(fd);
+
+    if ((fd = open(f, O_RDONLY)) < 0) err("open");
+    if (read(fd, buf, PGSIZE) != PGSIZE) err("read");
+    for (int i = 0; i < PGSIZE; i++)
+        if (buf[i] != (char)i) err("first page changed");
+    if (read(fd, buf, PGSIZE) != PGSIZE) err("read");
+    for (int i = 0; i < PGSIZE; i++)
+        if (buf[i] != 'Z') err("store not written back");
+    // the file didn't grow to the end of the last page.
+    if (read(fd, buf, PGSIZE) != PGSIZE / 2) err("file size changed");
+    close(fd);
+    unlink(f);
+    printf("ok\n");
+}
+
+// truncating a file unmaps the old pages from MAP_SHARED
+// areas: they see the file's new content, and stores made
+// before the truncation are not written back over it.
+void trunctest() {
+    char *f = "mmap.trunc";
+    char buf[PGSIZE];
+    int fd;
+
+    testname = "trunc";
+    printf("%s: ", testname);
+    makefile(f);
+    if ((fd = open(f, O_RDWR)) < 0) err("open");
+    char *p = mmap(0, 2 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) err("mmap");
+    close(fd);
+    for (int i = 0; i < 2 * PGSIZE; i++) p[i] = 'Z';
+
+    if ((fd = open(f, O_RDWR | O_TRUNC)) < 0) err("open O_TRUNC");
+    if (write(fd, "new", 3) != 3) err("write");
+    close(fd);
+    if (p[0] != 'n' || p[1] != 'e' || p[2] != 'w' || p[3] != 0)
+        err("mapping kept the old content");
+    if (p[PGSIZE] != 0) err("mapping kept an old page past the end");
+    if (munmap(p, 2 * PGSIZE) < 0) err("munmap");
+
+    if ((fd = open(f, O_RDONLY)) < 0) err("open");
+    if (read(fd, buf, PGSIZE) != 3 || memcmp(buf, "new", 3) != 0)
+        err("old stores written back");
+    close(fd);
+    unlink(f);
+    printf("ok\n");
+}
+
+// a read-only mapping must not be writable, even by read().
+void readonlytest() {
+    char *f = "mmap.ro";
+    int fd;
+
+    testname = "readonly";
+    printf("%s: ", testname);
+    makefile(f);
+    if ((fd = open(f, O_RDONLY)) < 0) err("open");
+    char *p = mmap(0, PGSIZE, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) err("mmap");
+    if (read(fd, p, 10) != -1) err("read() into a read-only mapping");
+
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        p[0] = 1;
+        exit(0);  // should have been killed
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != -1) err("store to a read-only mapping");
+    munmap(p, PGSIZE);
+    close(fd);
+    unlink(f);
+    printf("ok\n");
+}
+
+// a running program can't be written, nor can a file that
+// is open for writing be run.
+void texttest(char *prog) {
+    char *f = "mmap.text";
+    char buf[512];
+    int fd, fd1, n;
+
+    testname = "text";
+    printf("%s: ", testname);
+    if (open(prog, O_WRONLY) >= 0) err("opened a running program to write");
+    if (open(prog, O_RDONLY | O_TRUNC) >= 0) err("truncated a running program");
+    if ((fd = open(prog, O_RDONLY)) < 0) err("open");
+
+    // copy the program and try to run the copy.
+    if ((fd1 = open(f, O_CREATE | O_WRONLY)) < 0) err("create");
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        if (write(fd1, buf, n) != n) err("write");
+    close(fd);
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        char *argv[] = {f, "text", 0};
+        exec(f, argv);
+        exit(0);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0) err("ran a program open for writing");
+    close(fd1);
+    unlink(f);
+    printf("ok\n");
+}
+
+// anonymous memory; shared areas are shared with children,
+// private ones are copied.
+void anontest() {
+    int n = 8;
+
+    testname = "anonymous";
+    printf("%s: ", testname);
+    char *shared = mmap(0, n * PGSIZE, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    char *private = mmap(0, n * PGSIZE, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED || private == MAP_FAILED) err("mmap");
+    for (int i = 0; i < n * PGSIZE; i += PGSIZE) {
+        if (shared[i] != 0 || private[i] != 0) err("not zero");
+    }
+    private[0] = 1;
+
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        if (private[0] != 1) err("private area not copied");
+        for (int i = 0; i < n; i++) {
+            shared[i * PGSIZE] = i + 1;
+            private[i * PGSIZE] = i + 1;
+        }
+        exit(0);
+    }
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0) exit(1);
+    for (int i = 0; i < n; i++) {
+        if (shared[i * PGSIZE] != i + 1) err("child's store not shared");
+        if (private[i * PGSIZE] != (i == 0)) err("child's store leaked");
+    }
+
+    // unmap the middle of an area, leaving two.
+    if (munmap(private + 2 * PGSIZE, 2 * PGSIZE) < 0) err("munmap middle");
+    if (private[PGSIZE] != 0 || private[4 * PGSIZE] != 0) err("split");
+    if (munmap(shared, n * PGSIZE) < 0 || munmap(private, n * PGSIZE) < 0)
+        err("munmap");
+    printf("ok\n");
+}
+
+// mapping and unmapping must not leak memory.
+void leaktest() {
+    char *f = "mmap.leak";
+    struct sysinfo before, after;
+    int fd;
+
+    testname = "leak";
+    printf("%s: ", testname);
+    if (sysinfo(&before) < 0) err("sysinfo");
+    makefile(f);
+    for (int i = 0; i < 100; i++) {
+        if ((fd = open(f, O_RDWR)) < 0) err("open");
+        char *p = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        char *q = mmap(0, 3 * PGSIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        char *a = mmap(0, 64 * PGSIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED || q == MAP_FAILED || a == MAP_FAILED)
+            err("mmap");
+        close(fd);
+        for (int j = 0; j < 64; j++) a[j * PGSIZE] = j;
+        q[0] = p[0];
+        // leave them mapped in the child and let exit() clean up.
+        int pid = fork();
+        if (pid < 0) err("fork");
+        if (pid == 0) {
+            p[1] = q[1];
+            exit(0);
+        }
+        wait(0);
+        munmap(p, 3 * PGSIZE);
+        munmap(q, 3 * PGSIZE);
+        munmap(a, 64 * PGSIZE);
+    }
+    unlink(f);
+    if (sysinfo(&after) < 0) err("sysinfo");
+    // allow for a few pages held by kernel caches.
+    if (after.freemem + 16 * PGSIZE < before.freemem) err("lost memory");
+    printf("ok\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 1) exit(1);  // texttest() managed to run it
+    privatetest();
+    sharedtest();
+    trunctest();
+    readonlytest();
+    texttest(argv[0]);
+    anontest();
+    leaktest();
+    printf("ALL MMAP TESTS PASSED\n");
+    exit(0);
+}
@@ -0,0 +1,105 @@
+//
+// path lookup benchmark: 1, 2, 4 and 8 processes open and
+// stat files deep in the same directory tree at once, so
+// that every lookup walks the same directories. Prints the
+// time per lookup, and the dentry cache's report.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NFILE 8
+#define NLOOKUP 2000
+#define CYCLES_PER_US 10  // qemu's time CSR runs at 10MHz
+
+static inline uint64 rdtime() {
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+void err(char *why) {
+    printf("namebench: %s failed\n", why);
+    exit(1);
+}
+
+char path[] = "/nb/d1/d2/d3/f0";
+
+void mktree(void) {
+    int fd;
+
+    mkdir("/nb");
+    mkdir("/nb/d1");
+    mkdir("/nb/d1/d2");
+    mkdir("/nb/d1/d2/d3");
+    for (int i = 0; i < NFILE; i++) {
+        path[sizeof(path) - 2] = '0' + i;
+        if ((fd = open(path, O_CREATE | O_RDWR)) < 0) err("create");
+        close(fd);
+    }
+}
+
+void rmtree(void) {
+    for (int i = 0; i < NFILE; i++) {
+        path[sizeof(path) - 2] = '0' + i;
+        unlink(path);
+    }
+    unlink("/nb/d1/d2/d3");
+    unlink("/nb/d1/d2");
+    unlink("/nb/d1");
+    unlink("/nb");
+}
+
+// open and stat file i of the tree, NLOOKUP times each.
+void lookups(int i) {
+    struct stat st;
+    int fd;
+
+    path[sizeof(path) - 2] = '0' + i % NFILE;
+    for (int j = 0; j < NLOOKUP; j++) {
+        if ((fd = open(path, O_RDONLY)) < 0) err("open");
+        close(fd);
+        if (stat(path, &st) < 0) err("stat");
+    }
+}
+
+void run(int n) {
+    uint64 t0 = rdtime();
+
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) err("fork");
+        if (pid == 0) {
+            lookups(i);
+            exit(0);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        int xstatus;
+        if (wait(&xstatus) < 0 || xstatus != 0) err("lookups");
+    }
+    uint64 t = rdtime() - t0;
+    printf("%d processes: %d ms, %d ns per lookup\n", n,
+           (int)(t / CYCLES_PER_US / 1000),
+           (int)(t * 100 / (2 * NLOOKUP * (uint64)n)));
+}
+
+void report(void) {
+    char buf[512];
+    int fd, n;
+
+    if ((fd = open("statistics", O_RDWR)) < 0) return;
+    write(fd, "dcache", 6);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) write(1, buf, n);
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    mktree();
+    for (int n = 1; n <= 8; n *= 2) run(n);
+    report();
+    rmtree();
+    exit(0);
+}
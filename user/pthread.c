@@ -0,0 +1,214 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "user/user.h"
+#include "user/pthread.h"
+
+#define MAP_FAILED ((char *)-1)
+
+// Stacks come from MAP_STACK areas of NSTACKAREA stacks
+// each, which put a guard page below every stack, and go
+// back to a free list for their size when freed.
+#define NSTACKAREA 16
+#define NSTACKSIZE 4  // different stack sizes in use
+
+static struct {
+    pthread_mutex_t lock;
+    struct stackpool {
+        int size;    // bytes per stack, without the guard page
+        char *free;  // freed stacks, linked through their first word
+        char *next;  // unused part of the newest area
+        char *end;
+    } pool[NSTACKSIZE];
+} stacks = {PTHREAD_MUTEX_INITIALIZER};
+
+// Return the lowest address of a new stack of size bytes,
+// or 0 if there is no memory for it.
+void *stackalloc(int size) {
+    struct stackpool *sp;
+    char *s = 0;
+
+    size = PGROUNDUP(size);
+    pthread_mutex_lock(&stacks.lock);
+    for (sp = stacks.pool; sp < &stacks.pool[NSTACKSIZE]; sp++)
+        if (sp->size == size || sp->size == 0) break;
+    if (sp == &stacks.pool[NSTACKSIZE]) goto out;
+    sp->size = size;
+    if (sp->free) {
+        s = sp->free;
+        sp->free = *(char **)s;
+        goto out;
+    }
+    if (sp->next == sp->end) {
+        int n = NSTACKAREA * (size + PGSIZE);
+        char *a = mmap(0, n, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1,
+                       size + PGSIZE);
+        if (a == MAP_FAILED) goto out;
+        sp->next = a;
+        sp->end = a + n;
+    }
+    s = sp->next + PGSIZE;
+    sp->next += size + PGSIZE;
+out:
+    pthread_mutex_unlock(&stacks.lock);
+    return s;
+}
+
+// Give back a stack from stackalloc(size).
+void stackfree(void *s, int size) {
+    struct stackpool *sp;
+
+    size = PGROUNDUP(size);
+    pthread_mutex_lock(&stacks.lock);
+    for (sp = stacks.pool; sp->size != size; sp++)
+        ;
+    *(char **)s = sp->free;
+    sp->free = s;
+    pthread_mutex_unlock(&stacks.lock);
+}
+
+// every thread starts here, on its new stack.
+static void pthread_start(void *arg) {
+    pthread_t t = arg;
+
+    asm volatile("mv tp, %0" : : "r"(t));
+    pthread_exit(t->fn(t->arg));
+}
+
+// Start a thread running fn(arg). Returns 0, or -1 if there
+// is no memory for its stack or no room for another thread.
+int pthread_create(pthread_t *tp, void *(*fn)(void *), void *arg) {
+    char *stack = stackalloc(PTHREAD_STACK);
+    if (stack == 0) return -1;
+
+    pthread_t t = (pthread_t)stack;
+    t->fn = fn;
+    t->arg = arg;
+    t->retval = 0;
+    if ((t->tid = clone(pthread_start, t, stack + PTHREAD_STACK)) < 0) {
+        stackfree(stack, PTHREAD_STACK);
+        return -1;
+    }
+    *tp = t;
+    return 0;
+}
+
+// Wait for t to finish and free its stack. Only the thread
+// that created t can join it.
+int pthread_join(pthread_t t, void **retval) {
+    if (join(t->tid, 0) < 0) return -1;
+    if (retval) *retval = t->retval;
+    stackfree(t, PTHREAD_STACK);
+    return 0;
+}
+
+// End the calling thread. In the first thread, which has no
+// struct pthread, this ends the process.
+void pthread_exit(void *retval) {
+    pthread_t t = pthread_self();
+
+    if (t == 0) exit(0);
+    t->retval = retval;
+    exitthread(0);
+}
+
+// exec() clears tp, so it is 0 in the first thread.
+pthread_t pthread_self(void) {
+    pthread_t t;
+
+    asm volatile("mv %0, tp" : "=r"(t));
+    return t;
+}
+
+// Mutexes, after Drepper's "Futexes Are Tricky": locking an
+// unlocked mutex, and unlocking one that nobody waits for,
+// are a single atomic instruction with no system call.
+
+void pthread_mutex_init(pthread_mutex_t *m) { m->state = 0; }
+
+void pthread_mutex_lock(pthread_mutex_t *m) {
+    int c = 0;
+
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED))
+        return;
+    // mark it contended, so that its holder wakes a waiter.
+    if (c != 2) c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    while (c != 0) {
+        futex_wait(&m->state, 2, 0);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+// Returns 0 if it took m, -1 if m was locked.
+int pthread_mutex_trylock(pthread_mutex_t *m) {
+    int c = 0;
+
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED))
+        return 0;
+    return -1;
+}
+
+void pthread_mutex_unlock(pthread_mutex_t *m) {
+    if (__atomic_fetch_sub(&m->state, 1, __ATOMIC_RELEASE) != 1) {
+        __atomic_store_n(&m->state, 0, __ATOMIC_RELEASE);
+        futex_wake(&m->state, 1);
+    }
+}
+
+// Condition variables. A waiter sleeps until seq moves on
+// from the value it saw while it held the mutex, so a signal
+// sent after it let go of the mutex isn't lost. Like POSIX's,
+// pthread_cond_wait() may return without a signal.
+
+void pthread_cond_init(pthread_cond_t *c) { c->seq = 0; }
+
+void pthread_cond_wait(pthread_cond_t *c, pthread_mutex_t *m) {
+    int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+    pthread_mutex_unlock(m);
+    futex_wait(&c->seq, seq, 0);
+    // other waiters may have woken too: take m as contended.
+    while (__atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE) != 0)
+        futex_wait(&m->state, 2, 0);
+}
+
+void pthread_cond_signal(pthread_cond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 1);
+}
+
+void pthread_cond_broadcast(pthread_cond_t *c) {
+    __atomic_fetch_add(&c->seq, 1, __ATOMIC_RELEASE);
+    futex_wake(&c->seq, 0x7fffffff);
+}
+
+// Barriers. The last of n threads to arrive starts the next
+// round and wakes the others, which sleep on the round
+// number. Returns PTHREAD_BARRIER_SERIAL_THREAD in the last
+// thread and 0 in the others.
+
+void pthread_barrier_init(pthread_barrier_t *b, int n) {
+    pthread_mutex_init(&b->lock);
+    b->n = n;
+    b->count = 0;
+    b->round = 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *b) {
+    pthread_mutex_lock(&b->lock);
+    int round = b->round;
+    if (++b->count == b->n) {
+        b->count = 0;
+        __atomic_store_n(&b->round, round + 1, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&b->lock);
+        futex_wake(&b->round, 0x7fffffff);
+        return PTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    pthread_mutex_unlock(&b->lock);
+    while (__atomic_load_n(&b->round, __ATOMIC_ACQUIRE) == round)
+        futex_wait(&b->round, round, 0);
+    return 0;
+}
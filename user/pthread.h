@@ -0,0 +1,58 @@
+// POSIX-style threads on top of clone() and join(), and
+// locks on top of futex_wait() and futex_wake().
+//
+// Each thread runs on its own PTHREAD_STACK bytes from
+// stackalloc(), above a guard page, with its struct pthread
+// at the bottom; the tp register points there. Threads share the address
+// space and the file descriptors; malloc() isn't safe to
+// call from more than one thread at a time.
+
+#define PTHREAD_STACK (64 * 1024)
+
+struct pthread {
+    int tid;
+    void *(*fn)(void *);
+    void *arg;
+    void *retval;
+};
+
+typedef struct pthread *pthread_t;
+
+int pthread_create(pthread_t *, void *(*)(void *), void *);
+int pthread_join(pthread_t, void **);
+void pthread_exit(void *) __attribute__((noreturn));
+pthread_t pthread_self(void);
+
+// 0: unlocked, 1: locked, 2: locked and maybe waited for.
+typedef struct {
+    int state;
+} pthread_mutex_t;
+
+typedef struct {
+    int seq;  // bumped by every signal and broadcast
+} pthread_cond_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    int n;      // threads to wait for
+    int count;  // threads that have arrived this round
+    int round;  // rounds completed
+} pthread_barrier_t;
+
+#define PTHREAD_MUTEX_INITIALIZER {0}
+#define PTHREAD_COND_INITIALIZER {0}
+#define PTHREAD_BARRIER_SERIAL_THREAD 1
+
+void pthread_mutex_init(pthread_mutex_t *);
+void pthread_mutex_lock(pthread_mutex_t *);
+int pthread_mutex_trylock(pthread_mutex_t *);
+void pthread_mutex_unlock(pthread_mutex_t *);
+void pthread_cond_init(pthread_cond_t *);
+void pthread_cond_wait(pthread_cond_t *, pthread_mutex_t *);
+void pthread_cond_signal(pthread_cond_t *);
+void pthread_cond_broadcast(pthread_cond_t *);
+void pthread_barrier_init(pthread_barrier_t *, int);
+int pthread_barrier_wait(pthread_barrier_t *);
+
+void *stackalloc(int);
+void stackfree(void *, int);
@@ -0,0 +1,67 @@
+//
+// benchmark of concurrent readers of read-mostly kernel
+// data: uptime() reads ticks, and stat() looks inodes up in
+// the inode table. 1, 2, 4 and 8 processes make NCALL calls
+// each, while the clock interrupt and the other processes'
+// stat()s of the same inodes write to the same data.
+//
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NCALL 20000
+#define NSTAT 2000
+#define CYCLES_PER_US 10  // qemu's time CSR runs at 10MHz
+
+static inline uint64 rdtime() {
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+void err(char *why) {
+    printf("readbench: %s failed\n", why);
+    exit(1);
+}
+
+void uptimes(void) {
+    for (int i = 0; i < NCALL; i++) uptime();
+}
+
+void stats(void) {
+    struct stat st;
+
+    for (int i = 0; i < NSTAT; i++) {
+        if (stat("/", &st) < 0 || stat("/README", &st) < 0) err("stat");
+    }
+}
+
+// run fn in n processes at once, and print the average time
+// of a call.
+void run(char *name, void (*fn)(void), int ncall, int n) {
+    uint64 t0 = rdtime();
+
+    for (int i = 0; i < n; i++) {
+        int pid = fork();
+        if (pid < 0) err("fork");
+        if (pid == 0) {
+            fn();
+            exit(0);
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        int xstatus;
+        if (wait(&xstatus) < 0 || xstatus != 0) err(name);
+    }
+    uint64 t = rdtime() - t0;
+    printf("%s, %d readers: %d ms, %d ns per call\n", name, n,
+           (int)(t / CYCLES_PER_US / 1000),
+           (int)(t * 100 / ((uint64)ncall * n)));
+}
+
+int main(int argc, char *argv[]) {
+    for (int n = 1; n <= 8; n *= 2) run("uptime", uptimes, NCALL, n);
+    for (int n = 1; n <= 8; n *= 2) run("stat", stats, 2 * NSTAT, n);
+    exit(0);
+}
@@ -0,0 +1,175 @@
+//
+// scheduler benchmark.
+//
+// Runs NHOG CPU-bound processes next to NPAIR pairs of
+// processes that pass a byte back and forth over pipes, all
+// for DURATION ticks. Reports
+// - the context-switch throughput of the pairs, in round
+//   trips (two sleeps and two wakeups each) per tick,
+// - how evenly the CPU was shared among the hogs: the
+//   smallest share as a percentage of the largest, and
+//   Jain's fairness index in percent (100 is perfectly fair),
+// - the kernel's per-CPU run queue counters.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NHOG 8
+#define NPAIR 8
+#define DURATION 50  // ticks
+
+struct result {
+    int hog;    // 1 for a CPU hog, 0 for a pair
+    int count;  // loop iterations or round trips
+};
+
+int results[2];  // pipe the workers report on
+
+void report(int hog, int count) {
+    struct result r = {hog, count};
+    if (write(results[1], &r, sizeof(r)) != sizeof(r)) exit(-1);
+    exit(0);
+}
+
+// wait for the parent to close the write end of go.
+void barrier(int go) {
+    char c;
+    if (read(go, &c, 1) != 0) {
+        printf("schedbench: barrier\n");
+        exit(-1);
+    }
+    close(go);
+}
+
+void hog(int go) {
+    int n = 0;
+
+    barrier(go);
+    int end = uptime() + DURATION;
+    for (;;) {
+        for (volatile int i = 0; i < 4096; i++)
+            ;
+        n++;
+        if (uptime() >= end) break;
+    }
+    report(1, n);
+}
+
+// one side of a pair: answer every byte from in on out;
+// the pinger sends first and counts the round trips.
+void pair(int go, int in, int out, int pinger) {
+    char c = 0;
+    int n = 0;
+
+    barrier(go);
+    int end = uptime() + DURATION;
+    while (!pinger || uptime() < end) {
+        if (pinger && write(out, &c, 1) != 1) break;
+        if (read(in, &c, 1) != 1) break;
+        if (!pinger && write(out, &c, 1) != 1) break;
+        n++;
+    }
+    close(out);  // stops the other side
+    if (pinger) report(0, n);
+    exit(0);
+}
+
+void spawn(int go[2], void (*fn)(int)) {
+    int pid = fork();
+    if (pid < 0) {
+        printf("schedbench: fork failed\n");
+        exit(-1);
+    }
+    if (pid == 0) {
+        close(go[1]);
+        close(results[0]);
+        fn(go[0]);
+    }
+}
+
+void printsched() {
+    char buf[512];
+    int fd, n;
+
+    if ((fd = open("statistics", O_RDWR)) < 0) return;
+    write(fd, "sched", 5);
+    while ((n = read(fd, buf, sizeof(buf))) > 0) write(1, buf, n);
+    close(fd);
+}
+
+int main(int argc, char *argv[]) {
+    int go[2], nproc = 0;
+    struct result r;
+
+    if (pipe(go) < 0 || pipe(results) < 0) {
+        printf("schedbench: pipe failed\n");
+        exit(-1);
+    }
+
+    for (int i = 0; i < NHOG; i++, nproc++) spawn(go, hog);
+
+    for (int i = 0; i < NPAIR; i++) {
+        int ab[2], ba[2];
+        if (pipe(ab) < 0 || pipe(ba) < 0) {
+            printf("schedbench: pipe failed\n");
+            exit(-1);
+        }
+        for (int side = 0; side < 2; side++, nproc++) {
+            int pid = fork();
+            if (pid < 0) {
+                printf("schedbench: fork failed\n");
+                exit(-1);
+            }
+            if (pid == 0) {
+                close(go[1]);
+                close(results[0]);
+                if (side == 0) {
+                    close(ab[0]);
+                    close(ba[1]);
+                    pair(go[0], ba[0], ab[1], 1);
+                } else {
+                    close(ab[1]);
+                    close(ba[0]);
+                    pair(go[0], ab[0], ba[1], 0);
+                }
+            }
+        }
+        close(ab[0]);
+        close(ab[1]);
+        close(ba[0]);
+        close(ba[1]);
+    }
+
+    // start everyone at once.
+    close(go[0]);
+    close(go[1]);
+    close(results[1]);
+
+    int nhog = 0, trips = 0, min = 0, max = 0;
+    uint64 sum = 0, sumsq = 0;
+    while (read(results[0], &r, sizeof(r)) == sizeof(r)) {
+        if (!r.hog) {
+            trips += r.count;
+            continue;
+        }
+        if (nhog == 0 || r.count < min) min = r.count;
+        if (r.count > max) max = r.count;
+        sum += r.count;
+        sumsq += (uint64)r.count * r.count;
+        nhog++;
+    }
+    for (int i = 0; i < nproc; i++) wait(0);
+
+    printf("schedbench: %d hogs, %d pairs, %d ticks\n", NHOG, NPAIR, DURATION);
+    printf("pairs: %d round trips, %d round trips/tick\n", trips,
+           trips / DURATION);
+    if (nhog > 0 && max > 0) {
+        printf("hogs: min/max share %d%%, fairness index %d%%\n",
+               (int)((uint64)min * 100 / max),
+               (int)(sum * sum * 100 / (nhog * sumsq)));
+    }
+    printsched();
+    exit(0);
+}
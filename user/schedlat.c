@@ -0,0 +1,138 @@
+//
+// tests for setpriority() and getpriority(), and a
+// scheduling latency benchmark.
+//
+// Two processes pass a byte back and forth over pipes, as
+// an interactive program and a server might, while NHOG
+// CPU-bound processes compete for the CPUs. Each round trip
+// is timed with the time CSR; the average and the worst
+// show how long a process that wakes up waits to run. The
+// pair runs without hogs, then next to them at nice 0, at
+// nice -10, and in the real-time class.
+//
+
+#include "kernel/types.h"
+#include "kernel/sched.h"
+#include "user/user.h"
+
+#define NHOG 8
+#define NTRIP 2000
+#define CYCLES_PER_US 10  // qemu's time CSR runs at 10MHz
+
+static inline uint64 rdtime() {
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+void err(char *why) {
+    printf("schedlat: %s failed\n", why);
+    exit(1);
+}
+
+void expect(int pid, int class, int prio) {
+    int c, p;
+
+    if (getpriority(pid, &c, &p) < 0) err("getpriority");
+    if (c != class || p != prio) {
+        printf("schedlat: class %d prio %d, expected %d %d\n", c, p, class,
+               prio);
+        exit(1);
+    }
+}
+
+void apitest() {
+    printf("priority: ");
+    expect(0, SCHED_FAIR, 0);
+    if (setpriority(0, SCHED_FAIR, 5) < 0) err("setpriority nice 5");
+    expect(getpid(), SCHED_FAIR, 5);
+
+    if (setpriority(0, SCHED_FAIR, NICE_MAX + 1) != -1) err("nice range");
+    if (setpriority(0, SCHED_RT, RTPRIO_MAX + 1) != -1) err("rtprio range");
+    if (setpriority(0, 7, 0) != -1) err("bad class");
+    if (setpriority(1000000, SCHED_FAIR, 0) != -1) err("bad pid");
+    expect(0, SCHED_FAIR, 5);
+
+    // a child inherits its parent's priority, and can be
+    // changed by its parent.
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        expect(0, SCHED_FAIR, 5);
+        sleep(2);
+        expect(0, SCHED_RT, 3);
+        exit(0);
+    }
+    if (setpriority(pid, SCHED_RT, 3) < 0) err("setpriority child");
+    expect(pid, SCHED_RT, 3);
+    int xstatus;
+    wait(&xstatus);
+    if (xstatus != 0) exit(1);
+
+    if (setpriority(0, SCHED_FAIR, 0) < 0) err("setpriority nice 0");
+    printf("ok\n");
+}
+
+void hog() {
+    for (;;)
+        ;
+}
+
+// run NTRIP round trips at the given priority and print
+// their average and worst time.
+void pingpong(char *name, int class, int prio) {
+    int ping[2], pong[2];
+    uint64 sum = 0, max = 0;
+    char c = 0;
+
+    if (pipe(ping) < 0 || pipe(pong) < 0) err("pipe");
+    if (setpriority(0, class, prio) < 0) err("setpriority");
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1) {
+            if (write(pong[1], &c, 1) != 1) exit(1);
+        }
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+
+    for (int i = 0; i < NTRIP; i++) {
+        uint64 t0 = rdtime();
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+            err("pingpong");
+        uint64 t = rdtime() - t0;
+        sum += t;
+        if (t > max) max = t;
+    }
+    close(ping[1]);
+    close(pong[0]);
+    wait(0);
+    if (setpriority(0, SCHED_FAIR, 0) < 0) err("setpriority");
+
+    printf("%s: round trip avg %d us, max %d us\n", name,
+           (int)(sum / NTRIP / CYCLES_PER_US), (int)(max / CYCLES_PER_US));
+}
+
+int main(int argc, char *argv[]) {
+    int hogs[NHOG];
+
+    apitest();
+    pingpong("no hogs", SCHED_FAIR, 0);
+
+    for (int i = 0; i < NHOG; i++) {
+        if ((hogs[i] = fork()) < 0) err("fork");
+        if (hogs[i] == 0) hog();
+    }
+    pingpong("hogs, nice 0", SCHED_FAIR, 0);
+    pingpong("hogs, nice -10", SCHED_FAIR, -10);
+    pingpong("hogs, real-time", SCHED_RT, RTPRIO_MIN);
+    for (int i = 0; i < NHOG; i++) {
+        kill(hogs[i]);
+        wait(0);
+    }
+    exit(0);
+}
@@ -6,8 +6,18 @@
 #define SZ 4096
 char buf[SZ];
 
-int main(void) {
-    int i, n;
+int main(int argc, char *argv[]) {
+    int i, n, fd;
+
+    // optionally select a report other than the default.
+    if (argc > 1) {
+        if ((fd = open("statistics", O_WRONLY)) < 0 ||
+            write(fd, argv[1], strlen(argv[1])) != strlen(argv[1])) {
+            fprintf(2, "stats: no report %s\n", argv[1]);
+            exit(1);
+        }
+        close(fd);
+    }
 
     while (1) {
         n = statistics(buf, SZ);
@@ -0,0 +1,75 @@
+//
+// system call and context switch benchmark.
+//
+// syscall: a tight loop of getpid() calls, each a round trip
+// to the kernel and back through the trampoline.
+// pingpong: two processes pass a byte back and forth over a
+// pair of pipes, so every round trip is two context switches
+// between address spaces.
+//
+// Run it on a kernel built with and without `make NOASID=1`
+// to see what flushing the TLB on every switch costs. Use
+// CPUS=1 for pingpong to time switches rather than wakeups
+// across harts.
+//
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+#define NSYSCALL 200000
+#define NPINGPONG 10000
+
+void syscallbench() {
+    int t0 = uptime();
+    for (int i = 0; i < NSYSCALL; i++) getpid();
+    int t = uptime() - t0;
+    if (t == 0) t = 1;
+    printf("syscall: %d calls in %d ticks, %d calls/tick\n", NSYSCALL, t,
+           NSYSCALL / t);
+}
+
+void pingpongbench() {
+    int ping[2], pong[2];
+    char c = 0;
+
+    if (pipe(ping) < 0 || pipe(pong) < 0) {
+        printf("switchbench: pipe failed\n");
+        exit(-1);
+    }
+    int pid = fork();
+    if (pid < 0) {
+        printf("switchbench: fork failed\n");
+        exit(-1);
+    }
+    if (pid == 0) {
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1) {
+            if (write(pong[1], &c, 1) != 1) exit(-1);
+        }
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+
+    int t0 = uptime();
+    for (int i = 0; i < NPINGPONG; i++) {
+        if (write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1) {
+            printf("switchbench: pingpong failed\n");
+            exit(-1);
+        }
+    }
+    int t = uptime() - t0;
+    if (t == 0) t = 1;
+    close(ping[1]);
+    close(pong[0]);
+    wait(0);
+    printf("pingpong: %d round trips in %d ticks, %d round trips/tick\n",
+           NPINGPONG, t, NPINGPONG / t);
+}
+
+int main(int argc, char *argv[]) {
+    syscallbench();
+    pingpongbench();
+    exit(0);
+}
@@ -19,9 +19,12 @@ int countfree() {
     int n = 0;
 
     while (1) {
-        if ((uint64)sbrk(PGSIZE) == 0xffffffffffffffff) {
+        char *a = sbrk(PGSIZE);
+        if (a == (char *)0xffffffffffffffff) {
             break;
         }
+        // sbrk() is lazy; touch the page to really allocate it.
+        *a = 1;
         n += PGSIZE;
     }
     sinfo(&info);
@@ -45,10 +48,12 @@ void testmem() {
         exit(1);
     }
 
-    if ((uint64)sbrk(PGSIZE) == 0xffffffffffffffff) {
+    char *a = sbrk(PGSIZE);
+    if (a == (char *)0xffffffffffffffff) {
         printf("sbrk failed");
         exit(1);
     }
+    *a = 1;
 
     sinfo(&info);
 
@@ -0,0 +1,294 @@
+//
+// tests for clone(), join(), futexes and the pthread library.
+//
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/pthread.h"
+
+#define NWORKER 4
+#define NELEM (64 * 1024)
+#define MAP_FAILED ((char *)-1)
+
+char *testname = "???";
+
+void err(char *why) {
+    printf("threadtest: %s failed: %s, pid=%d\n", testname, why, getpid());
+    exit(1);
+}
+
+int a[NELEM];
+
+void *sum(void *arg) {
+    int i = (uint64)arg;
+    uint64 s = 0;
+
+    for (int j = i * (NELEM / NWORKER); j < (i + 1) * (NELEM / NWORKER); j++)
+        s += a[j];
+    return (void *)s;
+}
+
+// threads see the same memory, and join hands back what
+// they return.
+void sumtest() {
+    pthread_t t[NWORKER];
+    uint64 total = 0;
+
+    testname = "sum";
+    printf("%s: ", testname);
+    for (int i = 0; i < NELEM; i++) a[i] = i;
+    for (int i = 0; i < NWORKER; i++) {
+        if (pthread_create(&t[i], sum, (void *)(uint64)i) < 0) err("create");
+    }
+    for (int i = 0; i < NWORKER; i++) {
+        void *s;
+        if (pthread_join(t[i], &s) < 0) err("join");
+        total += (uint64)s;
+    }
+    if (total != (uint64)NELEM * (NELEM - 1) / 2) err("wrong sum");
+    if (pthread_join(t[0], 0) != -1) err("second join");
+    printf("ok\n");
+}
+
+int fd;
+
+void *openfile(void *arg) {
+    if ((fd = open("thread.file", O_CREATE | O_RDWR)) < 0) return (void *)1;
+    if (write(fd, "hi", 2) != 2) return (void *)1;
+    return 0;
+}
+
+void *grow(void *arg) {
+    char *p = sbrk(4096);
+    if (p == (char *)-1) return (void *)1;
+    p[4095] = 1;
+    return p;
+}
+
+// threads share file descriptors, the heap and the current
+// directory.
+void sharetest() {
+    pthread_t t;
+    void *r;
+    char buf[3];
+
+    testname = "share";
+    printf("%s: ", testname);
+    if (pthread_create(&t, openfile, 0) < 0) err("create");
+    if (pthread_join(t, &r) < 0 || r != 0) err("open in thread");
+    if (write(fd, "!", 1) != 1) err("fd opened by a thread");
+    close(fd);
+    if ((fd = open("thread.file", O_RDONLY)) < 0) err("open");
+    if (read(fd, buf, 3) != 3 || memcmp(buf, "hi!", 3) != 0) err("content");
+    close(fd);
+    unlink("thread.file");
+
+    char *top = sbrk(0);
+    if (pthread_create(&t, grow, 0) < 0) err("create");
+    if (pthread_join(t, &r) < 0 || r != top) err("sbrk in thread");
+    if (sbrk(0) != top + 4096 || top[4095] != 1) err("heap not shared");
+    printf("ok\n");
+}
+
+#define NRACE 100
+
+void *reader(void *arg) {
+    int rfd = (uint64)arg;
+    char c;
+
+    while (read(rfd, &c, 1) == 1)
+        ;
+    return 0;
+}
+
+// a thread can close a descriptor while another reads from
+// it; the read keeps the file alive until it returns.
+void closetest() {
+    pthread_t t;
+
+    testname = "close";
+    printf("%s: ", testname);
+    for (int i = 0; i < NRACE; i++) {
+        int rfd = open("README", O_RDONLY);
+        if (rfd < 0) err("open");
+        if (pthread_create(&t, reader, (void *)(uint64)rfd) < 0) err("create");
+        for (volatile int j = 0; j < i * 100; j++)
+            ;
+        if (close(rfd) != 0) err("close");
+        if (pthread_join(t, 0) < 0) err("join");
+        if (close(rfd) != -1) err("second close");
+    }
+    printf("ok\n");
+}
+
+volatile int go;
+
+void *count(void *arg) {
+    volatile int *n = arg;
+
+    for (;;) (*n)++;
+}
+
+void *quit(void *arg) {
+    while (!go)
+        ;
+    exit(7);
+}
+
+// a process has at most NTHREAD threads, and exit() in any
+// of them ends them all.
+void limittest() {
+    pthread_t t[NTHREAD];
+    int n;
+
+    testname = "limit";
+    printf("%s: ", testname);
+    // the child's threads count here, where the parent sees it.
+    int *counter = mmap(0, 4096, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if ((char *)counter == MAP_FAILED) err("mmap");
+    *counter = 0;  // fault it in, so that fork() shares the page
+    go = 0;
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        if (pthread_create(&t[0], quit, 0) < 0) err("create");
+        for (n = 1; n < NTHREAD; n++)
+            if (pthread_create(&t[n], count, counter) < 0) break;
+        if (n != NTHREAD - 1) err("thread limit");
+        // wait() doesn't see threads.
+        if (wait(0) != -1) err("wait saw a thread");
+        go = 1;
+        pthread_join(t[1], 0);  // never returns
+        exit(1);
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != 7) err("exit from a thread");
+    int before = *counter;
+    sleep(2);
+    if (*counter != before) err("a thread outlived its process");
+    munmap(counter, 4096);
+    printf("ok\n");
+}
+
+pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+volatile int counter, ready;
+
+#define NINCR 20000
+
+void *incr(void *arg) {
+    for (int i = 0; i < NINCR; i++) {
+        pthread_mutex_lock(&mutex);
+        counter++;
+        pthread_mutex_unlock(&mutex);
+    }
+    return 0;
+}
+
+void *consume(void *arg) {
+    pthread_mutex_lock(&mutex);
+    while (!ready) pthread_cond_wait(&cond, &mutex);
+    counter++;
+    pthread_mutex_unlock(&mutex);
+    return 0;
+}
+
+int flag;
+
+// a fork() moves flag's page when the parent next stores to
+// it; the waiter must still be woken.
+void *waitflag(void *arg) {
+    int t0 = uptime();
+    while (flag == 0) futex_wait(&flag, 0, 100);
+    return (void *)(uint64)(uptime() - t0 >= 100);
+}
+
+// futex_wait() sleeps only while the word holds the value,
+// and mutexes and condition variables built on it work.
+void futextest() {
+    pthread_t t[NWORKER];
+    int word = 1;
+
+    testname = "futex";
+    printf("%s: ", testname);
+    if (futex_wait(&word, 0, 0) != -1) err("wait on a changed word");
+    int t0 = uptime();
+    if (futex_wait(&word, 1, 2) != -1) err("timeout");
+    if (uptime() - t0 < 2) err("woke before the timeout");
+    if (futex_wait((int *)((char *)&word + 1), 1, 0) != -1) err("unaligned");
+    if (futex_wake(&word, 1) != 0) err("wake without waiters");
+
+    counter = 0;
+    for (int i = 0; i < NWORKER; i++)
+        if (pthread_create(&t[i], incr, 0) < 0) err("create");
+    for (int i = 0; i < NWORKER; i++)
+        if (pthread_join(t[i], 0) < 0) err("join");
+    if (counter != NWORKER * NINCR) err("mutex lost an increment");
+
+    counter = 0;
+    ready = 0;
+    for (int i = 0; i < NWORKER; i++)
+        if (pthread_create(&t[i], consume, 0) < 0) err("create");
+    sleep(1);
+    pthread_mutex_lock(&mutex);
+    ready = 1;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    for (int i = 0; i < NWORKER; i++)
+        if (pthread_join(t[i], 0) < 0) err("join");
+    if (counter != NWORKER) err("broadcast missed a waiter");
+
+    void *r;
+    flag = 0;
+    if (pthread_create(&t[0], waitflag, 0) < 0) err("create");
+    sleep(1);
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) exit(0);
+    wait(0);
+    flag = 1;
+    futex_wake(&flag, 1);
+    if (pthread_join(t[0], &r) < 0) err("join");
+    if (r != 0) err("wakeup lost after fork");
+    printf("ok\n");
+}
+
+// a thread stack has an unmapped guard page below it.
+void guardtest() {
+    testname = "guard";
+    printf("%s: ", testname);
+    if (mmap(0, 4 * 4096, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_ANONYMOUS | MAP_STACK, -1, 2 * 4096) != MAP_FAILED)
+        err("shared stack area");
+    if (mmap(0, 3 * 4096, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 2 * 4096) != MAP_FAILED)
+        err("ragged stack area");
+
+    int pid = fork();
+    if (pid < 0) err("fork");
+    if (pid == 0) {
+        char *s = stackalloc(4096);
+        if (s == 0) err("stackalloc");
+        s[0] = 1;
+        s[4095] = 1;
+        s[-1] = 1;  // into the guard page
+        exit(0);
+    }
+    int xstatus;
+    if (wait(&xstatus) != pid || xstatus != -1) err("guard page was mapped");
+    printf("ok\n");
+}
+
+int main(int argc, char *argv[]) {
+    sumtest();
+    sharetest();
+    closetest();
+    limittest();
+    futextest();
+    guardtest();
+    printf("ALL THREAD TESTS PASSED\n");
+    exit(0);
+}
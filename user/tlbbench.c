@@ -0,0 +1,65 @@
+//
+// TLB reach benchmark.
+//
+// Touches one word in every page of a large region, many
+// times over, once for a heap region, which becomes 2 MiB
+// superpages once every page of it has been touched, and
+// once for an anonymous mmap() region, which is always
+// mapped with 4096-byte pages.
+// Superpages need far fewer TLB entries to cover the region,
+// so the first pass should take fewer ticks.
+//
+
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define REGION (16 * 1024 * 1024)  // bytes in each region
+#define ROUNDS 200                 // passes over each region
+#define STRIDE 67                  // pages between touches, to defeat prefetch
+
+int touch(char *p) {
+    int npages = REGION / PGSIZE;
+    int t0 = uptime();
+
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < npages; i++) {
+            int pg = (i * STRIDE) % npages;
+            p[pg * PGSIZE] += r;
+        }
+    }
+    return uptime() - t0;
+}
+
+int main(int argc, char *argv[]) {
+    char *big, *small;
+
+    // align the break to a superpage so that the whole
+    // region can be mapped with superpages.
+    uint64 brk = (uint64)sbrk(0);
+    if (brk % SUPERPGSIZE) sbrk(SUPERPGSIZE - brk % SUPERPGSIZE);
+    big = sbrk(REGION);
+    if (big == (char *)-1) {
+        printf("tlbbench: sbrk failed\n");
+        exit(-1);
+    }
+
+    small = mmap(0, REGION, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (small == (char *)-1) {
+        printf("tlbbench: mmap failed\n");
+        exit(-1);
+    }
+
+    // fault everything in before timing.
+    memset(big, 0, REGION);
+    memset(small, 0, REGION);
+
+    int tbig = touch(big);
+    int tsmall = touch(small);
+    printf("tlbbench: %d MiB, %d rounds: superpages %d ticks, "
+           "4096-byte pages %d ticks\n",
+           REGION / (1024 * 1024), ROUNDS, tbig, tsmall);
+    exit(0);
+}
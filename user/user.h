@@ -25,6 +25,18 @@ int sleep(int);
 int uptime(void);
 int trace(int);
 int sysinfo(struct sysinfo *);
+void *mmap(void *, int, int, int, int, int);
+int munmap(void *, int);
+int setpriority(int, int, int);
+int getpriority(int, int *, int *);
+int clone(void (*)(void *), void *, void *);
+int join(int, int *);
+int futex_wait(int *, int, int);
+int futex_wake(int *, int);
+int setaffinity(int, int);
+int sigalarm(int, void (*)(void *));
+int sigreturn(void *);
+int exitthread(int) __attribute__((noreturn));
 #ifdef LAB_NET
 int connect(uint32, uint16, uint16);
 #endif
@@ -37,4 +37,16 @@ entry("sbrk");
 entry("sleep");
 entry("uptime");
 entry("trace");
-entry("sysinfo")
+entry("sysinfo");
+entry("mmap");
+entry("munmap");
+entry("setpriority");
+entry("getpriority");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("setaffinity");
+entry("sigalarm");
+entry("sigreturn");
+entry("exitthread");
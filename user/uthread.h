@@ -0,0 +1,12 @@
+// M:N user threads: many uthreads run on a few worker
+// kernel threads, one pinned to each hart. See uthreadlib.c.
+
+struct uthread;
+
+int uthread_init(int);
+struct uthread *uthread_create(void (*)(void *), void *);
+void uthread_yield(void);
+void uthread_exit(void) __attribute__((noreturn));
+void uthread_join(struct uthread *);
+struct uthread *uthread_self(void);
+void uthread_printstats(void);
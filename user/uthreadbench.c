@@ -0,0 +1,228 @@
+//
+// fan-out/fan-in benchmark for the M:N uthread runtime.
+//
+// Each of NROUND rounds, a root thread starts FANOUT tasks
+// and waits for all of them before the next round. A task
+// does NCHUNK chunks of arithmetic and yields between
+// them. The graph runs first on the old uthread scheduler,
+// kept here: a static array of threads with 8KB stacks, one
+// hart, and a linear scan for the next thread to run. Then
+// it runs on the runtime in uthreadlib.c, with one worker
+// per hart. Last, a check that the runtime preempts threads
+// that never yield.
+//
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/uthread.h"
+
+#define NROUND 20
+#define FANOUT 16
+#define NCHUNK 8
+#define CHUNK 20000       // loop iterations per chunk
+#define CYCLES_PER_MS 10000  // qemu's time CSR runs at 10MHz
+
+static inline uint64 rdtime() {
+    uint64 x;
+    asm volatile("rdtime %0" : "=r"(x));
+    return x;
+}
+
+void err(char *why) {
+    printf("uthreadbench: %s failed\n", why);
+    exit(1);
+}
+
+volatile uint64 sink;
+
+// one chunk of a task's work.
+void chunk(int seed) {
+    uint64 x = seed;
+
+    for (int i = 0; i < CHUNK; i++) x = x * 6364136223846793005UL + 1;
+    sink = x;
+}
+
+//
+// the old cooperative scheduler.
+//
+
+#define FREE 0x0
+#define RUNNING 0x1
+#define RUNNABLE 0x2
+
+#define STACK_SIZE 8192
+#define MAX_THREAD (FANOUT + 2)
+
+// registers saved by uthread_switch(), which also does for
+// the old thread_switch().
+struct context {
+    uint64 ra;
+    uint64 sp;
+    uint64 s[12];
+    uint64 tp;
+};
+
+struct thread {
+    struct context context;
+    char stack[STACK_SIZE];
+    int state;
+    int arg;
+};
+struct thread all_thread[MAX_THREAD];
+struct thread *current_thread;
+extern void uthread_switch(struct context *, struct context *);
+
+void thread_init(void) {
+    current_thread = &all_thread[0];
+    current_thread->state = RUNNING;
+}
+
+void thread_schedule(void) {
+    struct thread *t, *next_thread;
+
+    next_thread = 0;
+    t = current_thread + 1;
+    for (int i = 0; i < MAX_THREAD; i++) {
+        if (t >= all_thread + MAX_THREAD) t = all_thread;
+        if (t->state == RUNNABLE) {
+            next_thread = t;
+            break;
+        }
+        t = t + 1;
+    }
+    if (next_thread == 0) err("thread_schedule");
+
+    if (current_thread != next_thread) {
+        next_thread->state = RUNNING;
+        t = current_thread;
+        current_thread = next_thread;
+        uthread_switch(&t->context, &next_thread->context);
+    }
+}
+
+void thread_create(void (*func)(), int arg) {
+    struct thread *t;
+
+    for (t = all_thread; t < all_thread + MAX_THREAD; t++) {
+        if (t->state == FREE) break;
+    }
+    if (t == all_thread + MAX_THREAD) err("thread_create");
+    t->state = RUNNABLE;
+    t->arg = arg;
+    memset(&t->context, 0, sizeof(t->context));
+    t->context.ra = (uint64)func;
+    t->context.sp = (uint64)(t->stack + STACK_SIZE);
+}
+
+void thread_yield(void) {
+    current_thread->state = RUNNABLE;
+    thread_schedule();
+}
+
+int coop_done;
+
+void coop_task() {
+    for (int i = 0; i < NCHUNK; i++) {
+        chunk(current_thread->arg + i);
+        thread_yield();
+    }
+    coop_done++;
+    current_thread->state = FREE;
+    thread_schedule();
+}
+
+void coop_root() {
+    for (int r = 0; r < NROUND; r++) {
+        coop_done = 0;
+        for (int i = 0; i < FANOUT; i++) thread_create(coop_task, i);
+        while (coop_done < FANOUT) thread_yield();
+    }
+    current_thread->state = FREE;
+    thread_schedule();
+}
+
+void coop(void) {
+    thread_init();
+    thread_create(coop_root, 0);
+    // main waits for the root like any other thread.
+    while (all_thread[1].state != FREE) thread_yield();
+}
+
+//
+// the M:N runtime.
+//
+
+void task(void *arg) {
+    int seed = (int)(uint64)arg;
+
+    for (int i = 0; i < NCHUNK; i++) {
+        chunk(seed + i);
+        uthread_yield();
+    }
+}
+
+void root(void *arg) {
+    struct uthread *t[FANOUT];
+
+    for (int r = 0; r < NROUND; r++) {
+        for (int i = 0; i < FANOUT; i++) {
+            if ((t[i] = uthread_create(task, (void *)(uint64)i)) == 0)
+                err("uthread_create");
+        }
+        for (int i = 0; i < FANOUT; i++) uthread_join(t[i]);
+    }
+}
+
+void mn(int nworker) {
+    struct uthread *t;
+
+    if (uthread_init(nworker) < 0) err("uthread_init");
+    if ((t = uthread_create(root, 0)) == 0) err("uthread_create");
+    uthread_join(t);
+}
+
+#define NSPIN (NCPU + 1)  // more than there are workers
+
+volatile int nspinning, flag;
+
+// never yields: all NSPIN can start only if the workers
+// preempt them.
+void spin(void *arg) {
+    __atomic_fetch_add(&nspinning, 1, __ATOMIC_SEQ_CST);
+    while (flag == 0)
+        ;
+}
+
+void setflag(void *arg) {
+    while (nspinning < NSPIN) uthread_yield();
+    flag = 1;
+}
+
+void preempt(void) {
+    struct uthread *t[NSPIN + 1];
+
+    for (int i = 0; i < NSPIN; i++)
+        if ((t[i] = uthread_create(spin, 0)) == 0) err("uthread_create");
+    if ((t[NSPIN] = uthread_create(setflag, 0)) == 0) err("uthread_create");
+    for (int i = 0; i <= NSPIN; i++) uthread_join(t[i]);
+}
+
+int main(int argc, char *argv[]) {
+    uint64 t0;
+
+    printf("uthreadbench: %d rounds of %d tasks\n", NROUND, FANOUT);
+    t0 = rdtime();
+    coop();
+    printf("cooperative, 1 hart: %d ms\n", (int)((rdtime() - t0) / CYCLES_PER_MS));
+
+    t0 = rdtime();
+    mn(NCPU);
+    printf("M:N, %d workers: %d ms\n", NCPU, (int)((rdtime() - t0) / CYCLES_PER_MS));
+    uthread_printstats();
+
+    preempt();
+    printf("preempted %d spinning threads\n", NSPIN);
+    exit(0);
+}
@@ -0,0 +1,355 @@
+// M:N user threads.
+//
+// uthread_init(n) starts n worker threads (pthreads), each
+// pinned to a hart with setaffinity() if there is one for
+// it. Each worker has a run queue of uthreads and runs them
+// one after the other; a worker whose queue is empty steals
+// from the others, and sleeps on a futex when there is
+// nothing to steal. A uthread runs on a stack of USTACK
+// bytes from stackalloc(), with a guard page below it.
+//
+// Switching is cooperative, by uthread_switch() in
+// uthread_switch.S, but every worker also sets a sigalarm()
+// that interrupts whatever uthread it runs every PREEMPT
+// ticks. The handler runs on that uthread's stack, with its
+// registers saved below; it switches away to the worker's
+// scheduler like uthread_yield(), and when the uthread next
+// runs, maybe on another worker, sigreturn() resumes it
+// where it was.
+//
+// tp points at the running uthread, and travels with it:
+// uthread_switch() swaps it along with the stack, and the
+// alarm frame restores it. While a uthread's nopreempt is
+// non-zero, the handler leaves it alone, so that it stays
+// on its worker; the runtime raises it around every switch
+// and every use of the worker. A worker's scheduler runs as
+// a uthread of its own that is never preempted.
+//
+// A uthread that switches away can't put itself back on a
+// run queue, where another worker might start running it
+// while it is still on its stack. It leaves a note in
+// w->post instead, which its worker's scheduler carries out
+// after the switch.
+//
+// The runtime is driven from the first thread or from
+// uthreads. Uthreads must not call malloc() or the pthread
+// functions that use tp, and shouldn't block in the kernel
+// on each other: a uthread preempted while it holds a
+// pthread mutex stalls the worker of any uthread that then
+// waits for it.
+
+#include "kernel/types.h"
+#include "kernel/param.h"
+#include "user/user.h"
+#include "user/pthread.h"
+#include "user/uthread.h"
+
+#define NWORKER NCPU
+#define USTACK (16 * 1024)
+#define PREEMPT 1  // ticks
+
+// callee-saved registers, for uthread_switch().
+struct context {
+    uint64 ra;
+    uint64 sp;
+    uint64 s[12];
+    uint64 tp;
+};
+
+struct uthread {
+    struct context context;
+    void (*fn)(void *);
+    void *arg;
+    struct uthread *next;    // in a run queue
+    struct worker *worker;   // running it; stable while nopreempt != 0
+    int nopreempt;           // don't switch away in the alarm handler
+    int done;                // set once it has exited; a futex word
+    int extjoin;             // a thread outside the runtime waits on done
+    struct uthread *joiner;  // uthread parked in uthread_join(), or DONE
+};
+
+#define DONE ((struct uthread *)1)
+
+// what a worker's scheduler does with the uthread that
+// switched to it.
+enum post { REQUEUE, JOIN, EXIT };
+
+struct worker {
+    struct uthread sched;  // the scheduler's context
+    int id;
+    pthread_t thread;
+
+    pthread_mutex_t lock;  // protects the run queue
+    struct uthread *head;
+    struct uthread *tail;
+    int n;  // queued uthreads; read without the lock as a hint
+
+    enum post post;        // set by the uthread that switched here
+    struct uthread *postt;
+    struct uthread *postarg;
+
+    // statistics, written only by the worker.
+    int nswitch;   // uthreads it switched to
+    int nsteal;    // uthreads it took from other queues
+    int npreempt;  // uthreads it preempted
+    int nidle;     // times it slept for want of work
+};
+
+static struct worker workers[NWORKER];
+static int nworker;
+static int next;     // worker for the next uthread created outside
+static int workseq;  // futex word: bumped whenever work is queued
+static int nidle;    // workers asleep on workseq
+
+extern void uthread_switch(struct context *, struct context *);
+
+struct uthread *uthread_self(void) {
+    struct uthread *t;
+
+    asm volatile("mv %0, tp" : "=r"(t));
+    return t;
+}
+
+static void runqput(struct worker *w, struct uthread *t) {
+    pthread_mutex_lock(&w->lock);
+    t->next = 0;
+    if (w->tail)
+        w->tail->next = t;
+    else
+        w->head = t;
+    w->tail = t;
+    w->n++;
+    pthread_mutex_unlock(&w->lock);
+
+    __atomic_fetch_add(&workseq, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&nidle, __ATOMIC_SEQ_CST) > 0) futex_wake(&workseq, 1);
+}
+
+static struct uthread *runqget(struct worker *w) {
+    struct uthread *t;
+
+    if (__atomic_load_n(&w->n, __ATOMIC_RELAXED) == 0) return 0;
+    pthread_mutex_lock(&w->lock);
+    if ((t = w->head) != 0) {
+        w->head = t->next;
+        if (w->head == 0) w->tail = 0;
+        w->n--;
+    }
+    pthread_mutex_unlock(&w->lock);
+    return t;
+}
+
+// Find a uthread for w to run: its own, or another
+// worker's, the busiest first.
+static struct uthread *findwork(struct worker *w) {
+    struct uthread *t;
+    struct worker *busiest;
+
+    for (;;) {
+        if ((t = runqget(w)) != 0) return t;
+        busiest = 0;
+        for (struct worker *o = workers; o < &workers[nworker]; o++)
+            if (o != w && o->n > 0 && (busiest == 0 || o->n > busiest->n))
+                busiest = o;
+        if (busiest == 0) return 0;
+        if ((t = runqget(busiest)) != 0) {
+            w->nsteal++;
+            return t;
+        }
+    }
+}
+
+// Finish off t, which has exited, and wake whoever joins it.
+// t's stack may be reused as soon as done is set, so after
+// that t is only read, or woken as a futex.
+static void finish(struct worker *w, struct uthread *t) {
+    struct uthread *j = __atomic_exchange_n(&t->joiner, DONE, __ATOMIC_SEQ_CST);
+
+    __atomic_store_n(&t->done, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&t->extjoin, __ATOMIC_SEQ_CST))
+        futex_wake(&t->done, 0x7fffffff);
+    if (j) runqput(w, j);
+}
+
+// Carry out what t asked for when it switched to w.
+static void postswitch(struct worker *w, struct uthread *t) {
+    struct uthread *target, *none = 0;
+
+    switch (w->post) {
+    case REQUEUE:
+        runqput(w, t);
+        break;
+    case JOIN:
+        // park t on target, unless it has already exited.
+        target = w->postarg;
+        if (!__atomic_compare_exchange_n(&target->joiner, &none, t, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+            runqput(w, t);
+        break;
+    case EXIT:
+        finish(w, t);
+        break;
+    }
+}
+
+// Switch from the running uthread t to its worker's
+// scheduler, which then does post. t->nopreempt must be set.
+static void switchout(struct uthread *t, enum post post,
+                      struct uthread *arg) {
+    struct worker *w = t->worker;
+
+    w->post = post;
+    w->postt = t;
+    w->postarg = arg;
+    uthread_switch(&t->context, &w->sched.context);
+}
+
+// Alarm handler: preempt the running uthread, unless it is
+// in the middle of something.
+static void preempt(void *frame) {
+    struct uthread *t = uthread_self();
+
+    if (t && t->nopreempt == 0) {
+        t->nopreempt++;
+        t->worker->npreempt++;
+        switchout(t, REQUEUE, 0);
+        t->nopreempt--;
+    }
+    sigreturn(frame);
+}
+
+// A worker's scheduler: run uthreads, forever.
+static void schedule(struct worker *w) {
+    struct uthread *t;
+
+    for (;;) {
+        int seq = __atomic_load_n(&workseq, __ATOMIC_SEQ_CST);
+        if ((t = findwork(w)) == 0) {
+            // sleep unless work was queued since seq was read.
+            __atomic_fetch_add(&nidle, 1, __ATOMIC_SEQ_CST);
+            w->nidle++;
+            futex_wait(&workseq, seq, 0);
+            __atomic_fetch_sub(&nidle, 1, __ATOMIC_SEQ_CST);
+        } else {
+            t->worker = w;
+            w->nswitch++;
+            uthread_switch(&w->sched.context, &t->context);
+            postswitch(w, w->postt);
+        }
+    }
+}
+
+static void *workermain(void *arg) {
+    struct worker *w = arg;
+
+    setaffinity(0, w->id);  // fails if there is no such hart
+    w->sched.nopreempt = 1;
+    asm volatile("mv tp, %0" : : "r"(&w->sched));
+    sigalarm(PREEMPT, preempt);
+    schedule(w);
+    return 0;
+}
+
+// Start n workers. Returns 0, or -1 if none could start.
+int uthread_init(int n) {
+    if (n > NWORKER) n = NWORKER;
+    for (nworker = 0; nworker < n; nworker++) {
+        struct worker *w = &workers[nworker];
+        w->id = nworker;
+        pthread_mutex_init(&w->lock);
+        if (pthread_create(&w->thread, workermain, w) < 0) break;
+    }
+    return nworker > 0 ? 0 : -1;
+}
+
+// every uthread starts here, on its new stack.
+static void uthread_start(void) {
+    struct uthread *t = uthread_self();
+
+    t->nopreempt--;  // switched to with it set
+    t->fn(t->arg);
+    uthread_exit();
+}
+
+// Start a uthread running fn(arg), on the caller's worker
+// if the caller is a uthread. Returns 0 if there is no
+// memory for its stack.
+struct uthread *uthread_create(void (*fn)(void *), void *arg) {
+    struct uthread *t, *me = uthread_self();
+    struct worker *w;
+    char *stack;
+
+    // stackalloc() takes a pthread mutex. If we were switched
+    // away holding it, a uthread that then wanted it would
+    // block our worker in futex_wait().
+    if (me) me->nopreempt++;
+    stack = stackalloc(USTACK);
+    if (me) me->nopreempt--;
+    if (stack == 0) return 0;
+    t = (struct uthread *)stack;
+    memset(t, 0, sizeof(*t));
+    t->fn = fn;
+    t->arg = arg;
+    t->nopreempt = 1;
+    t->context.ra = (uint64)uthread_start;
+    t->context.sp = (uint64)(stack + USTACK) & ~0xfL;
+    t->context.tp = (uint64)t;
+
+    if (me) {
+        me->nopreempt++;
+        runqput(me->worker, t);
+        me->nopreempt--;
+    } else {
+        w = &workers[__atomic_fetch_add(&next, 1, __ATOMIC_RELAXED) % nworker];
+        runqput(w, t);
+    }
+    return t;
+}
+
+// Let the other uthreads of the caller's worker run.
+void uthread_yield(void) {
+    struct uthread *t = uthread_self();
+
+    if (t == 0) return;
+    t->nopreempt++;
+    switchout(t, REQUEUE, 0);
+    t->nopreempt--;
+}
+
+void uthread_exit(void) {
+    struct uthread *t = uthread_self();
+
+    t->nopreempt++;
+    switchout(t, EXIT, 0);
+    for (;;)
+        ;  // not reached
+}
+
+// Wait for t to exit, and free it. A uthread parks until
+// then; a thread outside the runtime sleeps on t->done.
+// Only one thread may join t.
+void uthread_join(struct uthread *t) {
+    struct uthread *me = uthread_self();
+
+    if (me == 0) {
+        __atomic_store_n(&t->extjoin, 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&t->done, __ATOMIC_SEQ_CST) == 0)
+            futex_wait(&t->done, 0, 0);
+    } else {
+        me->nopreempt++;
+        switchout(me, JOIN, t);
+        me->nopreempt--;
+        // finish() may still be between its two stores.
+        while (__atomic_load_n(&t->done, __ATOMIC_SEQ_CST) == 0) uthread_yield();
+    }
+    if (me) me->nopreempt++;
+    stackfree(t, USTACK);
+    if (me) me->nopreempt--;
+}
+
+void uthread_printstats(void) {
+    for (struct worker *w = workers; w < &workers[nworker]; w++) {
+        printf("worker %d: switches %d, steals %d, preemptions %d, idle %d\n",
+               w->id, w->nswitch, w->nsteal, w->npreempt, w->nidle);
+    }
+}